@@ -0,0 +1,450 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include "stb_image.h"
+
+#include "Debug.h"
+#include "Scene.h"
+#include "TextureCache.h"
+#include "ImGuiRenderer.h"
+
+// texture decoded on a worker thread, waiting to be uploaded on the context thread
+struct TextureRequest
+{
+	std::string filename;
+	MipChain mips;
+	bool srgb = true;
+	bool loaded = false;
+
+	unsigned int texture_id = 0;
+	int size_class = 0; // texture array of a material map, see Scene::map_classes
+	int layer = 0;
+
+	std::atomic<bool> decoded{ false };
+	std::atomic<bool> resampled{ false };
+	bool uploaded = false;
+};
+
+// object parsed on a worker thread, waiting to be merged into the scene
+struct ObjectRequest
+{
+	std::string path;
+	std::string filename;
+	glm::vec3 offset;
+	glm::vec3 scale;
+
+	ObjectData data;
+	double parse_ms = 0.0; // time on the worker thread
+
+	std::atomic<bool> parsed{ false };
+};
+
+// loads objects and textures on a pool of worker threads. Only the GL uploads and the
+// scene merges happen on the context thread, in update(), so the window can keep
+// rendering a progress bar while everything loads. Textures referenced by materials are
+// queued as objects are merged, then grouped into size classes, resampled to the largest
+// size in their class, and uploaded into the scene's color and data texture arrays once
+// every object is in.
+class AssetLoader
+{
+	static const int max_array_size = 2048;
+
+	Scene* scene;
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex job_mutex;
+	std::condition_variable job_condition;
+	bool stopping;
+
+	std::vector<TextureRequest*> textures;
+	std::vector<ObjectRequest*> objects;
+
+	// material texture array layers
+	std::vector<TextureRequest*> color_layers;
+	std::vector<TextureRequest*> data_layers;
+	bool layers_resampling;
+	bool arrays_built;
+
+	std::atomic<int> jobs_done;
+	int jobs_total;
+	unsigned int textures_uploaded;
+	unsigned int objects_merged;
+
+	void workerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(job_mutex);
+				job_condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping)
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+			jobs_done++;
+		}
+	}
+
+	void addJob(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(job_mutex);
+			jobs.push(std::move(job));
+		}
+		jobs_total++;
+		job_condition.notify_one();
+	}
+
+	void uploadTexture(TextureRequest* texture)
+	{
+		glGenTextures(1, &texture->texture_id);
+
+		if (texture->loaded)
+		{
+			MipChain& mips = texture->mips;
+
+			glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			for (unsigned int i = 0; i < mips.levels.size(); ++i)
+				glTexImage2D(GL_TEXTURE_2D, i, GL_SRGB, mips.levelWidth(i), mips.levelHeight(i), 0, GL_RGB, GL_UNSIGNED_BYTE, mips.levels[i].data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mips.levels.size() - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+			texture->mips = MipChain();
+		}
+		else
+		{
+			std::cout << "Texture failed to load at path: " << texture->filename << std::endl;
+		}
+		texture->uploaded = true;
+		textures_uploaded++;
+	}
+
+	void queueLayers(std::vector<TextureRequest*>& layers, std::vector<std::string>& files, bool srgb)
+	{
+		for (unsigned int i = layers.size(); i < files.size(); ++i)
+		{
+			TextureRequest* texture = new TextureRequest();
+			texture->filename = files[i];
+			texture->srgb = srgb;
+			layers.push_back(texture);
+
+			addJob([texture]() {
+				texture->loaded = TextureCache::load(texture->filename, texture->mips, texture->srgb);
+				if (!texture->loaded)
+				{
+					// missing maps become a white layer
+					texture->mips = MipChain();
+					texture->mips.srgb = texture->srgb;
+					texture->mips.width = texture->mips.height = 1;
+					texture->mips.levels.emplace_back(3, (unsigned char)255);
+				}
+				texture->decoded = true;
+			});
+		}
+	}
+
+	// slot of each texture file in the arrays, as Scene::setMaterialTextures takes them
+	static std::vector<int> mapSlots(std::vector<TextureRequest*>& layers)
+	{
+		std::vector<int> slots(layers.size());
+		for (unsigned int i = 0; i < layers.size(); ++i)
+			slots[i] = layers[i]->size_class << 16 | layers[i]->layer;
+		return slots;
+	}
+
+	bool layersDecoded(std::vector<TextureRequest*>& layers)
+	{
+		for (unsigned int i = 0; i < layers.size(); ++i)
+		{
+			if (!layers[i]->decoded)
+				return false;
+		}
+		return true;
+	}
+
+	bool layersResampled(std::vector<TextureRequest*>& layers)
+	{
+		for (unsigned int i = 0; i < layers.size(); ++i)
+		{
+			if (!layers[i]->resampled)
+				return false;
+		}
+		return true;
+	}
+
+	// smallest class whose arrays fit the map, larger maps are scaled down into the last one
+	static int sizeClass(const MipChain& mips)
+	{
+		int side = glm::max(mips.width, mips.height);
+		int size_class = 0;
+		while (size_class + 1 < Scene::map_classes && side > Scene::map_class_size << size_class)
+			size_class++;
+		return size_class;
+	}
+
+	glm::ivec2 arraySize(std::vector<TextureRequest*>& layers, int size_class)
+	{
+		glm::ivec2 size = glm::ivec2(1, 1);
+		for (unsigned int i = 0; i < layers.size(); ++i)
+		{
+			if (layers[i]->size_class != size_class)
+				continue;
+			size.x = glm::max(size.x, layers[i]->mips.width);
+			size.y = glm::max(size.y, layers[i]->mips.height);
+		}
+		size.x = glm::min(size.x, max_array_size);
+		size.y = glm::min(size.y, max_array_size);
+		return size;
+	}
+
+	void queueResample(std::vector<TextureRequest*>& layers)
+	{
+		int layer_counts[Scene::map_classes] = {};
+		for (unsigned int i = 0; i < layers.size(); ++i)
+		{
+			layers[i]->size_class = sizeClass(layers[i]->mips);
+			layers[i]->layer = layer_counts[layers[i]->size_class]++;
+		}
+
+		glm::ivec2 sizes[Scene::map_classes];
+		for (int i = 0; i < Scene::map_classes; ++i)
+			sizes[i] = arraySize(layers, i);
+
+		for (unsigned int i = 0; i < layers.size(); ++i)
+		{
+			TextureRequest* texture = layers[i];
+			glm::ivec2 size = sizes[texture->size_class];
+			addJob([texture, size]() {
+				MipChain resampled;
+				TextureCache::resample(texture->mips, size.x, size.y, resampled);
+				texture->mips = std::move(resampled);
+				texture->resampled = true;
+			});
+		}
+	}
+
+	// texture array of the maps in one size class
+	unsigned int uploadArray(std::vector<TextureRequest*>& all_layers, bool srgb, int size_class)
+	{
+		std::vector<TextureRequest*> layers;
+		for (unsigned int i = 0; i < all_layers.size(); ++i)
+		{
+			if (all_layers[i]->size_class == size_class)
+				layers.push_back(all_layers[i]);
+		}
+
+		unsigned int texture_id;
+		glGenTextures(1, &texture_id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		GLenum internal_format = srgb ? GL_SRGB8 : GL_RGB8;
+		if (layers.empty())
+		{
+			// keep a valid texture bound even when no material has maps
+			unsigned char white[3] = { 255, 255, 255 };
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, 1, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, white);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+		}
+		else
+		{
+			MipChain& first = layers[0]->mips;
+			int num_levels = first.levels.size();
+			for (int level = 0; level < num_levels; ++level)
+			{
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, first.levelWidth(level), first.levelHeight(level), layers.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+				for (unsigned int i = 0; i < layers.size(); ++i)
+				{
+					MipChain& mips = layers[i]->mips;
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, i, mips.levelWidth(level), mips.levelHeight(level), 1, GL_RGB, GL_UNSIGNED_BYTE, mips.levels[level].data());
+				}
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+
+			for (unsigned int i = 0; i < layers.size(); ++i)
+			{
+				if (!layers[i]->loaded)
+					std::cout << "Texture failed to load at path: " << layers[i]->filename << std::endl;
+				layers[i]->mips = MipChain();
+				layers[i]->uploaded = true;
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		return texture_id;
+	}
+
+public:
+	AssetLoader(Scene* scene) : scene(scene), stopping(false), layers_resampling(false), arrays_built(false), jobs_done(0), jobs_total(0), textures_uploaded(0), objects_merged(0)
+	{
+		// stb_image keeps the flip flag globally, so it is set once before any worker decodes
+		stbi_set_flip_vertically_on_load(true);
+
+		unsigned int num_threads = std::thread::hardware_concurrency();
+		if (num_threads == 0)
+			num_threads = 4;
+		for (unsigned int i = 0; i < num_threads; ++i)
+			workers.emplace_back(&AssetLoader::workerLoop, this);
+	}
+
+	~AssetLoader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(job_mutex);
+			stopping = true;
+		}
+		job_condition.notify_all();
+		for (unsigned int i = 0; i < workers.size(); ++i)
+			workers[i].join();
+
+		for (unsigned int i = 0; i < textures.size(); ++i)
+			delete(textures[i]);
+		for (unsigned int i = 0; i < objects.size(); ++i)
+			delete(objects[i]);
+		for (unsigned int i = 0; i < color_layers.size(); ++i)
+			delete(color_layers[i]);
+		for (unsigned int i = 0; i < data_layers.size(); ++i)
+			delete(data_layers[i]);
+	}
+
+	// queues a texture to be decoded and mipmapped, returns a handle for getTexture()
+	int loadTexture(const std::string& filename)
+	{
+		TextureRequest* texture = new TextureRequest();
+		texture->filename = filename;
+		textures.push_back(texture);
+
+		addJob([texture]() {
+			texture->loaded = TextureCache::load(texture->filename, texture->mips);
+			texture->decoded = true;
+		});
+
+		return textures.size() - 1;
+	}
+
+	// queues an object to be parsed, objects are merged into the scene in the order they were queued
+	void loadObject(const std::string& path, const std::string& filename, glm::vec3 offset, glm::vec3 scale)
+	{
+		ObjectRequest* object = new ObjectRequest();
+		object->path = path;
+		object->filename = filename;
+		object->offset = offset;
+		object->scale = scale;
+		objects.push_back(object);
+
+		Scene* scene = this->scene;
+		addJob([scene, object]() {
+			auto start = std::chrono::steady_clock::now();
+			scene->parseObject(object->path, object->filename, object->offset, object->scale, object->data);
+			object->parse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			object->parsed = true;
+		});
+	}
+
+	// uploads decoded textures and merges parsed objects, must be called on the context thread
+	void update()
+	{
+		for (unsigned int i = 0; i < textures.size(); ++i)
+		{
+			if (!textures[i]->uploaded && textures[i]->decoded)
+				uploadTexture(textures[i]);
+		}
+
+		while (objects_merged < objects.size() && objects[objects_merged]->parsed)
+		{
+			ObjectRequest* object = objects[objects_merged];
+			dlogln("merging object: " << object->path << object->filename);
+			scene->mergeObject(object->data);
+			object->data = ObjectData();
+			objects_merged++;
+
+			// start decoding maps of the new materials
+			queueLayers(color_layers, scene->color_texture_files, true);
+			queueLayers(data_layers, scene->data_texture_files, false);
+		}
+
+		// texture array size is only known once every object is merged and its maps decoded
+		if (objects_merged == objects.size() && !layers_resampling && layersDecoded(color_layers) && layersDecoded(data_layers))
+		{
+			queueResample(color_layers);
+			queueResample(data_layers);
+			layers_resampling = true;
+		}
+
+		if (layers_resampling && !arrays_built && layersResampled(color_layers) && layersResampled(data_layers))
+		{
+			unsigned int color[Scene::map_classes];
+			unsigned int data[Scene::map_classes];
+			for (int i = 0; i < Scene::map_classes; ++i)
+			{
+				color[i] = uploadArray(color_layers, true, i);
+				data[i] = uploadArray(data_layers, false, i);
+			}
+			scene->setMaterialTextures(color, data, mapSlots(color_layers), mapSlots(data_layers));
+			arrays_built = true;
+		}
+	}
+
+	unsigned int getTexture(int handle)
+	{
+		return textures[handle]->texture_id;
+	}
+
+	// OBJ parse time summed over the objects merged so far, the parses overlap on the workers
+	double parseTime()
+	{
+		double total = 0.0;
+		for (unsigned int i = 0; i < objects_merged; ++i)
+			total += objects[i]->parse_ms;
+		return total;
+	}
+
+	bool isDone()
+	{
+		return textures_uploaded == textures.size() && objects_merged == objects.size() && arrays_built;
+	}
+
+	float getProgress()
+	{
+		int total = jobs_total + textures.size() + objects.size() + 1;
+		return (float)(jobs_done + textures_uploaded + objects_merged + (arrays_built ? 1 : 0)) / (float)total;
+	}
+
+	void ImGuiDisplayProgress()
+	{
+		ImGui::Text("Loading");
+		ImGui::ProgressBar(getProgress());
+		ImGui::Text("Textures: %d / %d", textures_uploaded, (int)textures.size());
+		ImGui::Text("Objects: %d / %d", objects_merged, (int)objects.size());
+		ImGui::Text("Material textures: %d", (int)(color_layers.size() + data_layers.size()));
+	}
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -63,100 +65,325 @@ struct BVHNode
 	}
 };
 
+// Builds a BVH subtree for each object and a small top level tree over the objects. The
+// flattened nodes place each node's first child right after it and store the second
+// child in left, with every object subtree inlined at its top level leaf. An edit only
+// rebuilds or refits the touched object's subtree and the top level.
 class BVH
 {
-	BVHNode* root;
 	Scene* scene;
 
 	void computeAABB(BVHPrimitive& primitive)
 	{
-		glm::vec3 min = glm::vec3(99999.9f);
-		glm::vec3 max = glm::vec3(-99999.9f);
-
-		glm::vec3 vertex = scene->scene_data.vertices[scene->primitives[primitive.index].vertex_a];
-		min.x = glm::min(min.x, vertex.x);
-		min.y = glm::min(min.y, vertex.y);
-		min.z = glm::min(min.z, vertex.z);
-		max.x = glm::max(max.x, vertex.x);
-		max.y = glm::max(max.y, vertex.y);
-		max.z = glm::max(max.z, vertex.z);
-
-		vertex = scene->scene_data.vertices[scene->primitives[primitive.index].vertex_b];
-		min.x = glm::min(min.x, vertex.x);
-		min.y = glm::min(min.y, vertex.y);
-		min.z = glm::min(min.z, vertex.z);
-		max.x = glm::max(max.x, vertex.x);
-		max.y = glm::max(max.y, vertex.y);
-		max.z = glm::max(max.z, vertex.z);
-
-		vertex = scene->scene_data.vertices[scene->primitives[primitive.index].vertex_c];
-		min.x = glm::min(min.x, vertex.x);
-		min.y = glm::min(min.y, vertex.y);
-		min.z = glm::min(min.z, vertex.z);
-		max.x = glm::max(max.x, vertex.x);
-		max.y = glm::max(max.y, vertex.y);
-		max.z = glm::max(max.z, vertex.z);
-
-		primitive.min = min;
-		primitive.max = max;
+		const Primitive& prim = scene->primitives[primitive.index];
+		glm::vec3 a = scene->scene_data.vertices[prim.vertex_a];
+		glm::vec3 b = scene->scene_data.vertices[prim.vertex_b];
+		glm::vec3 c = scene->scene_data.vertices[prim.vertexC()];
+
+		switch (prim.type())
+		{
+		case SPHERE_PRIMITIVE:
+		{
+			float radius = glm::length(b - a);
+			primitive.min = a - glm::vec3(radius);
+			primitive.max = a + glm::vec3(radius);
+			break;
+		}
+		case PLANE_PRIMITIVE:
+			primitive.min = glm::min(glm::min(a, b), glm::min(c, b + c - a));
+			primitive.max = glm::max(glm::max(a, b), glm::max(c, b + c - a));
+			break;
+		case BOX_PRIMITIVE:
+			primitive.min = glm::min(a, b);
+			primitive.max = glm::max(a, b);
+			break;
+		default:
+			primitive.min = glm::min(glm::min(a, b), c);
+			primitive.max = glm::max(glm::max(a, b), c);
+			break;
+		}
+	}
+
+	void setBounds(Node& node, glm::vec3 min, glm::vec3 max)
+	{
+		node.min = min;
+		node.max = max;
+	}
+
+	// bounds of a node's two children
+	void mergeBounds(Node& node, const Node& first, const Node& second)
+	{
+		setBounds(node, glm::min(glm::vec3(first.min), glm::vec3(second.min)), glm::max(glm::vec3(first.max), glm::vec3(second.max)));
+	}
+
+	// recomputes the bounds of the top level nodes bottom up, children come after their parents
+	void refitTopLevel()
+	{
+		for (int i = scene->top_nodes.size() - 1; i >= 0; --i)
+		{
+			int index = scene->top_nodes[i];
+			Node& node = scene->nodes[index];
+			mergeBounds(node, scene->nodes[index + 1], scene->nodes[node.left]);
+			scene->dirty_nodes.add(index, index + 1);
+		}
+	}
+
+	// copies an object's subtree to the end of the flattened nodes
+	void placeObject(SceneObject& object)
+	{
+		object.node_start = scene->num_nodes;
+		for (unsigned int i = 0; i < object.nodes.size(); ++i)
+		{
+			Node node = object.nodes[i];
+			if (node.prim_index == -1)
+				node.left += object.node_start;
+			scene->nodes[scene->num_nodes++] = node;
+		}
+	}
+
+	// parent links of the flattened nodes for the stackless traversal, and the depth of the
+	// tree. Children always come after their parent
+	void linkParents()
+	{
+		std::vector<int> depths(scene->num_nodes, 0);
+		scene->nodes[0].parent = -1;
+		scene->bvh_depth = 0;
+		for (int i = 0; i < scene->num_nodes; ++i)
+		{
+			Node& node = scene->nodes[i];
+			if (node.prim_index > -1)
+			{
+				scene->bvh_depth = glm::max(scene->bvh_depth, depths[i]);
+				continue;
+			}
+			int children[2] = { i + 1, node.left };
+			for (int child : children)
+			{
+				scene->nodes[child].parent = i;
+				depths[child] = depths[i] + 1;
+			}
+		}
+	}
+
+	// emits the top level tree over objects[start, end) depth first, returns the root index
+	int flattenObjects(std::vector<unsigned int>& objects, int start, int end)
+	{
+		if (end - start == 1)
+		{
+			SceneObject& object = scene->objects[objects[start]];
+			int index = scene->num_nodes;
+			placeObject(object);
+			return index;
+		}
+
+		// split the objects at the midpoint of their root centroids, or in half if they overlap
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+		for (int i = start; i < end; ++i)
+		{
+			Node& root = scene->objects[objects[i]].nodes[0];
+			glm::vec3 centroid = 0.5f * glm::vec3(root.min) + 0.5f * glm::vec3(root.max);
+			min = glm::min(min, centroid);
+			max = glm::max(max, centroid);
+		}
+
+		int dim = 0;
+		if (max.y - min.y > max[dim] - min[dim])
+			dim = 1;
+		if (max.z - min.z > max[dim] - min[dim])
+			dim = 2;
+
+		float pmid = (min[dim] + max[dim]) * 0.5f;
+		int mid = std::partition(objects.begin() + start, objects.begin() + end,
+			[this, dim, pmid](unsigned int i) {
+				Node& root = scene->objects[i].nodes[0];
+				return (root.min[dim] + root.max[dim]) * 0.5f < pmid;
+			}
+		) - objects.begin();
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
+
+		int index = scene->num_nodes++;
+		scene->top_nodes.push_back(index);
+
+		flattenObjects(objects, start, mid);
+		int second = flattenObjects(objects, mid, end);
+
+		Node& node = scene->nodes[index];
+		node.axis = dim;
+		node.left = second;
+		node.prim_count = -1;
+		node.prim_index = -1;
+		node.pad = 0;
+		mergeBounds(node, scene->nodes[index + 1], scene->nodes[second]);
+		return index;
 	}
 
 public:
 	BVH(Scene* scene) : scene(scene)
 	{
-		root = NULL;
+		
 	}
-	void computeBVH()
+
+	// builds every object's subtree and the top level, false if the nodes do not fit
+	bool computeBVH()
 	{
+		for (unsigned int i = 0; i < scene->objects.size(); ++i)
+		{
+			if (!scene->objects[i].removed)
+				buildObject(i);
+		}
+		return flatten();
+	}
+
+	// builds the subtree of one object, reordering the primitives within its range
+	void buildObject(unsigned int index)
+	{
+		SceneObject& object = scene->objects[index];
+		object.nodes.clear();
+		if (object.prim_count == 0)
+			return;
+
 		std::vector<BVHPrimitive> primitives;
-		primitives.reserve(scene->num_primitives);
+		primitives.reserve(object.prim_count);
 
 		// init primitives
-		for (unsigned int i = 0; i < scene->num_primitives; ++i)
+		for (unsigned int i = 0; i < object.prim_count; ++i)
 		{
 			primitives.emplace_back();
-			primitives[i].index = i;
+			primitives[i].index = object.prim_start + i;
 			computeAABB(primitives[i]);
 			primitives[i].centroid = 0.5f * primitives[i].min + 0.5f * primitives[i].max;
 		}
 
-		int total_nodes;
+		int total_nodes = 0;
 		std::vector<int> ordered_prims;
 		ordered_prims.reserve(primitives.size());
-		root = recursiveBuild(primitives, 0, primitives.size(), &total_nodes, ordered_prims);
-
-		/*for (unsigned int i = 0; i < primitives.size(); ++i)
-		{
-			std::cout << "prim: " << primitives[i].index << std::endl;
-			std::cout << "ordr: " << ordered_prims[i] << std::endl;
-		}*/
+		BVHNode* root = recursiveBuild(primitives, 0, primitives.size(), &total_nodes, ordered_prims, object);
+		delete(root);
 
 		std::vector<Primitive> new_primitives;
-		new_primitives.reserve(scene->num_primitives);
+		new_primitives.reserve(object.prim_count);
 		for (unsigned int i = 0; i < ordered_prims.size(); ++i)
 		{
 			new_primitives.push_back(scene->primitives[ordered_prims[i]]);
 		}
-		for (unsigned int i = 0; i < scene->num_primitives; ++i)
+		for (unsigned int i = 0; i < object.prim_count; ++i)
+		{
+			scene->primitives[object.prim_start + i] = new_primitives[i];
+		}
+		scene->dirty_primitives.add(object.prim_start, object.prim_start + object.prim_count);
+	}
+
+	// rebuilds the top level tree and places the object subtrees under it. Returns false and
+	// keeps the current tree if the nodes do not fit
+	bool flatten()
+	{
+		std::vector<unsigned int> objects;
+		int total_nodes = 0;
+		for (unsigned int i = 0; i < scene->objects.size(); ++i)
+		{
+			SceneObject& object = scene->objects[i];
+			if (!object.removed && !object.nodes.empty())
+			{
+				objects.push_back(i);
+				total_nodes += object.nodes.size() + 1;
+			}
+		}
+
+		if (total_nodes > (int)(sizeof(scene->nodes) / sizeof(Node)))
+		{
+			std::cout << "BVH has too many nodes: " << total_nodes << std::endl;
+			return false;
+		}
+
+		// the top level nodes sit between the subtrees, so they can move on any edit. Only
+		// the nodes that changed are uploaded
+		std::vector<Node> previous(scene->nodes, scene->nodes + scene->num_nodes);
+		for (SceneObject& object : scene->objects)
+			object.node_start = -1;
+
+		scene->num_nodes = 0;
+		scene->top_nodes.clear();
+		if (objects.empty())
+		{
+			// empty leaf with inverted bounds so traversal misses it
+			Node& node = scene->nodes[scene->num_nodes++];
+			node.axis = 0;
+			node.left = -1;
+			node.prim_count = 0;
+			node.prim_index = 0;
+			node.pad = 0;
+			setBounds(node, glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()));
+		}
+		else
+		{
+			flattenObjects(objects, 0, objects.size());
+		}
+		linkParents();
+		markChangedNodes(previous);
+		return true;
+	}
+
+	void markChangedNodes(const std::vector<Node>& previous)
+	{
+		int start = -1;
+		for (int i = 0; i < scene->num_nodes; ++i)
+		{
+			bool changed = i >= (int)previous.size() || memcmp(&scene->nodes[i], &previous[i], sizeof(Node)) != 0;
+			if (changed && start < 0)
+				start = i;
+			else if (!changed && start >= 0)
+			{
+				scene->dirty_nodes.add(start, i);
+				start = -1;
+			}
+		}
+		if (start >= 0)
+			scene->dirty_nodes.add(start, scene->num_nodes);
+	}
+
+	// recomputes an object's bounds after its vertices moved. The subtree topology is kept,
+	// offset and scale are axis aligned so the refit tree is as good as a rebuilt one
+	void refitObject(unsigned int index)
+	{
+		SceneObject& object = scene->objects[index];
+		for (int i = object.nodes.size() - 1; i >= 0; --i)
 		{
-			scene->primitives[i] = new_primitives[i];
+			Node& node = object.nodes[i];
+			if (node.prim_index > -1)
+			{
+				glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+				glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+				for (int j = 0; j < node.prim_count; ++j)
+				{
+					BVHPrimitive prim;
+					prim.index = node.prim_index + j;
+					computeAABB(prim);
+					min = glm::min(min, prim.min);
+					max = glm::max(max, prim.max);
+				}
+				setBounds(node, min, max);
+			}
+			else
+			{
+				mergeBounds(node, object.nodes[i + 1], object.nodes[node.left]);
+			}
 		}
 
-		//int new_indices[100000];
-		//for (unsigned int i = 0; i < ordered_prims.size(); ++i)
-		//{
-		//	int index = ordered_prims[i];
-		//	new_indices[i * 3] = scene->mesh.indices[index * 3]; // primitives[index].index * 3;
-		//	new_indices[i * 3 + 1] = scene->mesh.indices[index * 3 + 1];
-		//	new_indices[i * 3 + 2] = scene->mesh.indices[index * 3 + 2];
-		//}
-		//for (unsigned int i = 0; i < scene->mesh.index_size; ++i)
-		//{
-		//	scene->mesh.indices[i] = new_indices[i];
-		//}
+		if (object.node_start < 0)
+			return;
+
+		for (unsigned int i = 0; i < object.nodes.size(); ++i)
+		{
+			scene->nodes[object.node_start + i].min = object.nodes[i].min;
+			scene->nodes[object.node_start + i].max = object.nodes[i].max;
+		}
+		scene->dirty_nodes.add(object.node_start, object.node_start + object.nodes.size());
+		refitTopLevel();
 	}
 	
-	BVHNode* recursiveBuild(std::vector<BVHPrimitive>& primitives, int start, int end, int* total_nodes, std::vector<int>& ordered_prims)
+	BVHNode* recursiveBuild(std::vector<BVHPrimitive>& primitives, int start, int end, int* total_nodes, std::vector<int>& ordered_prims, SceneObject& object)
 	{
 
 		BVHNode* node = new BVHNode();
@@ -164,7 +391,7 @@ public:
 		
 		// compute bounds of all primitives
 		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
-		glm::vec3 max = glm::vec3(std::numeric_limits<float>::min());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
 		for (int i = start; i < end; ++i)
 		{
 			min.x = glm::min(min.x, primitives[i].min.x);
@@ -175,14 +402,15 @@ public:
 			max.z = glm::max(max.z, primitives[i].max.z);
 		}
 
-		scene->nodes[scene->num_nodes] = Node();
-		scene->nodes[scene->num_nodes].min = glm::vec4(min.x, min.y, min.z, 0.0f);
-		scene->nodes[scene->num_nodes].max = glm::vec4(max.x, max.y, max.z, 0.0f);
-		scene->nodes[scene->num_nodes].left = -1;
-		scene->nodes[scene->num_nodes].prim_count = -1;
-		scene->nodes[scene->num_nodes].prim_index = -1;
-		node->linear_index = scene->num_nodes;
-		scene->num_nodes++;
+		node->linear_index = object.nodes.size();
+		object.nodes.emplace_back();
+		setBounds(object.nodes[node->linear_index], min, max);
+		object.nodes[node->linear_index].axis = 0;
+		object.nodes[node->linear_index].left = -1;
+		object.nodes[node->linear_index].prim_count = -1;
+		object.nodes[node->linear_index].prim_index = -1;
+		object.nodes[node->linear_index].parent = -1;
+		object.nodes[node->linear_index].pad = 0;
 
 		int prim_count = end - start;
 		if (prim_count <= 4)
@@ -195,8 +423,8 @@ public:
 				ordered_prims.push_back(prim_num);
 			}
 			node->initLeaf(prim_offset, prim_count, min, max);
-			scene->nodes[node->linear_index].prim_index = prim_offset;// primitives[start].index;
-			scene->nodes[node->linear_index].prim_count = prim_count;
+			object.nodes[node->linear_index].prim_index = object.prim_start + prim_offset;
+			object.nodes[node->linear_index].prim_count = prim_count;
 			return node;
 		}
 		else
@@ -231,7 +459,6 @@ public:
 			int mid = (start + end) / 2;
 			if (min[dim] == max[dim])
 			{
-				//dlogln("here");
 				// create leaf node
 				int prim_offset = ordered_prims.size();
 				for (int i = start; i < end; ++i)
@@ -240,8 +467,8 @@ public:
 					ordered_prims.push_back(prim_num);
 				}
 				node->initLeaf(prim_offset, prim_count, min, max);
-				scene->nodes[node->linear_index].prim_index = prim_offset;// primitives[start].index;
-				scene->nodes[node->linear_index].prim_count = prim_count;
+				object.nodes[node->linear_index].prim_index = object.prim_start + prim_offset;
+				object.nodes[node->linear_index].prim_count = prim_count;
 				return node;
 			}
 			else
@@ -256,23 +483,15 @@ public:
 				);
 				mid = mid_ptr - &primitives[0];
 
-				// equal primitives
-				/*mid = (start + end) / 2;
-				std::nth_element(&primitives[start], &primitives[mid], &primitives[end-1]+1,
-					[dim](const Primitive& a, const Primitive& b) {
-						return a.centroid[dim] < b.centroid[dim];
-					}
-				);*/
-
-				// build children
-				node->initInterior(dim,
-					recursiveBuild(primitives, start, mid, total_nodes, ordered_prims),
-					recursiveBuild(primitives, mid,   end, total_nodes, ordered_prims));
-				scene->nodes[node->linear_index].left = node->left->linear_index;
-				scene->nodes[node->linear_index].axis = dim;
+				// build children in order, the first child must directly follow this node
+				BVHNode* first = recursiveBuild(primitives, start, mid, total_nodes, ordered_prims, object);
+				BVHNode* second = recursiveBuild(primitives, mid, end, total_nodes, ordered_prims, object);
+				node->initInterior(dim, first, second);
+				object.nodes[node->linear_index].left = second->linear_index;
+				object.nodes[node->linear_index].axis = dim;
 			}
 		}
 
 		return node;
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "Debug.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "FrameCapture.h"
+#include "BVH.h"
+#include "AssetLoader.h"
+#include "Profiler.h"
+
+// options of an offline render, see printBatchUsage()
+struct BatchSettings
+{
+	std::string scene_path;
+	std::string output = "render";
+	int width = 1200;
+	int height = 800;
+	int spp = 256;
+	float time_limit = 0.0f; // seconds, 0 renders all spp
+	bool denoise = false;
+	float exposure = 1.0f;
+	int backend = Renderer::COMPUTE_BACKEND;
+	bool headless = false;
+
+	bool camera_set = false;
+	glm::vec3 camera_pos = glm::vec3(0.0f, -25.0f, 5.0f);
+	glm::vec3 camera_front = glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 camera_up = glm::vec3(0.0f, 0.0f, 1.0f);
+};
+
+inline void printBatchUsage()
+{
+	std::cout << "usage: RayTracing --render <scene file> [options]\n"
+		"  -o, --output <path>     output without extension, writes .pfm and .png (render)\n"
+		"  --size <w> <h>          resolution (1200 800)\n"
+		"  --spp <n>               samples per pixel (256)\n"
+		"  --time <seconds>        stop early once the time is spent\n"
+		"  --camera <pos> <front> <up>  nine numbers, overrides the scene camera\n"
+		"  --backend <name>        compute, wavefront or fragment (compute)\n"
+		"  --denoise               filter the result before writing it\n"
+		"  --exposure <e>          tone mapping of the png (1)\n"
+		"  --headless              no display, needs GLFW 3.4 with OSMesa\n"
+		"scene files have one command per line, # starts a comment:\n"
+		"  object <directory> <file.obj> <x y z> <scale x y z>\n"
+		"  environment <image>\n"
+		"  camera <pos> <front> <up>" << std::endl;
+}
+
+// parses the arguments after --render, returns false on a bad command line
+inline bool parseBatchArgs(int argc, char** argv, BatchSettings& settings)
+{
+	if (argc < 3)
+		return false;
+	settings.scene_path = argv[2];
+
+	for (int i = 3; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		// number of values that have to follow the option
+		auto values = [&](int count) { return i + count < argc; };
+
+		if ((arg == "-o" || arg == "--output") && values(1))
+			settings.output = argv[++i];
+		else if (arg == "--size" && values(2))
+		{
+			settings.width = atoi(argv[++i]);
+			settings.height = atoi(argv[++i]);
+		}
+		else if (arg == "--spp" && values(1))
+			settings.spp = atoi(argv[++i]);
+		else if (arg == "--time" && values(1))
+			settings.time_limit = (float)atof(argv[++i]);
+		else if (arg == "--camera" && values(9))
+		{
+			glm::vec3* vectors[] = { &settings.camera_pos, &settings.camera_front, &settings.camera_up };
+			for (glm::vec3* v : vectors)
+			{
+				for (int c = 0; c < 3; ++c)
+					(*v)[c] = (float)atof(argv[++i]);
+			}
+			settings.camera_set = true;
+		}
+		else if (arg == "--backend" && values(1))
+		{
+			std::string name = argv[++i];
+			if (name == "compute")
+				settings.backend = Renderer::COMPUTE_BACKEND;
+			else if (name == "wavefront")
+				settings.backend = Renderer::WAVEFRONT_BACKEND;
+			else if (name == "fragment")
+				settings.backend = Renderer::FRAGMENT_BACKEND;
+			else
+				return false;
+		}
+		else if (arg == "--denoise")
+			settings.denoise = true;
+		else if (arg == "--exposure" && values(1))
+			settings.exposure = (float)atof(argv[++i]);
+		else if (arg == "--headless")
+			settings.headless = true;
+		else
+		{
+			std::cout << "unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+
+	// the extension is picked per file
+	size_t dot = settings.output.find_last_of('.');
+	if (dot != std::string::npos && (settings.output.substr(dot) == ".png" || settings.output.substr(dot) == ".pfm"))
+		settings.output = settings.output.substr(0, dot);
+
+	return settings.width > 0 && settings.height > 0 && settings.spp > 0;
+}
+
+// queues the objects of a scene file on the loader, returns the environment texture
+// handle or -1
+inline int loadSceneFile(const std::string& path, AssetLoader* loader, BatchSettings& settings, bool& ok)
+{
+	ok = false;
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cout << "could not open scene: " << path << std::endl;
+		return -1;
+	}
+
+	int environment = -1;
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+		std::istringstream tokens(line);
+		std::string command;
+		if (!(tokens >> command) || command[0] == '#')
+			continue;
+
+		if (command == "object")
+		{
+			std::string directory, filename;
+			glm::vec3 offset, scale;
+			if (tokens >> directory >> filename >> offset.x >> offset.y >> offset.z >> scale.x >> scale.y >> scale.z)
+			{
+				loader->loadObject(directory, filename, offset, scale);
+				continue;
+			}
+		}
+		else if (command == "environment")
+		{
+			std::string filename;
+			if (tokens >> filename)
+			{
+				environment = loader->loadTexture(filename);
+				continue;
+			}
+		}
+		else if (command == "camera")
+		{
+			glm::vec3 pos, front, up;
+			if (tokens >> pos.x >> pos.y >> pos.z >> front.x >> front.y >> front.z >> up.x >> up.y >> up.z)
+			{
+				// the command line camera wins
+				if (!settings.camera_set)
+				{
+					settings.camera_pos = pos;
+					settings.camera_front = front;
+					settings.camera_up = up;
+				}
+				continue;
+			}
+		}
+		std::cout << "invalid scene command: " << path << "(" << line_number << "): " << line << std::endl;
+		return -1;
+	}
+	ok = true;
+	return environment;
+}
+
+// GL context, scene and renderer of an offline render. The context is an invisible
+// window, with --headless GLFW's null platform creates an OSMesa context so no display
+// is needed
+class BatchRenderer
+{
+	bool glfw_initialized;
+
+public:
+	GLFWwindow* window;
+	Profiler* profiler;
+	Scene* scene;
+	Camera* camera;
+	Renderer* renderer;
+
+	double parse_ms; // OBJ parsing, summed over the loader threads
+	// rays of the last render(), counted when the renderer's ray counters are on
+	unsigned long long primary_rays;
+	unsigned long long secondary_rays;
+
+	BatchRenderer() : glfw_initialized(false), window(NULL), profiler(NULL), scene(NULL), camera(NULL), renderer(NULL), parse_ms(0.0), primary_rays(0), secondary_rays(0)
+	{
+
+	}
+
+	~BatchRenderer()
+	{
+		delete(renderer);
+		delete(camera);
+		delete(scene);
+		delete(profiler);
+		if (glfw_initialized)
+			glfwTerminate();
+	}
+
+	// creates the context, loads the scene and uploads it, false if anything failed
+	bool init(BatchSettings& settings)
+	{
+#ifdef GLFW_PLATFORM_NULL
+		if (settings.headless)
+			glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+		if (settings.headless)
+			std::cout << "--headless needs GLFW 3.4, using a hidden window" << std::endl;
+#endif
+		if (!glfwInit())
+		{
+			std::cout << "Failed to initialize GLFW" << std::endl;
+			return false;
+		}
+		glfw_initialized = true;
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+		if (settings.headless)
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+
+		window = glfwCreateWindow(settings.width, settings.height, "Ray Tracing v3", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			return false;
+		}
+		glfwMakeContextCurrent(window);
+
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return false;
+		}
+
+		profiler = new Profiler();
+		scene = new Scene();
+
+		double load_start = profiler->now();
+		AssetLoader* loader = new AssetLoader(scene);
+		bool scene_ok;
+		int environment = loadSceneFile(settings.scene_path, loader, settings, scene_ok);
+
+		camera = new Camera(settings.camera_pos, settings.camera_front, settings.camera_up);
+		renderer = new Renderer(camera);
+		renderer->createBuffers(settings.width, settings.height);
+		renderer->setBatchMode(settings.backend, settings.denoise);
+
+		if (scene_ok)
+		{
+			while (!loader->isDone())
+			{
+				loader->update();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			if (environment >= 0)
+				scene->setEnvironmentMap(loader->getTexture(environment));
+			renderer->setTextureMaps(!scene->color_texture_files.empty() || !scene->data_texture_files.empty());
+		}
+		parse_ms = loader->parseTime();
+		delete(loader);
+		profiler->addCpuTime("asset load", load_start);
+
+		if (!scene_ok)
+			return false;
+		if (scene->num_primitives == 0)
+		{
+			std::cout << "scene has no primitives: " << settings.scene_path << std::endl;
+			return false;
+		}
+
+		{
+			CpuTimer timer(profiler, "bvh build");
+			BVH* bvh = new BVH(scene);
+			bvh->computeBVH();
+			delete(bvh);
+		}
+		{
+			CpuTimer timer(profiler, "scene upload");
+			scene->createBVHBuffer();
+			scene->createSceneBuffer();
+			scene->createMaterialBuffer();
+			scene->createPrimitiveBuffer();
+			scene->createLightBuffer();
+		}
+		return true;
+	}
+
+	// starts a new image and renders up to spp samples, numbered from sample_offset, or
+	// until time_limit seconds are spent. Returns the seconds spent
+	double render(int spp, float time_limit, int sample_offset = 0)
+	{
+		renderer->resetAccumulate();
+		renderer->setSampleOffset(sample_offset);
+		primary_rays = 0;
+		secondary_rays = 0;
+
+		// every pass is finished before the clock is read so the time limit holds
+		double render_start = profiler->now();
+		double elapsed = 0.0;
+		while (renderer->samples() < spp && (time_limit <= 0.0f || elapsed < time_limit))
+		{
+			renderer->render(scene);
+			glFinish();
+			elapsed = (profiler->now() - render_start) * 1e-6;
+
+			unsigned int primary, secondary;
+			renderer->readRayCounts(primary, secondary);
+			primary_rays += primary;
+			secondary_rays += secondary;
+		}
+		return elapsed;
+	}
+
+	void printLoadStats(const BatchSettings& settings)
+	{
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << "scene: " << settings.scene_path << ", " << scene->num_primitives << " primitives" << std::endl;
+		std::cout << "load " << profiler->cpuTime("asset load") << " ms (parse " << parse_ms << " ms), bvh build " << profiler->cpuTime("bvh build") << " ms, upload " << profiler->cpuTime("scene upload") << " ms" << std::endl;
+	}
+};
+
+inline void printRenderStats(int samples, int width, int height, double seconds)
+{
+	double pixel_samples = (double)samples * width * height;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "rendered " << samples << " spp at " << width << "x" << height << " in " << seconds << " s, "
+		<< samples / seconds << " spp/s, " << pixel_samples / seconds * 1e-6 << " M samples/s" << std::endl;
+}
+
+// Offline render for farm machines: renders a fixed number of samples or until the time
+// runs out, writes the linear result as PFM and a tone mapped PNG and prints timing
+// stats. Returns the process exit code.
+inline int batchRender(int argc, char** argv)
+{
+	BatchSettings settings;
+	if (!parseBatchArgs(argc, argv, settings))
+	{
+		printBatchUsage();
+		return 1;
+	}
+
+	BatchRenderer batch;
+	if (!batch.init(settings))
+		return 1;
+
+	double elapsed = batch.render(settings.spp, settings.time_limit);
+
+	std::vector<glm::vec4> pixels;
+	batch.renderer->readResult(pixels);
+
+	batch.printLoadStats(settings);
+	printRenderStats(batch.renderer->samples(), settings.width, settings.height, elapsed);
+	return writeImages(settings.output, settings.width, settings.height, pixels, settings.exposure) ? 0 : 1;
+}
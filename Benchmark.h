@@ -0,0 +1,378 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#include "BatchRender.h"
+
+// Benchmark over the bundled assets: every scene in Scenes/Benchmark is loaded and
+// rendered with the compute backend from its fixed camera with the random sequences
+// starting at sample 0, so repeated runs trace the same rays. Load, parse and BVH build
+// times, the scene data size, ray and sample throughput and the BVH traversal cost of the
+// primary rays are written as JSON. Given --baseline, they are compared against the results
+// of an earlier run and regressions past the threshold fail the run. Timings depend on the
+// machine, so no baseline is shipped: store one with --save-baseline on the machine that
+// compares against it.
+
+static const char* benchmark_scenes[] = { "bunny", "teapot", "cessna", "shuttle", "turtle", "dragon" };
+
+struct BenchmarkSettings
+{
+	std::string output = "benchmark.json";
+	std::string baseline; // results to compare against, empty to only write the results
+	bool save_baseline = false;
+	float threshold = 10.0f; // percent a metric may get worse
+	int width = 960;
+	int height = 540;
+	int spp = 64;
+	bool headless = false;
+	std::string filter; // only scenes with this name
+};
+
+// one scene's numbers, the JSON keys are the member names
+struct BenchmarkResult
+{
+	std::string name;
+	int primitives = 0;
+	int nodes = 0;
+	double load_ms = 0.0;
+	double parse_ms = 0.0;
+	double bvh_build_ms = 0.0;
+	double scene_bytes = 0.0;
+	double primary_rays = 0.0;
+	double secondary_rays = 0.0;
+	double render_s = 0.0;
+	double spp_per_s = 0.0;
+	double primary_mrays_per_s = 0.0;
+	double secondary_mrays_per_s = 0.0;
+	double nodes_per_ray = 0.0; // mean traversal cost of the primary rays, from the CPU traversal
+	double triangles_per_ray = 0.0;
+};
+
+// how a metric is compared to the baseline. Short timings are noisy, they only count as
+// regressions once they are slack_ms worse as well
+struct BenchmarkMetric
+{
+	const char* key;
+	double BenchmarkResult::* value;
+	bool higher_is_better;
+	double slack;
+};
+
+static const BenchmarkMetric benchmark_metrics[] = {
+	{ "parse_ms", &BenchmarkResult::parse_ms, false, 2.0 },
+	{ "bvh_build_ms", &BenchmarkResult::bvh_build_ms, false, 2.0 },
+	{ "scene_bytes", &BenchmarkResult::scene_bytes, false, 0.0 },
+	{ "spp_per_s", &BenchmarkResult::spp_per_s, true, 0.0 },
+	{ "primary_mrays_per_s", &BenchmarkResult::primary_mrays_per_s, true, 0.0 },
+	{ "secondary_mrays_per_s", &BenchmarkResult::secondary_mrays_per_s, true, 0.0 },
+	{ "nodes_per_ray", &BenchmarkResult::nodes_per_ray, false, 0.0 },
+	{ "triangles_per_ray", &BenchmarkResult::triangles_per_ray, false, 0.0 }
+};
+
+inline void printBenchmarkUsage()
+{
+	std::cout << "usage: RayTracing --benchmark [options]\n"
+		"  -o, --output <file>     results as JSON (benchmark.json)\n"
+		"  --baseline <file>       results to compare against, not compared without one\n"
+		"  --save-baseline         write the results to the --baseline file instead\n"
+		"  --threshold <percent>   allowed regression per metric (10)\n"
+		"  --size <w> <h>          resolution (960 540)\n"
+		"  --spp <n>               samples per pixel (64)\n"
+		"  --scene <name>          only this scene\n"
+		"  --headless              no display, needs GLFW 3.4 with OSMesa" << std::endl;
+}
+
+inline bool parseBenchmarkArgs(int argc, char** argv, BenchmarkSettings& settings)
+{
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		auto values = [&](int count) { return i + count < argc; };
+
+		if ((arg == "-o" || arg == "--output") && values(1))
+			settings.output = argv[++i];
+		else if (arg == "--baseline" && values(1))
+			settings.baseline = argv[++i];
+		else if (arg == "--save-baseline")
+			settings.save_baseline = true;
+		else if (arg == "--threshold" && values(1))
+			settings.threshold = (float)atof(argv[++i]);
+		else if (arg == "--size" && values(2))
+		{
+			settings.width = atoi(argv[++i]);
+			settings.height = atoi(argv[++i]);
+		}
+		else if (arg == "--spp" && values(1))
+			settings.spp = atoi(argv[++i]);
+		else if (arg == "--scene" && values(1))
+			settings.filter = argv[++i];
+		else if (arg == "--headless")
+			settings.headless = true;
+		else
+		{
+			std::cout << "unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+	if (settings.save_baseline && settings.baseline.empty())
+	{
+		std::cout << "--save-baseline needs a --baseline <file>" << std::endl;
+		return false;
+	}
+	return settings.width > 0 && settings.height > 0 && settings.spp > 0;
+}
+
+// loads and renders one benchmark scene, false if it could not be loaded
+inline bool runBenchmarkScene(const std::string& name, const BenchmarkSettings& benchmark, BenchmarkResult& result, std::string& gpu)
+{
+	BatchSettings settings;
+	settings.scene_path = "Scenes/Benchmark/" + name + ".scene";
+	settings.width = benchmark.width;
+	settings.height = benchmark.height;
+	settings.spp = benchmark.spp;
+	settings.headless = benchmark.headless;
+
+	BatchRenderer batch;
+	if (!batch.init(settings))
+		return false;
+	batch.printLoadStats(settings);
+	gpu = (const char*)glGetString(GL_RENDERER);
+
+	// the first pass pays for the driver finishing the shaders
+	batch.renderer->setRayCounters(true);
+	batch.render(1, 0.0f);
+
+	double seconds = batch.render(settings.spp, 0.0f);
+	printRenderStats(batch.renderer->samples(), settings.width, settings.height, seconds);
+
+	result.name = name;
+	result.primitives = batch.scene->num_primitives;
+	result.nodes = batch.scene->num_nodes;
+	result.load_ms = batch.profiler->cpuTime("asset load");
+	result.parse_ms = batch.parse_ms;
+	result.bvh_build_ms = batch.profiler->cpuTime("bvh build");
+	result.scene_bytes = (double)batch.scene->dataBytes();
+	result.primary_rays = (double)batch.primary_rays;
+	result.secondary_rays = (double)batch.secondary_rays;
+	result.render_s = seconds;
+	result.spp_per_s = batch.renderer->samples() / seconds;
+	result.primary_mrays_per_s = result.primary_rays / seconds * 1e-6;
+	result.secondary_mrays_per_s = result.secondary_rays / seconds * 1e-6;
+
+	// the traversal cost does not depend on the GPU, it catches BVH quality changes
+	TraversalHistogram costs;
+	BVHTraversal(batch.scene).primaryCosts(batch.camera, settings.width, settings.height, costs);
+	result.nodes_per_ray = costs.mean(TraversalHistogram::NODES);
+	result.triangles_per_ray = costs.mean(TraversalHistogram::TRIANGLES);
+	return true;
+}
+
+// one scene per line so the baseline can be read back line by line
+inline bool writeBenchmarkJSON(const std::string& path, const BenchmarkSettings& settings, const std::string& gpu, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\n";
+	file << "\"gpu\": \"" << gpu << "\",\n";
+	file << "\"width\": " << settings.width << ",\n";
+	file << "\"height\": " << settings.height << ",\n";
+	file << "\"spp\": " << settings.spp << ",\n";
+	file << "\"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchmarkResult& r = results[i];
+		file << "{\"name\": \"" << r.name << "\", \"primitives\": " << r.primitives << ", \"nodes\": " << r.nodes
+			<< ", \"load_ms\": " << r.load_ms << ", \"parse_ms\": " << r.parse_ms << ", \"bvh_build_ms\": " << r.bvh_build_ms
+			<< ", \"scene_bytes\": " << std::setprecision(0) << r.scene_bytes
+			<< ", \"primary_rays\": " << r.primary_rays << ", \"secondary_rays\": " << r.secondary_rays << std::setprecision(3)
+			<< ", \"render_s\": " << r.render_s << ", \"spp_per_s\": " << r.spp_per_s
+			<< ", \"primary_mrays_per_s\": " << r.primary_mrays_per_s << ", \"secondary_mrays_per_s\": " << r.secondary_mrays_per_s
+			<< ", \"nodes_per_ray\": " << r.nodes_per_ray << ", \"triangles_per_ray\": " << r.triangles_per_ray << "}"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "]\n}\n";
+	return (bool)file;
+}
+
+// value of "key": in a line of a results file, strings without their quotes
+inline bool findJSONValue(const std::string& line, const std::string& key, std::string& value)
+{
+	size_t start = line.find("\"" + key + "\":");
+	if (start == std::string::npos)
+		return false;
+	start = line.find_first_not_of(' ', start + key.size() + 3);
+	if (start == std::string::npos)
+		return false;
+
+	if (line[start] == '"')
+	{
+		size_t end = line.find('"', start + 1);
+		value = line.substr(start + 1, end - start - 1);
+	}
+	else
+	{
+		size_t end = line.find_first_of(",}", start);
+		value = line.substr(start, end - start);
+	}
+	return true;
+}
+
+// reads a file written by writeBenchmarkJSON
+inline bool readBenchmarkJSON(const std::string& path, BenchmarkSettings& settings, std::string& gpu, std::vector<BenchmarkResult>& results)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	std::string line, value;
+	while (std::getline(file, line))
+	{
+		if (findJSONValue(line, "name", value))
+		{
+			BenchmarkResult result;
+			result.name = value;
+			for (const BenchmarkMetric& metric : benchmark_metrics)
+			{
+				if (findJSONValue(line, metric.key, value))
+					result.*metric.value = atof(value.c_str());
+			}
+			results.push_back(result);
+		}
+		else if (findJSONValue(line, "gpu", value))
+			gpu = value;
+		else if (findJSONValue(line, "width", value))
+			settings.width = atoi(value.c_str());
+		else if (findJSONValue(line, "height", value))
+			settings.height = atoi(value.c_str());
+		else if (findJSONValue(line, "spp", value))
+			settings.spp = atoi(value.c_str());
+	}
+	return true;
+}
+
+// prints every metric against the baseline, returns the number of regressions
+inline int compareBenchmark(const std::vector<BenchmarkResult>& results, const std::vector<BenchmarkResult>& baseline, float threshold)
+{
+	int regressions = 0;
+	std::cout << std::fixed << std::setprecision(2);
+	for (const BenchmarkResult& result : results)
+	{
+		const BenchmarkResult* base = NULL;
+		for (const BenchmarkResult& b : baseline)
+		{
+			if (b.name == result.name)
+				base = &b;
+		}
+		if (!base)
+		{
+			std::cout << result.name << ": not in the baseline" << std::endl;
+			continue;
+		}
+
+		for (const BenchmarkMetric& metric : benchmark_metrics)
+		{
+			double now = result.*metric.value;
+			double before = base->*metric.value;
+			if (before <= 0.0)
+				continue;
+
+			// positive change is worse
+			double worse = metric.higher_is_better ? before - now : now - before;
+			double percent = worse / before * 100.0;
+			bool regressed = percent > threshold && worse > metric.slack;
+			if (regressed)
+				regressions++;
+			std::cout << (regressed ? "REGRESSION " : "           ") << result.name << " " << metric.key << ": "
+				<< before << " -> " << now << " (" << fabs(percent) << "% " << (percent > 0.0 ? "worse" : "better") << ")" << std::endl;
+		}
+	}
+	return regressions;
+}
+
+// RayTracing --benchmark [options], returns the process exit code: 1 when a scene failed
+// to load or a metric regressed past the threshold
+inline int benchmark(int argc, char** argv)
+{
+	BenchmarkSettings settings;
+	if (!parseBenchmarkArgs(argc, argv, settings))
+	{
+		printBenchmarkUsage();
+		return 1;
+	}
+
+	std::vector<BenchmarkResult> results;
+	std::string gpu;
+	for (const char* name : benchmark_scenes)
+	{
+		if (!settings.filter.empty() && settings.filter != name)
+			continue;
+
+		BenchmarkResult result;
+		if (!runBenchmarkScene(name, settings, result, gpu))
+		{
+			std::cout << "benchmark scene failed: " << name << std::endl;
+			return 1;
+		}
+		results.push_back(result);
+	}
+
+	if (!writeBenchmarkJSON(settings.output, settings, gpu, results))
+	{
+		std::cout << "could not write " << settings.output << std::endl;
+		return 1;
+	}
+	std::cout << "wrote " << settings.output << std::endl;
+
+	if (settings.baseline.empty())
+	{
+		std::cout << "no --baseline given, not comparing" << std::endl;
+		return 0;
+	}
+
+	// read the baseline before it is replaced
+	BenchmarkSettings base_settings;
+	std::string base_gpu;
+	std::vector<BenchmarkResult> baseline;
+	bool has_baseline = readBenchmarkJSON(settings.baseline, base_settings, base_gpu, baseline);
+
+	if (settings.save_baseline)
+	{
+		if (!writeBenchmarkJSON(settings.baseline, settings, gpu, results))
+		{
+			std::cout << "could not write " << settings.baseline << std::endl;
+			return 1;
+		}
+		std::cout << "saved the baseline to " << settings.baseline << std::endl;
+	}
+
+	if (!has_baseline)
+	{
+		if (settings.save_baseline)
+			return 0;
+		// a missing baseline would otherwise pass every run
+		std::cout << "no baseline at " << settings.baseline << ", run with --save-baseline to store one" << std::endl;
+		return 1;
+	}
+	if (base_settings.width != settings.width || base_settings.height != settings.height || base_settings.spp != settings.spp)
+	{
+		std::cout << "the baseline was run with other settings, not comparing" << std::endl;
+		return 0;
+	}
+	if (base_gpu != gpu)
+		std::cout << "the baseline is from another GPU: " << base_gpu << std::endl;
+
+	int regressions = compareBenchmark(results, baseline, settings.threshold);
+	std::cout << regressions << " regressions past " << settings.threshold << "%" << std::endl;
+	return regressions > 0 ? 1 : 0;
+}
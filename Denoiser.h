@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "ImGuiRenderer.h"
+
+// edge stopping parameters, shared by the GPU and CPU filters
+struct DenoiseSettings
+{
+	int iterations = 5;
+	float color_phi = 16.0f;
+	float normal_phi = 64.0f;
+	float depth_phi = 0.05f; // relative depth difference per pixel of tap distance
+
+	// the color test tightens every iteration as the image gets smoother, and with the
+	// sample count of the pixel as the noise falls
+	float colorPhi(int iteration, float samples) const
+	{
+		return color_phi * powf(0.5f, (float)iteration) / sqrtf(glm::max(samples, 1.0f));
+	}
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) over the accumulated image.
+// Every iteration is a 5x5 B3 spline kernel with the taps spread twice as far as the last,
+// weighted down across color, normal and depth edges from the feature images written by
+// the path tracers. The color is divided by the albedo while filtering so texture detail
+// stays sharp. The CPU filter gives the same result for headless output.
+class Denoiser
+{
+	Shader* atrous_shader;
+
+	// ping-pong targets at the window size, filtered region in the bottom left
+	unsigned int textures[2];
+
+	static glm::vec3 albedoAt(const std::vector<glm::vec4>& albedo, int index)
+	{
+		return glm::max(glm::vec3(albedo[index]), glm::vec3(0.001f));
+	}
+
+public:
+	DenoiseSettings settings;
+	bool enabled;
+
+	Denoiser() : enabled(false)
+	{
+		atrous_shader = new Shader("Shaders/DenoiseCompute.shader");
+		textures[0] = 0;
+		textures[1] = 0;
+	}
+
+	~Denoiser()
+	{
+		delete(atrous_shader);
+		glDeleteTextures(2, textures);
+	}
+
+	void createBuffers(int width, int height)
+	{
+		glDeleteTextures(2, textures);
+		glGenTextures(2, textures);
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+			// linear for the upscale in post processing
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+	}
+
+	// filters the bottom left width x height of color_texture, returns the texture holding
+	// the result. The color alpha is the number of samples of each pixel
+	unsigned int denoise(unsigned int color_texture, unsigned int albedo_texture, unsigned int normal_texture, int width, int height)
+	{
+		atrous_shader->use();
+		atrous_shader->setInt("color_texture", 0);
+		atrous_shader->setInt("albedo_texture", 1);
+		atrous_shader->setInt("normal_texture", 2);
+		atrous_shader->setFloat("normal_phi", settings.normal_phi);
+		atrous_shader->setFloat("depth_phi", settings.depth_phi);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, albedo_texture);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, normal_texture);
+
+		unsigned int input = color_texture;
+		for (int i = 0; i < settings.iterations; ++i)
+		{
+			unsigned int output = textures[i % 2];
+
+			atrous_shader->setInt("step_size", 1 << i);
+			atrous_shader->setInt("first_iteration", i == 0);
+			atrous_shader->setInt("last_iteration", i == settings.iterations - 1);
+			atrous_shader->setFloat("color_phi", settings.colorPhi(i, 1.0f));
+
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, input);
+			glBindImageTexture(0, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+			glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+			input = output;
+		}
+		return input;
+	}
+
+	// same filter on images read back from the GPU, rows of width pixels
+	static void denoiseCPU(int width, int height, const std::vector<glm::vec4>& color, const std::vector<glm::vec4>& albedo, const std::vector<glm::vec4>& normal_depth,
+		std::vector<glm::vec4>& result, const DenoiseSettings& settings)
+	{
+		static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+		// filter the color divided by the albedo
+		std::vector<glm::vec3> input(width * height);
+		for (int i = 0; i < width * height; ++i)
+			input[i] = glm::vec3(color[i]) / albedoAt(albedo, i);
+
+		std::vector<glm::vec3> output(width * height);
+		for (int iteration = 0; iteration < settings.iterations; ++iteration)
+		{
+			int step_size = 1 << iteration;
+
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					int index = y * width + x;
+					glm::vec3 center = input[index];
+					glm::vec4 center_normal_depth = normal_depth[index];
+
+					// misses have nothing to filter against
+					if (center_normal_depth.w <= 0.0f)
+					{
+						output[index] = center;
+						continue;
+					}
+					glm::vec3 normal = glm::normalize(glm::vec3(center_normal_depth));
+					float color_phi = settings.colorPhi(iteration, color[index].w);
+
+					glm::vec3 sum(0.0f);
+					float weight_sum = 0.0f;
+					for (int ty = -2; ty <= 2; ++ty)
+					{
+						for (int tx = -2; tx <= 2; ++tx)
+						{
+							int cx = x + tx * step_size;
+							int cy = y + ty * step_size;
+							if (cx < 0 || cy < 0 || cx >= width || cy >= height)
+								continue;
+
+							int tap = cy * width + cx;
+							glm::vec4 tap_normal_depth = normal_depth[tap];
+							if (tap_normal_depth.w <= 0.0f)
+								continue;
+
+							glm::vec3 color_diff = input[tap] - center;
+							float color_weight = expf(-glm::dot(color_diff, color_diff) / (color_phi * color_phi));
+							float normal_weight = powf(glm::max(glm::dot(normal, glm::normalize(glm::vec3(tap_normal_depth))), 0.0f), settings.normal_phi);
+							float depth_weight = expf(-fabsf(tap_normal_depth.w - center_normal_depth.w) / (settings.depth_phi * center_normal_depth.w * (float)step_size));
+
+							float weight = kernel[abs(tx)] * kernel[abs(ty)] * color_weight * normal_weight * depth_weight;
+							sum += input[tap] * weight;
+							weight_sum += weight;
+						}
+					}
+					output[index] = sum / weight_sum;
+				}
+			}
+			input.swap(output);
+		}
+
+		result.resize(width * height);
+		for (int i = 0; i < width * height; ++i)
+			result[i] = glm::vec4(input[i] * albedoAt(albedo, i), color[i].w);
+	}
+
+	void ImGuiDisplaySettings()
+	{
+		ImGui::Checkbox("Denoise", &enabled);
+		if (enabled)
+		{
+			ImGui::SliderInt("Iterations", &settings.iterations, 1, 5);
+			ImGui::SliderFloat("Color Phi", &settings.color_phi, 0.1f, 100.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Normal Phi", &settings.normal_phi, 1.0f, 256.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Depth Phi", &settings.depth_phi, 0.001f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+		}
+	}
+};
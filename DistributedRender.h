@@ -0,0 +1,498 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include "Socket.h"
+#include "Debug.h"
+#include "Denoiser.h"
+#include "BatchRender.h"
+
+// Distributed rendering: a coordinator splits the samples of one image into jobs of
+// consecutive sample ranges and hands them to worker processes over TCP. Every worker
+// loads the scene file itself, so it has to be reachable at the same path, e.g. on a
+// shared drive. Workers render their range with its own random sequences and send back
+// the HDR image with the denoiser features, the coordinator averages the results weighted
+// by their sample counts. Jobs of workers that disconnect or time out go back to the
+// queue for the others. Messages are a type and length header followed by the payload,
+// all machines are assumed little endian.
+
+enum DistributedMessage
+{
+	HELLO_MESSAGE = 1, // worker -> coordinator, protocol version
+	SCENE_MESSAGE, // coordinator -> worker, render arguments as lines
+	JOB_MESSAGE, // coordinator -> worker, JobMessage
+	RESULT_MESSAGE, // worker -> coordinator, ResultHeader and images
+	DONE_MESSAGE // coordinator -> worker, no more jobs
+};
+
+static const unsigned int distributed_version = 1;
+static const unsigned int max_message_length = 1u << 30;
+
+struct MessageHeader
+{
+	unsigned int type;
+	unsigned int length;
+};
+
+struct JobMessage
+{
+	int job;
+	int sample_offset;
+	int spp;
+	int features; // send albedo and normal images for denoising
+};
+
+// followed by width * height rgb colors, then rgb albedos and normal depths if requested
+struct ResultHeader
+{
+	int job;
+	int samples;
+	int width;
+	int height;
+	int features;
+};
+
+inline bool sendMessage(Socket& socket, unsigned int type, const void* data, size_t length)
+{
+	MessageHeader header = { type, (unsigned int)length };
+	return socket.sendAll(&header, sizeof(header)) && (length == 0 || socket.sendAll(data, length));
+}
+
+inline bool receiveMessage(Socket& socket, unsigned int& type, std::vector<char>& data)
+{
+	MessageHeader header;
+	if (!socket.recvAll(&header, sizeof(header)) || header.length > max_message_length)
+		return false;
+	type = header.type;
+	data.resize(header.length);
+	return header.length == 0 || socket.recvAll(data.data(), header.length);
+}
+
+struct DistributedSettings
+{
+	int port = 7878;
+	int chunk = 32; // samples per job
+	int timeout = 600; // seconds a job may take before it is given to another worker
+	std::vector<std::string> render_args; // the batch arguments, sent to the workers
+};
+
+inline void printDistributedUsage()
+{
+	std::cout << "usage: RayTracing --coordinate <scene file> [--port <n>] [--chunk <spp>] [--timeout <seconds>] [render options]\n"
+		"       RayTracing --worker <host>:<port> [--headless]\n"
+		"the coordinator takes the --render options, workers load the scene from the same path\n"
+		"  --port <n>              port to listen on (7878)\n"
+		"  --chunk <spp>           samples per job (32)\n"
+		"  --timeout <seconds>     reassign a job after this long (600)" << std::endl;
+	printBatchUsage();
+}
+
+// samples of the image, filled in by the connection threads
+class DistributedImage
+{
+	struct Job
+	{
+		int sample_offset;
+		int spp;
+	};
+
+	std::vector<Job> jobs;
+	std::deque<int> pending;
+	int jobs_done;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+
+public:
+	int width;
+	int height;
+	bool features;
+
+	// sums weighted by the sample counts
+	std::vector<glm::vec4> color;
+	std::vector<glm::vec4> albedo;
+	std::vector<glm::vec4> normal_depth;
+	int samples;
+
+	DistributedImage(int width, int height, int spp, int chunk, bool features) : jobs_done(0), width(width), height(height), features(features), samples(0)
+	{
+		for (int offset = 0; offset < spp; offset += chunk)
+		{
+			pending.push_back(jobs.size());
+			jobs.push_back({ offset, glm::min(chunk, spp - offset) });
+		}
+		color.resize(width * height, glm::vec4(0.0f));
+		if (features)
+		{
+			albedo.resize(width * height, glm::vec4(0.0f));
+			normal_depth.resize(width * height, glm::vec4(0.0f));
+		}
+	}
+
+	bool done()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return jobs_done == (int)jobs.size();
+	}
+
+	int numJobs() const
+	{
+		return jobs.size();
+	}
+
+	// waits for a pending job, false once every job is done. Jobs in flight on other
+	// workers can still come back, so an empty queue is not the end
+	bool takeJob(JobMessage& job)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this]() { return !pending.empty() || jobs_done == (int)jobs.size(); });
+		if (pending.empty())
+			return false;
+
+		job.job = pending.front();
+		job.sample_offset = jobs[job.job].sample_offset;
+		job.spp = jobs[job.job].spp;
+		job.features = features;
+		pending.pop_front();
+		return true;
+	}
+
+	void returnJob(int job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push_front(job);
+		}
+		condition.notify_one();
+	}
+
+	// checks a RESULT_MESSAGE against the job and adds it in, false if it does not fit
+	bool addResult(const JobMessage& job, const std::vector<char>& data)
+	{
+		if (data.size() < sizeof(ResultHeader))
+			return false;
+		ResultHeader header;
+		memcpy(&header, data.data(), sizeof(header));
+
+		size_t pixels = (size_t)width * height;
+		size_t floats = pixels * (features ? 10 : 3);
+		if (header.job != job.job || header.samples != job.spp || header.width != width || header.height != height ||
+			header.features != job.features || data.size() != sizeof(ResultHeader) + floats * sizeof(float))
+			return false;
+
+		const float* values = (const float*)(data.data() + sizeof(ResultHeader));
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			float weight = (float)header.samples;
+			for (size_t i = 0; i < pixels; ++i)
+				color[i] += glm::vec4(values[i * 3], values[i * 3 + 1], values[i * 3 + 2], 0.0f) * weight;
+			if (features)
+			{
+				const float* albedo_values = values + pixels * 3;
+				const float* normal_values = values + pixels * 6;
+				for (size_t i = 0; i < pixels; ++i)
+				{
+					albedo[i] += glm::vec4(albedo_values[i * 3], albedo_values[i * 3 + 1], albedo_values[i * 3 + 2], 0.0f) * weight;
+					normal_depth[i] += glm::vec4(normal_values[i * 4], normal_values[i * 4 + 1], normal_values[i * 4 + 2], normal_values[i * 4 + 3]) * weight;
+				}
+			}
+			samples += header.samples;
+			jobs_done++;
+		}
+		condition.notify_all();
+		return true;
+	}
+
+	// averages of everything received, the color alpha is the sample count
+	void resolve(std::vector<glm::vec4>& result_color, std::vector<glm::vec4>& result_albedo, std::vector<glm::vec4>& result_normal_depth)
+	{
+		float inv_samples = 1.0f / (float)glm::max(samples, 1);
+		result_color.resize(color.size());
+		for (size_t i = 0; i < color.size(); ++i)
+		{
+			result_color[i] = color[i] * inv_samples;
+			result_color[i].w = (float)samples;
+		}
+		result_albedo.resize(albedo.size());
+		result_normal_depth.resize(normal_depth.size());
+		for (size_t i = 0; i < albedo.size(); ++i)
+		{
+			result_albedo[i] = albedo[i] * inv_samples;
+			result_normal_depth[i] = normal_depth[i] * inv_samples;
+		}
+	}
+};
+
+// serves one worker until the jobs run out or the worker fails
+inline void serveWorker(Socket* socket, int id, DistributedImage* image, const DistributedSettings* settings)
+{
+	std::vector<char> data;
+	unsigned int type;
+	unsigned int version = 0;
+	if (receiveMessage(*socket, type, data) && type == HELLO_MESSAGE && data.size() == sizeof(version))
+		memcpy(&version, data.data(), sizeof(version));
+	if (version != distributed_version)
+	{
+		std::cout << "worker " << id << ": bad handshake" << std::endl;
+		delete(socket);
+		return;
+	}
+
+	// nothing left to render, the worker does not need to load the scene
+	if (image->done())
+	{
+		sendMessage(*socket, DONE_MESSAGE, NULL, 0);
+		dlogln("worker " << id << " connected after the last job");
+		delete(socket);
+		return;
+	}
+
+	std::string args;
+	for (const std::string& arg : settings->render_args)
+		args += arg + "\n";
+	if (!sendMessage(*socket, SCENE_MESSAGE, args.data(), args.size()))
+	{
+		delete(socket);
+		return;
+	}
+	socket->setTimeout(settings->timeout);
+
+	int jobs = 0;
+	JobMessage job;
+	while (image->takeJob(job))
+	{
+		auto start = std::chrono::steady_clock::now();
+		if (!sendMessage(*socket, JOB_MESSAGE, &job, sizeof(job)) || !receiveMessage(*socket, type, data) || type != RESULT_MESSAGE || !image->addResult(job, data))
+		{
+			std::cout << "worker " << id << " failed, job " << job.job << " goes back to the queue" << std::endl;
+			image->returnJob(job.job);
+			delete(socket);
+			return;
+		}
+		jobs++;
+		dlogln("worker " << id << ": job " << job.job << " (" << job.spp << " spp) in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s");
+	}
+
+	sendMessage(*socket, DONE_MESSAGE, NULL, 0);
+	dlogln("worker " << id << " finished after " << jobs << " jobs");
+	delete(socket);
+}
+
+// RayTracing --coordinate <scene file> [options], returns the process exit code
+inline int coordinateRender(int argc, char** argv)
+{
+	DistributedSettings distributed;
+	std::vector<std::string> args = { argv[0], "--render" };
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--port" && i + 1 < argc)
+			distributed.port = atoi(argv[++i]);
+		else if (arg == "--chunk" && i + 1 < argc)
+			distributed.chunk = glm::max(1, atoi(argv[++i]));
+		else if (arg == "--timeout" && i + 1 < argc)
+			distributed.timeout = atoi(argv[++i]);
+		else
+			args.push_back(arg);
+	}
+
+	std::vector<char*> render_argv;
+	for (std::string& arg : args)
+		render_argv.push_back(&arg[0]);
+	BatchSettings settings;
+	if (!parseBatchArgs(render_argv.size(), render_argv.data(), settings))
+	{
+		printDistributedUsage();
+		return 1;
+	}
+	distributed.render_args.assign(args.begin() + 2, args.end());
+
+	if (!Socket::startup())
+	{
+		std::cout << "could not start sockets" << std::endl;
+		return 1;
+	}
+	Socket server;
+	if (!server.listen(distributed.port))
+	{
+		std::cout << "could not listen on port " << distributed.port << std::endl;
+		return 1;
+	}
+
+	DistributedImage* image = new DistributedImage(settings.width, settings.height, settings.spp, distributed.chunk, settings.denoise);
+	std::cout << "waiting for workers on port " << distributed.port << ", " << image->numJobs() << " jobs of " << distributed.chunk << " spp" << std::endl;
+
+	// connections are served on their own threads until every job is in
+	std::vector<std::thread> connections;
+	auto start = std::chrono::steady_clock::now();
+	while (!image->done())
+	{
+		Socket* client = server.accept(100);
+		if (!client)
+			continue;
+		int id = connections.size();
+		dlogln("worker " << id << " connected");
+		connections.emplace_back(serveWorker, client, id, image, &distributed);
+	}
+	for (std::thread& connection : connections)
+		connection.join();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// workers still waiting in the listen queue are told there is nothing left
+	while (Socket* client = server.accept(0))
+	{
+		client->setTimeout(distributed.timeout);
+		serveWorker(client, connections.size(), image, &distributed);
+	}
+
+	std::vector<glm::vec4> color, albedo, normal_depth;
+	image->resolve(color, albedo, normal_depth);
+	std::vector<glm::vec4> pixels = color;
+	if (settings.denoise)
+	{
+		DenoiseSettings denoise_settings;
+		Denoiser::denoiseCPU(settings.width, settings.height, color, albedo, normal_depth, pixels, denoise_settings);
+	}
+
+	std::cout << connections.size() << " workers" << std::endl;
+	printRenderStats(image->samples, settings.width, settings.height, elapsed);
+	bool written = writeImages(settings.output, settings.width, settings.height, pixels, settings.exposure);
+	delete(image);
+	return written ? 0 : 1;
+}
+
+// RayTracing --worker <host>:<port> [--headless], returns the process exit code
+inline int workerRender(int argc, char** argv)
+{
+	std::string address = argc > 2 ? argv[2] : "";
+	size_t colon = address.find_last_of(':');
+	if (colon == std::string::npos)
+	{
+		printDistributedUsage();
+		return 1;
+	}
+	std::string host = address.substr(0, colon);
+	int port = atoi(address.substr(colon + 1).c_str());
+	bool headless = argc > 3 && std::string(argv[3]) == "--headless";
+
+	if (!Socket::startup())
+	{
+		std::cout << "could not start sockets" << std::endl;
+		return 1;
+	}
+
+	// workers may start before the coordinator
+	Socket socket;
+	for (int attempt = 0; !socket.connect(host, port); ++attempt)
+	{
+		if (attempt == 30)
+		{
+			std::cout << "could not connect to " << address << std::endl;
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+
+	std::vector<char> data;
+	unsigned int type;
+	if (!sendMessage(socket, HELLO_MESSAGE, &distributed_version, sizeof(distributed_version)) || !receiveMessage(socket, type, data))
+	{
+		std::cout << "handshake with " << address << " failed" << std::endl;
+		return 1;
+	}
+	if (type == DONE_MESSAGE)
+	{
+		std::cout << "no jobs left at " << address << std::endl;
+		return 0;
+	}
+	if (type != SCENE_MESSAGE)
+	{
+		std::cout << "handshake with " << address << " failed" << std::endl;
+		return 1;
+	}
+
+	// the arguments of the coordinator, minus its output options
+	std::vector<std::string> args = { argv[0], "--render" };
+	std::string arguments(data.begin(), data.end());
+	size_t line_start = 0;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i] == '\n')
+		{
+			args.push_back(arguments.substr(line_start, i - line_start));
+			line_start = i + 1;
+		}
+	}
+	std::vector<char*> render_argv;
+	for (std::string& arg : args)
+		render_argv.push_back(&arg[0]);
+
+	BatchSettings settings;
+	if (!parseBatchArgs(render_argv.size(), render_argv.data(), settings))
+	{
+		std::cout << "bad render arguments from " << address << std::endl;
+		return 1;
+	}
+	// the coordinator denoises the merged image
+	settings.denoise = false;
+	settings.headless = headless;
+
+	BatchRenderer batch;
+	if (!batch.init(settings))
+		return 1;
+	batch.printLoadStats(settings);
+
+	while (receiveMessage(socket, type, data))
+	{
+		if (type == DONE_MESSAGE)
+			return 0;
+
+		JobMessage job;
+		if (type != JOB_MESSAGE || data.size() != sizeof(job))
+			break;
+		memcpy(&job, data.data(), sizeof(job));
+
+		double elapsed = batch.render(job.spp, 0.0f, job.sample_offset);
+		printRenderStats(job.spp, settings.width, settings.height, elapsed);
+
+		std::vector<glm::vec4> color, albedo, normal_depth;
+		batch.renderer->readAccumulated(color, albedo, normal_depth);
+
+		size_t pixels = color.size();
+		std::vector<char> result(sizeof(ResultHeader) + pixels * (job.features ? 10 : 3) * sizeof(float));
+		ResultHeader header = { job.job, batch.renderer->samples(), settings.width, settings.height, job.features };
+		memcpy(result.data(), &header, sizeof(header));
+		float* values = (float*)(result.data() + sizeof(header));
+		for (size_t i = 0; i < pixels; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				values[i * 3 + c] = color[i][c];
+		}
+		if (job.features)
+		{
+			float* albedo_values = values + pixels * 3;
+			float* normal_values = values + pixels * 6;
+			for (size_t i = 0; i < pixels; ++i)
+			{
+				for (int c = 0; c < 3; ++c)
+					albedo_values[i * 3 + c] = albedo[i][c];
+				for (int c = 0; c < 4; ++c)
+					normal_values[i * 4 + c] = normal_depth[i][c];
+			}
+		}
+
+		if (!sendMessage(socket, RESULT_MESSAGE, result.data(), result.size()))
+			break;
+	}
+	std::cout << "lost the connection to " << address << std::endl;
+	return 1;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Debug.h"
+#include "TextureCache.h"
+
+// alias table entry of one environment map pixel, matches EnvironmentEntry in
+// Shaders/Include/Environment.shader
+struct EnvironmentEntry
+{
+	float probability; // chance to keep this pixel instead of taking the alias
+	int alias;
+	float pdf; // chance the pixel is picked
+	float pad;
+};
+
+// Importance sampling of the equirectangular environment map. Pixels are picked in
+// proportion to their luminance times the solid angle they cover, through an alias table
+// (Vose 1991) so a sample is one lookup on the GPU. The table is built from a small mip of
+// the map and shared by the shaders and CPU code
+class EnvironmentMap
+{
+	static constexpr float pi = 3.14159265f;
+
+	// alias table over the pixel weights, width and height are 0 if they are all 0
+	void buildTable(const std::vector<float>& weights)
+	{
+		int count = width * height;
+		double total = 0.0;
+		for (float w : weights)
+			total += w;
+		entries.assign(count, EnvironmentEntry());
+		if (total <= 0.0)
+		{
+			width = height = 0;
+			entries.clear();
+			return;
+		}
+
+		// pixels scaled so the average is 1, the ones below 1 take the rest from an alias
+		std::vector<float> scaled(count);
+		std::vector<int> small;
+		std::vector<int> large;
+		for (int i = 0; i < count; ++i)
+		{
+			entries[i].pdf = (float)(weights[i] / total);
+			entries[i].alias = i;
+			scaled[i] = (float)(weights[i] / total * count);
+			if (scaled[i] < 1.0f)
+				small.push_back(i);
+			else
+				large.push_back(i);
+		}
+		while (!small.empty() && !large.empty())
+		{
+			int s = small.back();
+			small.pop_back();
+			int l = large.back();
+			entries[s].probability = scaled[s];
+			entries[s].alias = l;
+
+			scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+			if (scaled[l] < 1.0f)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		// what is left is 1 up to rounding
+		for (int i : small)
+			entries[i].probability = 1.0f;
+		for (int i : large)
+			entries[i].probability = 1.0f;
+	}
+
+public:
+	static const int max_width = 512;
+
+	int width;
+	int height;
+	std::vector<EnvironmentEntry> entries;
+
+	EnvironmentMap() : width(0), height(0)
+	{
+
+	}
+
+	// reads back the largest mip of texture that is at most max_width wide, the map is sRGB
+	void build(unsigned int texture)
+	{
+		width = height = 0;
+		entries.clear();
+		if (texture == 0)
+			return;
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		int level = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+		while (width > max_width)
+		{
+			int next_width = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_WIDTH, &next_width);
+			if (next_width == 0)
+				break;
+			level++;
+			width = next_width;
+		}
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+		if (width == 0 || height == 0)
+		{
+			width = height = 0;
+			return;
+		}
+
+		std::vector<unsigned char> pixels(width * height * 3);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, level, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+		std::vector<glm::vec3> radiance(width * height);
+		for (int i = 0; i < width * height; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				radiance[i][c] = TextureCache::srgbToLinear(pixels[i * 3 + c]);
+		}
+		build(width, height, radiance);
+		dlogln("environment sampling: " << width << "x" << height << " from mip " << level);
+	}
+
+	// rows bottom up like the texture, v = 0 is the -z pole
+	void build(int width, int height, const std::vector<glm::vec3>& radiance)
+	{
+		this->width = width;
+		this->height = height;
+		std::vector<float> weights(width * height);
+		for (int y = 0; y < height; ++y)
+		{
+			// rows near the poles cover less solid angle
+			float cos_latitude = cosf(((y + 0.5f) / height - 0.5f) * pi);
+			for (int x = 0; x < width; ++x)
+			{
+				const glm::vec3& c = radiance[y * width + x];
+				weights[y * width + x] = glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * cos_latitude;
+			}
+		}
+		buildTable(weights);
+	}
+
+	bool enabled() const
+	{
+		return width > 0;
+	}
+
+	// texture coordinate of a direction, the mapping of the skybox lookups in the shaders
+	static glm::vec2 uv(const glm::vec3& dir)
+	{
+		float u = (atan2f(dir.y, dir.x) + pi / 2.0f) / (pi * 2.0f);
+		float v = (asinf(glm::clamp(dir.z, -1.0f, 1.0f)) + pi / 2.0f) / pi;
+		return glm::vec2(u - floorf(u), v);
+	}
+
+	static glm::vec3 direction(const glm::vec2& uv)
+	{
+		float phi = uv.x * pi * 2.0f - pi / 2.0f;
+		float latitude = uv.y * pi - pi / 2.0f;
+		return glm::vec3(cosf(latitude) * cosf(phi), cosf(latitude) * sinf(phi), sinf(latitude));
+	}
+
+	// direction for four uniform random numbers and its solid angle density
+	glm::vec3 sample(const glm::vec4& random, float& pdf) const
+	{
+		int count = width * height;
+		int i = glm::min((int)(random.x * count), count - 1);
+		if (random.y >= entries[i].probability)
+			i = entries[i].alias;
+
+		glm::vec2 pixel_uv = glm::vec2((i % width + random.z) / width, (i / width + random.w) / height);
+		glm::vec3 dir = direction(pixel_uv);
+		pdf = this->pdf(dir);
+		return dir;
+	}
+
+	// solid angle density of sample()
+	float pdf(const glm::vec3& dir) const
+	{
+		if (!enabled())
+			return 0.0f;
+		glm::vec2 p = uv(dir);
+		int x = glm::min((int)(p.x * width), width - 1);
+		int y = glm::min((int)(p.y * height), height - 1);
+		float cos_latitude = sqrtf(glm::max(1.0f - dir.z * dir.z, 0.0f));
+		return entries[y * width + x].pdf * width * height / (2.0f * pi * pi * glm::max(cos_latitude, 0.000001f));
+	}
+};
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "stb_image_write.h"
+
+#include "Debug.h"
+#include "ImGuiRenderer.h"
+
+// portable float map, linear RGB with the rows bottom up like GL
+inline bool writePFM(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	// negative scale marks little endian data
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(width * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			for (int c = 0; c < 3; ++c)
+				row[x * 3 + c] = pixels[y * width + x][c];
+		}
+		file.write((const char*)row.data(), row.size() * sizeof(float));
+	}
+	return (bool)file;
+}
+
+// tone mapped and gamma corrected like the post processing shader
+inline bool writePNG(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels, float exposure)
+{
+	std::vector<unsigned char> image(width * height * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		// png rows are top down
+		const glm::vec4* row = &pixels[(height - 1 - y) * width];
+		for (int x = 0; x < width; ++x)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				float value = 1.0f - expf(-row[x][c] * exposure);
+				value = powf(glm::clamp(value, 0.0f, 1.0f), 1.0f / 2.2f);
+				image[(y * width + x) * 3 + c] = (unsigned char)(value * 255.0f + 0.5f);
+			}
+		}
+	}
+	return stbi_write_png(path.c_str(), width, height, 3, image.data(), width * 3) != 0;
+}
+
+// writes <output>.pfm and <output>.png
+inline bool writeImages(const std::string& output, int width, int height, const std::vector<glm::vec4>& pixels, float exposure)
+{
+	std::string pfm = output + ".pfm";
+	std::string png = output + ".png";
+	bool written = writePFM(pfm, width, height, pixels);
+	if (!written)
+		std::cout << "could not write " << pfm << std::endl;
+	if (!writePNG(png, width, height, pixels, exposure))
+	{
+		std::cout << "could not write " << png << std::endl;
+		written = false;
+	}
+	if (written)
+		std::cout << "wrote " << pfm << " and " << png << std::endl;
+	return written;
+}
+
+// pixels read back from the GPU, waiting for the encoder thread
+struct CaptureFrame
+{
+	std::string name; // written as <name>_000000
+	int index = 0;
+	int width = 0;
+	int height = 0;
+	float exposure = 1.0f;
+	int output = 0;
+	bool screenshot = false;
+	bool end = false; // closes the pipe once the frames before it are written
+	std::vector<glm::vec4> pixels; // linear color, rows bottom up
+};
+
+// Gets frames out of the renderer without stalling it. Each capture reads the result
+// texture into one of a ring of pixel buffer objects and sets a fence, the copy finishes on
+// the GPU while the next frames render. Buffers whose fence has signaled are mapped a few
+// frames later and handed to an encoder thread, which writes PNG or PFM sequences or raw
+// RGB frames into the pipe of an external video encoder. Frames are only dropped when the
+// encoder falls behind, never waited for on the render thread.
+class FrameCapture
+{
+public:
+	enum Output
+	{
+		PNG_OUTPUT,
+		PFM_OUTPUT,
+		PIPE_OUTPUT
+	};
+
+private:
+	static const int num_buffers = 3;
+	static const int max_queued = 4; // frames waiting for the encoder before new ones drop
+
+	// a pixel buffer object and the fence of the copy into it
+	struct Readback
+	{
+		unsigned int buffer = 0;
+		size_t size = 0;
+		GLsync fence = NULL;
+		std::string name;
+		int index = 0;
+		int width = 0;
+		int height = 0;
+		float exposure = 1.0f;
+		int output = 0;
+		bool screenshot = false;
+	};
+
+	Readback readbacks[num_buffers];
+	int next_readback; // oldest in flight and the next one to copy into
+	unsigned int framebuffer;
+
+	bool screenshot_requested;
+	bool end_pending; // the pipe closes after the in flight frames
+	int frame_index;
+	int screenshot_index;
+
+	std::thread encoder;
+	std::deque<CaptureFrame*> queue;
+	std::vector<CaptureFrame*> free_frames;
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	bool stopping;
+
+	// only used by the encoder thread
+	FILE* pipe;
+	int pipe_width;
+	int pipe_height;
+
+	int frames_dropped;
+	int stalls; // captures that had to wait for the oldest copy
+	std::atomic<int> frames_written;
+
+	CaptureFrame* takeFrame()
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (free_frames.empty())
+			return new CaptureFrame();
+		CaptureFrame* frame = free_frames.back();
+		free_frames.pop_back();
+		return frame;
+	}
+
+	void queueFrame(CaptureFrame* frame)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			queue.push_back(frame);
+		}
+		queue_condition.notify_one();
+	}
+
+	int queued()
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		return (int)queue.size();
+	}
+
+	int inFlight() const
+	{
+		int count = 0;
+		for (int i = 0; i < num_buffers; ++i)
+			count += readbacks[i].fence != NULL;
+		return count;
+	}
+
+	// maps the oldest finished copies and queues them for the encoder, stops at the first
+	// copy still running so frames stay in order. wait blocks on the oldest one, which can
+	// time out and leave it in flight
+	void retire(bool wait)
+	{
+		bool oldest = true;
+		for (int i = 0; i < num_buffers; ++i)
+		{
+			Readback& readback = readbacks[(next_readback + i) % num_buffers];
+			if (readback.fence == NULL)
+				continue;
+
+			GLuint64 timeout = wait && oldest ? 1000000000ull : 0ull;
+			oldest = false;
+			GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+			if (status == GL_WAIT_FAILED)
+			{
+				// the copy can't be waited on, give up on its frame
+				glDeleteSync(readback.fence);
+				readback.fence = NULL;
+				frames_dropped++;
+				continue;
+			}
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				return;
+			glDeleteSync(readback.fence);
+			readback.fence = NULL;
+
+			// screenshots are never dropped
+			if (!readback.screenshot && queued() >= max_queued)
+			{
+				frames_dropped++;
+				continue;
+			}
+
+			CaptureFrame* frame = takeFrame();
+			frame->name = readback.name;
+			frame->index = readback.index;
+			frame->width = readback.width;
+			frame->height = readback.height;
+			frame->exposure = readback.exposure;
+			frame->output = readback.output;
+			frame->screenshot = readback.screenshot;
+			frame->end = false;
+			frame->pixels.resize(readback.width * readback.height);
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+			void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame->pixels.size() * sizeof(glm::vec4), GL_MAP_READ_BIT);
+			if (data)
+			{
+				memcpy(frame->pixels.data(), data, frame->pixels.size() * sizeof(glm::vec4));
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				queueFrame(frame);
+			}
+			else
+			{
+				std::cout << "could not map capture buffer" << std::endl;
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				free_frames.push_back(frame);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+	}
+
+	// starts the copy of the bottom left width x height of texture into the next buffer
+	void readback(unsigned int texture, int width, int height, float exposure, bool screenshot)
+	{
+		Readback& readback = readbacks[next_readback];
+		if (readback.fence != NULL)
+		{
+			// every buffer is in flight, the oldest copy is a few frames old so this is short.
+			// The buffer can only be reused once its copy is done
+			stalls++;
+			while (readback.fence != NULL)
+				retire(true);
+		}
+
+		readback.name = screenshot ? screenshot_name : output_name;
+		readback.index = screenshot ? screenshot_index++ : frame_index++;
+		readback.width = width;
+		readback.height = height;
+		readback.exposure = exposure;
+		readback.output = output;
+		readback.screenshot = screenshot;
+
+		size_t size = (size_t)width * height * sizeof(glm::vec4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		if (size > readback.size)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			readback.size = size;
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, (void*)0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		next_readback = (next_readback + 1) % num_buffers;
+	}
+
+	static std::string framePath(const CaptureFrame& frame, const char* extension)
+	{
+		std::stringstream path;
+		path << frame.name << "_" << std::setw(6) << std::setfill('0') << frame.index << extension;
+		return path.str();
+	}
+
+	bool openPipe(int width, int height)
+	{
+		// the command gets the frame size in place of {size}
+		std::string command = pipe_command;
+		size_t size_pos = command.find("{size}");
+		if (size_pos != std::string::npos)
+			command.replace(size_pos, 6, std::to_string(width) + "x" + std::to_string(height));
+
+#ifdef _WIN32
+		pipe = _popen(command.c_str(), "wb");
+#else
+		// an encoder that exits should fail the writes, not end the process
+		signal(SIGPIPE, SIG_IGN);
+		pipe = popen(command.c_str(), "w");
+#endif
+		if (!pipe)
+		{
+			std::cout << "could not start capture pipe: " << command << std::endl;
+			return false;
+		}
+		pipe_width = width;
+		pipe_height = height;
+		dlogln("capture pipe " << width << "x" << height << ": " << command);
+		return true;
+	}
+
+	void closePipe()
+	{
+		if (!pipe)
+			return;
+#ifdef _WIN32
+		_pclose(pipe);
+#else
+		pclose(pipe);
+#endif
+		pipe = NULL;
+	}
+
+	// tone mapped rgb24 rows top down, the pipe keeps the size of its first frame so
+	// frames rendered at another resolution are scaled to it
+	bool writePipeFrame(const CaptureFrame& frame, std::vector<unsigned char>& image)
+	{
+		if (!pipe && !openPipe(frame.width, frame.height))
+			return false;
+
+		image.resize(pipe_width * pipe_height * 3);
+		for (int y = 0; y < pipe_height; ++y)
+		{
+			int src_y = (pipe_height - 1 - y) * frame.height / pipe_height;
+			for (int x = 0; x < pipe_width; ++x)
+			{
+				const glm::vec4& pixel = frame.pixels[src_y * frame.width + x * frame.width / pipe_width];
+				for (int c = 0; c < 3; ++c)
+				{
+					float value = 1.0f - expf(-pixel[c] * frame.exposure);
+					value = powf(glm::clamp(value, 0.0f, 1.0f), 1.0f / 2.2f);
+					image[(y * pipe_width + x) * 3 + c] = (unsigned char)(value * 255.0f + 0.5f);
+				}
+			}
+		}
+		return fwrite(image.data(), 1, image.size(), pipe) == image.size();
+	}
+
+	void encoderLoop()
+	{
+		std::vector<unsigned char> image;
+		while (true)
+		{
+			CaptureFrame* frame;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_condition.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty())
+					break;
+				frame = queue.front();
+				queue.pop_front();
+			}
+
+			bool written = true;
+			if (frame->end)
+				closePipe();
+			else if (frame->screenshot)
+				written = writeImages(framePath(*frame, ""), frame->width, frame->height, frame->pixels, frame->exposure);
+			else if (frame->output == PNG_OUTPUT)
+				written = writePNG(framePath(*frame, ".png"), frame->width, frame->height, frame->pixels, frame->exposure);
+			else if (frame->output == PFM_OUTPUT)
+				written = writePFM(framePath(*frame, ".pfm"), frame->width, frame->height, frame->pixels);
+			else
+				written = writePipeFrame(*frame, image);
+
+			if (!frame->end)
+			{
+				if (written)
+					frames_written++;
+				else
+					std::cout << "could not write capture frame " << frame->index << std::endl;
+			}
+
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			free_frames.push_back(frame);
+		}
+		closePipe();
+	}
+
+public:
+	bool recording;
+	int output;
+	std::string output_name; // frames are <name>_000000.png, screenshots use screenshot_name
+	std::string screenshot_name;
+	std::string pipe_command; // reads rgb24 frames from stdin, {size} is the frame size
+
+	FrameCapture() : next_readback(0), framebuffer(0), screenshot_requested(false), end_pending(false), frame_index(0), screenshot_index(0),
+		stopping(false), pipe(NULL), pipe_width(0), pipe_height(0), frames_dropped(0), stalls(0), frames_written(0), recording(false),
+		output(PNG_OUTPUT), output_name("capture"), screenshot_name("screenshot"),
+		pipe_command("ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgb24 -s {size} -r 30 -i - -pix_fmt yuv420p capture.mp4")
+	{
+		glGenFramebuffers(1, &framebuffer);
+		for (int i = 0; i < num_buffers; ++i)
+			glGenBuffers(1, &readbacks[i].buffer);
+
+		encoder = std::thread(&FrameCapture::encoderLoop, this);
+	}
+
+	~FrameCapture()
+	{
+		finish();
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		queue_condition.notify_one();
+		encoder.join();
+
+		for (CaptureFrame* frame : free_frames)
+			delete(frame);
+		for (int i = 0; i < num_buffers; ++i)
+			glDeleteBuffers(1, &readbacks[i].buffer);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+
+	void screenshot()
+	{
+		screenshot_requested = true;
+	}
+
+	void startRecording()
+	{
+		if (recording)
+			return;
+		frame_index = 0;
+		frames_dropped = 0;
+		stalls = 0;
+		frames_written = 0;
+		recording = true;
+	}
+
+	void stopRecording()
+	{
+		if (!recording)
+			return;
+		recording = false;
+		end_pending = true;
+	}
+
+	// call once per frame after rendering with the texture shown, copies it when recording
+	// or when a screenshot was requested and passes finished copies to the encoder
+	void update(unsigned int texture, int width, int height, float exposure)
+	{
+		retire(false);
+
+		if (screenshot_requested)
+		{
+			readback(texture, width, height, exposure, true);
+			screenshot_requested = false;
+		}
+		if (recording)
+			readback(texture, width, height, exposure, false);
+
+		if (end_pending && inFlight() == 0)
+		{
+			CaptureFrame* frame = takeFrame();
+			frame->end = true;
+			queueFrame(frame);
+			end_pending = false;
+		}
+	}
+
+	// waits for the copies in flight and queues them, the encoder finishes them on its own
+	void finish()
+	{
+		stopRecording();
+		while (inFlight() > 0)
+			retire(true);
+		if (end_pending)
+		{
+			CaptureFrame* frame = takeFrame();
+			frame->end = true;
+			queueFrame(frame);
+			end_pending = false;
+		}
+	}
+
+	void ImGuiDisplaySettings()
+	{
+		if (ImGui::Button("Screenshot"))
+			screenshot();
+		ImGui::SameLine();
+		if (ImGui::Button(recording ? "Stop Recording" : "Record Frames"))
+		{
+			if (recording)
+				stopRecording();
+			else
+				startRecording();
+		}
+
+		if (!recording)
+		{
+			static const char* outputs[] = { "PNG Sequence", "PFM Sequence", "Raw Pipe" };
+			ImGui::Combo("Output", &output, outputs, 3);
+		}
+		if (output == PIPE_OUTPUT)
+			ImGui::TextWrapped("%s", pipe_command.c_str());
+
+		ImGui::Text("%d written, %d dropped, %d stalls, %d queued", frames_written.load(), frames_dropped, stalls, queued());
+	}
+};
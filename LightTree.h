@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Debug.h"
+
+// spatial and orientation bounds of one or more emitters. Emitters light both sides, so
+// the normal cone around axis also bounds the opposite cone
+struct LightBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	float power;
+	glm::vec3 axis;
+	float cos_theta_o; // spread of the normals around axis
+	float cos_theta_e; // spread of the emission around each normal
+
+	LightBounds() : min(1e30f), max(-1e30f), power(0.0f), axis(0.0f, 0.0f, 1.0f), cos_theta_o(1.0f), cos_theta_e(1.0f)
+	{
+
+	}
+};
+
+// light tree node, matches LightNode in Shaders/Include/LightTree.shader
+struct LightNode
+{
+	glm::vec4 min; // w is the power
+	glm::vec4 max; // w is cos_theta_o
+	glm::vec4 axis; // w is cos_theta_e
+	int children[2]; // -1 in a leaf
+	int parent; // -1 at the root
+	int light; // index into the light list in a leaf, -1 in an interior node
+};
+
+// Light BVH over the emissive triangles (Conty Estevez and Kulla 2018, as in pbrt-v4). Each
+// node bounds the position, normals, and power of the lights below it, so the importance of
+// a node toward a shading point accounts for distance, orientation, and the horizon of the
+// surface. A light is picked by walking down the tree and choosing a child in proportion to
+// its importance. The interior nodes come first and the leaf of light i is at
+// num_lights - 1 + i, so the probability of a light can be found by walking up from its leaf
+class LightTree
+{
+	static constexpr float pi = 3.14159265f;
+	static const int num_buckets = 12;
+
+	std::vector<LightBounds> leaves;
+	std::vector<int> order;
+	int next_interior;
+
+	static LightBounds merge(const LightBounds& a, const LightBounds& b)
+	{
+		if (a.power == 0.0f && a.min.x > a.max.x)
+			return b;
+		if (b.power == 0.0f && b.min.x > b.max.x)
+			return a;
+
+		LightBounds bounds;
+		bounds.min = glm::min(a.min, b.min);
+		bounds.max = glm::max(a.max, b.max);
+		bounds.power = a.power + b.power;
+		bounds.cos_theta_e = glm::min(a.cos_theta_e, b.cos_theta_e);
+
+		// the cones are two sided, so b may be flipped toward a
+		glm::vec3 b_axis = glm::dot(a.axis, b.axis) < 0.0f ? -b.axis : b.axis;
+		float theta_a = acosf(glm::clamp(a.cos_theta_o, -1.0f, 1.0f));
+		float theta_b = acosf(glm::clamp(b.cos_theta_o, -1.0f, 1.0f));
+		float theta_d = acosf(glm::clamp(glm::dot(a.axis, b_axis), -1.0f, 1.0f));
+		if (glm::min(theta_d + theta_b, pi) <= theta_a)
+		{
+			bounds.axis = a.axis;
+			bounds.cos_theta_o = a.cos_theta_o;
+			return bounds;
+		}
+		if (glm::min(theta_d + theta_a, pi) <= theta_b)
+		{
+			bounds.axis = b_axis;
+			bounds.cos_theta_o = b.cos_theta_o;
+			return bounds;
+		}
+
+		// smallest cone holding both, its axis turned from a's toward b's
+		float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+		glm::vec3 turn = glm::cross(a.axis, b_axis);
+		if (theta_o >= pi || glm::length(turn) < 1e-6f)
+		{
+			bounds.axis = a.axis;
+			bounds.cos_theta_o = -1.0f;
+			return bounds;
+		}
+		turn = glm::normalize(turn);
+		float theta_r = theta_o - theta_a;
+		bounds.axis = a.axis * cosf(theta_r) + glm::cross(turn, a.axis) * sinf(theta_r) + turn * glm::dot(turn, a.axis) * (1.0f - cosf(theta_r));
+		bounds.axis = glm::normalize(bounds.axis);
+		bounds.cos_theta_o = cosf(theta_o);
+		return bounds;
+	}
+
+	// surface area orientation heuristic, thin boxes along the split axis are penalized
+	static float cost(const LightBounds& bounds, const glm::vec3& parent_extent, int axis)
+	{
+		if (bounds.power == 0.0f)
+			return 0.0f;
+		float theta_o = acosf(glm::clamp(bounds.cos_theta_o, -1.0f, 1.0f));
+		float theta_e = acosf(glm::clamp(bounds.cos_theta_e, -1.0f, 1.0f));
+		float theta_w = glm::min(theta_o + theta_e, pi);
+		float sin_theta_o = sinf(theta_o);
+		float m_omega = 2.0f * pi * (1.0f - bounds.cos_theta_o) + pi / 2.0f *
+			(2.0f * theta_w * sin_theta_o - cosf(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + bounds.cos_theta_o);
+
+		glm::vec3 d = bounds.max - bounds.min;
+		float area = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		float max_extent = glm::max(parent_extent.x, glm::max(parent_extent.y, parent_extent.z));
+		float regularize = parent_extent[axis] > 0.0f ? max_extent / parent_extent[axis] : 1.0f;
+		return regularize * bounds.power * m_omega * area;
+	}
+
+	void setNode(int index, const LightBounds& bounds, int parent, int light)
+	{
+		LightNode& node = nodes[index];
+		node.min = glm::vec4(bounds.min, bounds.power);
+		node.max = glm::vec4(bounds.max, bounds.cos_theta_o);
+		node.axis = glm::vec4(bounds.axis, bounds.cos_theta_e);
+		node.children[0] = node.children[1] = -1;
+		node.parent = parent;
+		node.light = light;
+	}
+
+	// builds the subtree over order[start, end) and returns its node and bounds
+	int buildNode(int start, int end, int parent, LightBounds& bounds)
+	{
+		if (end - start == 1)
+		{
+			int light = order[start];
+			int index = (int)leaves.size() - 1 + light;
+			bounds = leaves[light];
+			setNode(index, bounds, parent, light);
+			return index;
+		}
+
+		LightBounds all;
+		glm::vec3 centroid_min(1e30f);
+		glm::vec3 centroid_max(-1e30f);
+		for (int i = start; i < end; ++i)
+		{
+			const LightBounds& b = leaves[order[i]];
+			all = merge(all, b);
+			centroid_min = glm::min(centroid_min, (b.min + b.max) * 0.5f);
+			centroid_max = glm::max(centroid_max, (b.min + b.max) * 0.5f);
+		}
+
+		// cheapest bucket boundary over the three axes
+		float best_cost = 1e30f;
+		int best_axis = -1;
+		int best_split = 0;
+		glm::vec3 extent = all.max - all.min;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float width = centroid_max[axis] - centroid_min[axis];
+			if (width <= 0.0f)
+				continue;
+			LightBounds buckets[num_buckets];
+			for (int i = start; i < end; ++i)
+			{
+				const LightBounds& b = leaves[order[i]];
+				int bucket = bucketOf(b, centroid_min[axis], width, axis);
+				buckets[bucket] = merge(buckets[bucket], b);
+			}
+			for (int split = 1; split < num_buckets; ++split)
+			{
+				LightBounds below;
+				LightBounds above;
+				for (int i = 0; i < split; ++i)
+					below = merge(below, buckets[i]);
+				for (int i = split; i < num_buckets; ++i)
+					above = merge(above, buckets[i]);
+				float c = cost(below, extent, axis) + cost(above, extent, axis);
+				if (c < best_cost)
+				{
+					best_cost = c;
+					best_axis = axis;
+					best_split = split;
+				}
+			}
+		}
+
+		int mid = start;
+		if (best_axis >= 0)
+		{
+			float width = centroid_max[best_axis] - centroid_min[best_axis];
+			mid = (int)(std::partition(order.begin() + start, order.begin() + end, [&](int light) {
+				return bucketOf(leaves[light], centroid_min[best_axis], width, best_axis) < best_split;
+			}) - order.begin());
+		}
+		// coincident lights or an empty side, split by count
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
+
+		int index = next_interior++;
+		LightBounds first;
+		LightBounds second;
+		int first_child = buildNode(start, mid, index, first);
+		int second_child = buildNode(mid, end, index, second);
+		bounds = merge(first, second);
+		setNode(index, bounds, parent, -1);
+		nodes[index].children[0] = first_child;
+		nodes[index].children[1] = second_child;
+		return index;
+	}
+
+	static int bucketOf(const LightBounds& bounds, float centroid_min, float width, int axis)
+	{
+		float centroid = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+		return glm::min((int)((centroid - centroid_min) / width * num_buckets), num_buckets - 1);
+	}
+
+	static float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+	{
+		return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+	}
+
+	static float sinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+	{
+		return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+	}
+
+public:
+	std::vector<LightNode> nodes;
+
+	LightTree() : next_interior(0)
+	{
+
+	}
+
+	// one bounds per light, in the order of the light list
+	void build(const std::vector<LightBounds>& lights)
+	{
+		leaves = lights;
+		nodes.assign(leaves.empty() ? 0 : leaves.size() * 2 - 1, LightNode());
+		if (leaves.empty())
+			return;
+
+		order.resize(leaves.size());
+		for (unsigned int i = 0; i < order.size(); ++i)
+			order[i] = i;
+		next_interior = 0;
+		LightBounds root;
+		buildNode(0, (int)leaves.size(), -1, root);
+		dlogln("light tree: " << leaves.size() << " lights, " << nodes.size() << " nodes");
+	}
+
+	int numLights() const
+	{
+		return (int)leaves.size();
+	}
+
+	// upper bound of the light a node sends toward pos, normal is the outward surface normal
+	static float importance(const LightNode& node, const glm::vec3& pos, const glm::vec3& normal)
+	{
+		glm::vec3 center = (glm::vec3(node.min) + glm::vec3(node.max)) * 0.5f;
+		glm::vec3 to_pos = pos - center;
+		float dist2 = glm::dot(to_pos, to_pos);
+		float radius2 = glm::dot(glm::vec3(node.max) - center, glm::vec3(node.max) - center);
+		float d2 = glm::max(dist2, glm::length(glm::vec3(node.max) - glm::vec3(node.min)) * 0.5f);
+		if (dist2 <= radius2)
+			return node.min.w / d2;
+
+		// angle from the normal cone to pos, less the angle the bounds cover from pos
+		glm::vec3 wi = to_pos / sqrtf(dist2);
+		float cos_w = glm::abs(glm::dot(glm::vec3(node.axis), wi));
+		float sin_w = sqrtf(glm::max(1.0f - cos_w * cos_w, 0.0f));
+		float cos_b = sqrtf(glm::max(1.0f - radius2 / dist2, 0.0f));
+		float sin_b = sqrtf(glm::max(1.0f - cos_b * cos_b, 0.0f));
+		float cos_o = node.max.w;
+		float sin_o = sqrtf(glm::max(1.0f - cos_o * cos_o, 0.0f));
+		float cos_x = cosSubClamped(sin_w, cos_w, sin_o, cos_o);
+		float sin_x = sinSubClamped(sin_w, cos_w, sin_o, cos_o);
+		float cos_p = cosSubClamped(sin_x, cos_x, sin_b, cos_b);
+		if (cos_p <= node.axis.w)
+			return 0.0f;
+
+		// lights below the horizon of the surface do not reach it
+		float cos_i = glm::dot(-wi, normal);
+		float sin_i = sqrtf(glm::max(1.0f - cos_i * cos_i, 0.0f));
+		float cos_pi = cosSubClamped(sin_i, cos_i, sin_b, cos_b);
+		return glm::max(node.min.w * cos_p * cos_pi / d2, 0.0f);
+	}
+
+	// light index for a uniform random number and the chance it was picked, -1 if no light
+	// reaches pos
+	int sample(const glm::vec3& pos, const glm::vec3& normal, float u, float& pmf) const
+	{
+		pmf = 0.0f;
+		if (nodes.empty() || importance(nodes[0], pos, normal) <= 0.0f)
+			return -1;
+		pmf = 1.0f;
+		int index = 0;
+		while (nodes[index].light < 0)
+		{
+			const LightNode& node = nodes[index];
+			float first = importance(nodes[node.children[0]], pos, normal);
+			float second = importance(nodes[node.children[1]], pos, normal);
+			if (first + second <= 0.0f)
+			{
+				pmf = 0.0f;
+				return -1;
+			}
+			float p = first / (first + second);
+			if (u < p)
+			{
+				index = node.children[0];
+				u = glm::min(u / p, 0.99999994f);
+				pmf *= p;
+			}
+			else
+			{
+				index = node.children[1];
+				u = glm::min((u - p) / (1.0f - p), 0.99999994f);
+				pmf *= 1.0f - p;
+			}
+		}
+		return nodes[index].light;
+	}
+
+	// chance sample() picks the light at pos
+	float pmf(const glm::vec3& pos, const glm::vec3& normal, int light) const
+	{
+		if (nodes.empty() || importance(nodes[0], pos, normal) <= 0.0f)
+			return 0.0f;
+		float probability = 1.0f;
+		int index = (int)leaves.size() - 1 + light;
+		while (nodes[index].parent >= 0)
+		{
+			const LightNode& parent = nodes[nodes[index].parent];
+			float first = importance(nodes[parent.children[0]], pos, normal);
+			float second = importance(nodes[parent.children[1]], pos, normal);
+			if (first + second <= 0.0f)
+				return 0.0f;
+			probability *= (index == parent.children[0] ? first : second) / (first + second);
+			index = nodes[index].parent;
+		}
+		return probability;
+	}
+};
@@ -2,25 +2,55 @@
 
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+// GPU material, matches the std430 layout of Material in the shaders (96 bytes).
+// Texture maps index the scene's color (sRGB) or data (linear) texture files, -1 when
+// the material has no map. They become texture array slots when uploaded.
 struct Material
 {
-	float roughness;
-	float metal;
-	float emission = 1.0f;
-	float b;
-	glm::vec4 albedo;
-	// glm::vec3 emission;
-	// float emission_strength;
+	float roughness = 0.0f;
+	float metal = 0.0f;
+	float emission = 1.0f; // emission strength, scales the emissive color or map
+	float ior = 1.5f; // Ni
+	glm::vec4 albedo = glm::vec4(1.0f); // Kd, w is the opacity d
+	glm::vec4 specular = glm::vec4(0.0f); // Ks, w is the shininess Ns
+	glm::vec4 emissive = glm::vec4(0.0f); // Ke
+
+	// color texture files
+	int base_map = -1; // map_Kd
+	int emissive_map = -1; // map_Ke
+	int specular_map = -1; // map_Ks
+
+	// data texture files
+	int roughness_map = -1; // map_Pr, replaces roughness, sampled from green like glTF metallicRoughness
+	int metallic_map = -1; // map_Pm, replaces metal, sampled from blue
+	int normal_map = -1; // norm, map_Bump, bump
+	int opacity_map = -1; // map_d
+	int pad = 0;
+};
+
+// texture files referenced by a material, resolved to texture file indices when the
+// material is added to the scene
+struct MaterialMaps
+{
+	std::string base;
+	std::string emissive;
+	std::string specular;
+	std::string roughness;
+	std::string metallic;
+	std::string normal;
+	std::string opacity;
 };
 
 class MaterialLoader
 {
 	Material* curr_material = NULL;
+	MaterialMaps* curr_maps = NULL;
 
 	Material* createMaterial(std::vector<Material>* materials)
 	{
@@ -28,6 +58,14 @@ class MaterialLoader
 		return &(*materials)[materials->size() - 1];
 	}
 
+	glm::vec3 parseColor(std::vector<std::string>& tokens)
+	{
+		float r = std::stof(tokens[1]);
+		float g = tokens.size() > 2 ? std::stof(tokens[2]) : r;
+		float b = tokens.size() > 3 ? std::stof(tokens[3]) : r;
+		return glm::vec3(r, g, b);
+	}
+
 public:
 	MaterialLoader()
 	{
@@ -38,34 +76,107 @@ public:
 
 	}
 
-	void loadMaterials(const std::string& path, std::vector<Material>* materials, std::vector<std::string>* material_names)
+	// map paths are relative to the mtl file, directory is prepended to them
+	void loadMaterials(const std::string& path, std::vector<Material>* materials, std::vector<std::string>* material_names, std::vector<MaterialMaps>* material_maps = NULL)
 	{
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
 		std::string text;
 		std::ifstream file(path);
 
+		bool has_roughness = false;
+
 		while (std::getline(file, text))
 		{
-			unsigned int token_length = 0;
-			std::string tokens[10];
+			std::vector<std::string> tokens;
+			std::string token;
 
 			std::stringstream ss(text);
-			while (ss >> tokens[token_length])
+			while (ss >> token)
 			{
-				token_length++;
+				tokens.push_back(token);
 			}
 
+			if (tokens.empty())
+				continue;
+
 			if (tokens[0] == "newmtl")
 			{
 				curr_material = createMaterial(materials);
-				material_names->push_back(tokens[1]);
+				material_names->push_back(tokens.size() > 1 ? tokens[1] : "");
+				if (material_maps)
+				{
+					material_maps->emplace_back();
+					curr_maps = &(*material_maps)[material_maps->size() - 1];
+				}
+				has_roughness = false;
+				continue;
+			}
+
+			if (!curr_material || tokens.size() < 2)
+				continue;
+
+			// map options come before the filename, so the filename is the last token
+			std::string map_file = directory + tokens[tokens.size() - 1];
+
+			if (tokens[0] == "Kd")
+			{
+				curr_material->albedo = glm::vec4(parseColor(tokens), curr_material->albedo.w);
 			}
-			else if (tokens[0] == "Kd")
+			else if (tokens[0] == "Ks")
 			{
-				float r = std::stof(tokens[1]);
-				float g = std::stof(tokens[2]);
-				float b = std::stof(tokens[3]);
-				curr_material->albedo = glm::vec4(r, g, b, 1.0f);
+				curr_material->specular = glm::vec4(parseColor(tokens), curr_material->specular.w);
+			}
+			else if (tokens[0] == "Ke")
+			{
+				curr_material->emissive = glm::vec4(parseColor(tokens), 0.0f);
+			}
+			else if (tokens[0] == "Ns")
+			{
+				curr_material->specular.w = std::stof(tokens[1]);
+				// Blinn-Phong exponent to roughness, unless an explicit Pr is given
+				if (!has_roughness)
+					curr_material->roughness = sqrtf(2.0f / (curr_material->specular.w + 2.0f));
+			}
+			else if (tokens[0] == "d")
+			{
+				curr_material->albedo.w = std::stof(tokens[1]);
+			}
+			else if (tokens[0] == "Tr")
+			{
+				curr_material->albedo.w = 1.0f - std::stof(tokens[1]);
+			}
+			else if (tokens[0] == "Ni")
+			{
+				// some exporters write Ni 0, no dielectric is below 1
+				curr_material->ior = glm::max(std::stof(tokens[1]), 1.0f);
+			}
+			else if (tokens[0] == "Pr")
+			{
+				curr_material->roughness = std::stof(tokens[1]);
+				has_roughness = true;
+			}
+			else if (tokens[0] == "Pm")
+			{
+				curr_material->metal = std::stof(tokens[1]);
+			}
+			else if (curr_maps)
+			{
+				if (tokens[0] == "map_Kd")
+					curr_maps->base = map_file;
+				else if (tokens[0] == "map_Ke")
+					curr_maps->emissive = map_file;
+				else if (tokens[0] == "map_Ks")
+					curr_maps->specular = map_file;
+				else if (tokens[0] == "map_Pr")
+					curr_maps->roughness = map_file;
+				else if (tokens[0] == "map_Pm")
+					curr_maps->metallic = map_file;
+				else if (tokens[0] == "norm" || tokens[0] == "map_Bump" || tokens[0] == "map_bump" || tokens[0] == "bump")
+					curr_maps->normal = map_file;
+				else if (tokens[0] == "map_d")
+					curr_maps->opacity = map_file;
 			}
 		}
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "Debug.h"
+#include "ImGuiRenderer.h"
+
+// timing event in the trace, times in microseconds since the profiler was created
+struct ProfileEvent
+{
+	std::string name;
+	bool gpu;
+	int frame;
+	double start;
+	double duration;
+};
+
+// per name timing history, the value of a frame is the sum of all its events of that name
+struct ProfileTrack
+{
+	static const int history_size = 120;
+
+	std::string name;
+	bool gpu;
+	float history[history_size] = {};
+	int offset = 0;
+	float frame_ms = 0.0f; // sum of the frame being collected
+	float last_ms = 0.0f;
+
+	void push(float ms)
+	{
+		last_ms = ms;
+		history[offset] = ms;
+		offset = (offset + 1) % history_size;
+	}
+
+	float average() const
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < history_size; ++i)
+			sum += history[i];
+		return sum / history_size;
+	}
+};
+
+// CPU and GPU timers. CPU timers read a steady clock, GPU timers put GL_TIMESTAMP queries
+// into the command stream, so they measure execution and nest freely. GPU results are
+// polled each frame and read back once every query of a frame is available, so reading
+// them never waits on the GPU. Recorded events can be exported as a Chrome trace
+// (chrome://tracing, Perfetto) or as CSV.
+class Profiler
+{
+	struct TimerQueries
+	{
+		int track;
+		unsigned int begin_query;
+		unsigned int end_query;
+	};
+
+	struct GpuFrame
+	{
+		int frame;
+		std::vector<TimerQueries> timers;
+	};
+
+	std::chrono::steady_clock::time_point start_time;
+	long long gpu_offset; // gpu timestamp at start_time in nanoseconds
+
+	std::vector<ProfileTrack> tracks;
+	std::vector<ProfileEvent> events;
+
+	std::deque<GpuFrame> gpu_frames; // recorded frames not read back yet, oldest first
+	std::vector<TimerQueries> gpu_timers; // of the frame being recorded
+	std::vector<int> open_gpu_timers;
+	std::vector<unsigned int> free_queries;
+
+	int frame;
+	double frame_start;
+
+	int findTrack(const std::string& name, bool gpu)
+	{
+		for (unsigned int i = 0; i < tracks.size(); ++i)
+		{
+			if (tracks[i].name == name && tracks[i].gpu == gpu)
+				return i;
+		}
+		tracks.emplace_back();
+		tracks.back().name = name;
+		tracks.back().gpu = gpu;
+		return tracks.size() - 1;
+	}
+
+	unsigned int allocQuery()
+	{
+		if (free_queries.empty())
+		{
+			unsigned int query;
+			glGenQueries(1, &query);
+			return query;
+		}
+		unsigned int query = free_queries.back();
+		free_queries.pop_back();
+		return query;
+	}
+
+	void addEvent(int track, double start, double duration, int event_frame)
+	{
+		tracks[track].frame_ms += (float)(duration * 0.001);
+		if (recording)
+			events.push_back({ tracks[track].name, tracks[track].gpu, event_frame, start, duration });
+	}
+
+	static bool queryAvailable(unsigned int query)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		return available != 0;
+	}
+
+	// reads back the gpu timers of the oldest recorded frame and pushes its gpu totals,
+	// false without reading anything if the GPU has not finished it yet
+	bool resolveGpuFrame()
+	{
+		GpuFrame& gpu_frame = gpu_frames.front();
+		for (TimerQueries& timer : gpu_frame.timers)
+		{
+			if (!queryAvailable(timer.begin_query) || !queryAvailable(timer.end_query))
+				return false;
+		}
+
+		for (TimerQueries& timer : gpu_frame.timers)
+		{
+			GLuint64 begin = 0;
+			GLuint64 end = 0;
+			glGetQueryObjectui64v(timer.begin_query, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(timer.end_query, GL_QUERY_RESULT, &end);
+			addEvent(timer.track, (double)((long long)begin - gpu_offset) * 0.001, (double)(end - begin) * 0.001, gpu_frame.frame);
+
+			free_queries.push_back(timer.begin_query);
+			free_queries.push_back(timer.end_query);
+		}
+		gpu_frames.pop_front();
+
+		for (ProfileTrack& track : tracks)
+		{
+			if (!track.gpu)
+				continue;
+			track.push(track.frame_ms);
+			track.frame_ms = 0.0f;
+		}
+		return true;
+	}
+
+public:
+	bool recording;
+
+	Profiler() : frame(0), frame_start(0.0), recording(false)
+	{
+		start_time = std::chrono::steady_clock::now();
+		GLint64 gpu_time = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+		gpu_offset = gpu_time;
+	}
+
+	~Profiler()
+	{
+		gpu_frames.push_back({ frame, std::move(gpu_timers) });
+		for (GpuFrame& gpu_frame : gpu_frames)
+		{
+			for (TimerQueries& timer : gpu_frame.timers)
+			{
+				free_queries.push_back(timer.begin_query);
+				if (timer.end_query != 0)
+					free_queries.push_back(timer.end_query);
+			}
+		}
+		if (!free_queries.empty())
+			glDeleteQueries(free_queries.size(), free_queries.data());
+	}
+
+	// microseconds since the profiler was created
+	double now() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	// ends the previous frame and pushes its CPU totals into the histories. GPU totals are
+	// pushed when the GPU has finished the frame, usually a few frames later
+	void beginFrame()
+	{
+		double time = now();
+		if (frame > 0)
+			addEvent(findTrack("frame", false), frame_start, time - frame_start, frame);
+		frame_start = time;
+
+		for (ProfileTrack& track : tracks)
+		{
+			if (track.gpu)
+				continue;
+			track.push(track.frame_ms);
+			track.frame_ms = 0.0f;
+		}
+
+		gpu_frames.push_back({ frame, std::move(gpu_timers) });
+		gpu_timers.clear();
+		frame++;
+
+		// frames finish in order, stop at the first one still running
+		while (!gpu_frames.empty())
+		{
+			if (!resolveGpuFrame())
+				break;
+		}
+	}
+
+	void addCpuTime(const std::string& name, double start)
+	{
+		double end = now();
+		addEvent(findTrack(name, false), start, end - start, frame);
+	}
+
+	void beginGpu(const std::string& name)
+	{
+		TimerQueries timer;
+		timer.track = findTrack(name, true);
+		timer.begin_query = allocQuery();
+		timer.end_query = 0;
+		glQueryCounter(timer.begin_query, GL_TIMESTAMP);
+
+		open_gpu_timers.push_back(gpu_timers.size());
+		gpu_timers.push_back(timer);
+	}
+
+	void endGpu()
+	{
+		TimerQueries& timer = gpu_timers[open_gpu_timers.back()];
+		open_gpu_timers.pop_back();
+		timer.end_query = allocQuery();
+		glQueryCounter(timer.end_query, GL_TIMESTAMP);
+	}
+
+	// last finished value of a track in milliseconds
+	float lastTime(const std::string& name, bool gpu = false)
+	{
+		return tracks[findTrack(name, gpu)].last_ms;
+	}
+
+	// last value of a CPU timer that ran outside of the frame loop, e.g. loading
+	float cpuTime(const std::string& name)
+	{
+		return tracks[findTrack(name, false)].frame_ms;
+	}
+
+	void clearEvents()
+	{
+		events.clear();
+	}
+
+	// Chrome trace event format, CPU events on thread 0 and GPU events on thread 1
+	bool exportTrace(const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			std::cout << "could not write trace: " << path << std::endl;
+			return false;
+		}
+
+		file << std::fixed << std::setprecision(3);
+		file << "{\"traceEvents\":[\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+		for (const ProfileEvent& event : events)
+		{
+			file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << (event.gpu ? 1 : 0)
+				 << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << ",\"args\":{\"frame\":" << event.frame << "}}";
+		}
+		file << "\n]}\n";
+		return true;
+	}
+
+	bool exportCSV(const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			std::cout << "could not write csv: " << path << std::endl;
+			return false;
+		}
+
+		file << std::fixed << std::setprecision(4);
+		file << "frame,name,timer,start_ms,duration_ms\n";
+		for (const ProfileEvent& event : events)
+			file << event.frame << "," << event.name << "," << (event.gpu ? "gpu" : "cpu") << "," << event.start * 0.001 << "," << event.duration * 0.001 << "\n";
+		return true;
+	}
+
+	void ImGuiDisplayProfiler()
+	{
+		ImGui::Text("Profiler");
+
+		for (const ProfileTrack& track : tracks)
+		{
+			std::string label = track.name + (track.gpu ? " (gpu)" : " (cpu)");
+			char overlay[32];
+			snprintf(overlay, sizeof(overlay), "%.2f ms, avg %.2f", track.last_ms, track.average());
+			ImGui::PlotLines(label.c_str(), track.history, ProfileTrack::history_size, track.offset, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+		}
+
+		if (ImGui::Button(recording ? "Stop Recording" : "Record"))
+		{
+			if (!recording)
+				clearEvents();
+			recording = !recording;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Export"))
+		{
+			if (exportTrace("profile.json") && exportCSV("profile.csv"))
+				dlogln("exported " << events.size() << " events to profile.json and profile.csv");
+		}
+		ImGui::Text("%d events recorded", (int)events.size());
+	}
+};
+
+// times the enclosing scope on the CPU
+class CpuTimer
+{
+	Profiler* profiler;
+	std::string name;
+	double start;
+
+public:
+	CpuTimer(Profiler* profiler, const std::string& name) : profiler(profiler), name(name), start(0.0)
+	{
+		if (profiler)
+			start = profiler->now();
+	}
+	~CpuTimer()
+	{
+		if (profiler)
+			profiler->addCpuTime(name, start);
+	}
+};
+
+// times the GL commands issued in the enclosing scope on the GPU
+class GpuTimer
+{
+	Profiler* profiler;
+
+public:
+	GpuTimer(Profiler* profiler, const std::string& name) : profiler(profiler)
+	{
+		if (profiler)
+			profiler->beginGpu(name);
+	}
+	~GpuTimer()
+	{
+		if (profiler)
+			profiler->endGpu();
+	}
+};
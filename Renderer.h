@@ -2,7 +2,13 @@
 
 #include "Shader.h"
 #include "Camera.h"
+#include "Wavefront.h"
+#include "SampleScheduler.h"
+#include "Denoiser.h"
+#include "FrameCapture.h"
+#include "Profiler.h"
 #include "ImGuiRenderer.h"
+#include "Traversal.h"
 
 class Renderer
 {
@@ -17,70 +23,281 @@ class Renderer
 
 	Shader* curr_shader;
 
+	// traversal cost view, the shader builds a histogram of the costs of the shown pixels
+	int cost_stat; // TraversalHistogram::Stat shown in the heatmap
+	float max_cost; // cost shown as the hottest color
+	unsigned int histogram_buffer;
+	TraversalHistogram gpu_histogram;
+	TraversalHistogram cpu_histogram; // same rays traced on the CPU, on request
+	bool cpu_histogram_requested;
+
+	int backend;
+
+	Shader* path_compute_shader;
+	int tile_x;
+	int tile_y;
+
+	// compile time specializations of the ray tracing shaders
+	int max_bounces;
+	int stack_size; // BVH traversal stack entries
+	bool stackless; // parent link traversal without a stack, for trees deeper than stack_size
+	int bvh_depth; // of the scene last rendered
+	bool texture_maps; // false compiles out material map lookups
+	bool ray_counters; // the compute path tracer counts its rays into ray_counter_buffer
+	unsigned int ray_counter_buffer;
+
+	WavefrontPathTracer* wavefront;
+
 	// rendering UBO
 	unsigned int render_data;
 
-	// accumulate buffers
-	unsigned int sample_buffer;
+	// accumulate buffer, every backend updates the running average in place
 	unsigned int accumulate_buffer;
-	unsigned int result_buffer;
-
-	unsigned int sample_texture;
 	unsigned int accumulate_texture;
-	unsigned int result_texture;
+	// first hit features for the denoiser, averaged like the color
+	unsigned int albedo_texture;
+	unsigned int normal_texture; // normal and hit distance, zero on a miss
+
+	// temporal reprojection, camera motion moves the accumulated samples into the new view
+	// instead of starting over. The alpha of the accumulate texture counts the samples of
+	// each pixel, only the compute and wavefront backends weight by it
+	bool reproject;
+	float max_history;
+	float depth_tolerance;
+	Shader* reproject_shader;
+	unsigned int prev_textures[3]; // accumulate, albedo and normal of the last frame
+	unsigned int motion_texture;
+	glm::mat4 last_view;
+	glm::vec3 last_camera_pos;
+	int last_width;
+	int last_height;
+
+	Denoiser* denoiser;
+	FrameCapture* capture; // screenshots and recordings of the shown frames
+	unsigned int result_texture; // shown by the last frame, denoised or the accumulate texture
 
 	// image processing shaders
-	Shader* accumulate_shader; // combines sample and accumulate textures
 	Shader* post_process_shader; // renders accumulate texture to default buffer with post processing
 
 	float exposure;
 
 	int current_frame;
+	int sample_offset; // shifts the random sequences, see setSampleOffset()
+
+	// sample passes per displayed frame, sized from GPU timer queries of earlier frames
+	SampleScheduler scheduler;
+	static const int num_timer_queries = 4;
+	unsigned int timer_queries[num_timer_queries];
+	float timer_fractions[num_timer_queries]; // fraction of a pass each query measures, 0 when free
+	int timer_index;
+	int last_backend;
+
+	// band of the pass in progress when a pass is split over several frames
+	int band;
+	int num_bands;
+
+	// the buffers are allocated at the window size, the path tracers render into the
+	// bottom left screen_width x screen_height and post processing scales it up
+	int window_width;
+	int window_height;
+	int screen_width;
+	int screen_height;
+
+	float render_scale; // fraction of the window resolution rendered when still
+	bool dynamic_resolution; // drop to motion_scale while the camera moves
+	float motion_scale;
+	bool moving;
 
 	Camera* camera;
 
+	Profiler* profiler;
+
 	ImGuiRenderer imgui_renderer;
 
 	void sampleRender()
 	{
-		// render scene
-		glBindFramebuffer(GL_FRAMEBUFFER, sample_buffer);
-		glClear(GL_COLOR_BUFFER_BIT);
+		// render scene straight into the accumulate buffer, blending keeps the running
+		// average: sample / frame + accumulated * (1 - 1 / frame)
+		glBindFramebuffer(GL_FRAMEBUFFER, accumulate_buffer);
+		glViewport(0, 0, screen_width, screen_height);
+
+		// only the path tracer writes the feature images
+		unsigned int attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(curr_shader == path_shader ? 3 : 1, attachments);
+
+		// the first frame replaces the buffer so stale or uninitialized values never blend in
+		if (current_frame > 1)
+		{
+			glEnable(GL_BLEND);
+			glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / (float)current_frame);
+			glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+			// the color alpha is the sample count, it is replaced instead of averaged
+			glBlendFuncSeparatei(0, GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA, GL_ONE, GL_ZERO);
+		}
 
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
+
+		glDisable(GL_BLEND);
 	}
 
-	void accumulateRender()
+	void computeRender(int y_start, int y_end)
 	{
-		// combine accumulate and sample buffer into result buffer
-		glBindFramebuffer(GL_FRAMEBUFFER, result_buffer);
-		glClear(GL_COLOR_BUFFER_BIT);
+		// one invocation per pixel in tile shaped workgroups
+		path_compute_shader->use();
+		glUniform2i(path_compute_shader->uniformLoc("tile_offset"), 0, y_start);
+		path_compute_shader->setInt("band_end", y_end);
+		glBindImageTexture(0, accumulate_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(1, albedo_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(2, normal_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glDispatchCompute((screen_width + tile_x - 1) / tile_x, (y_end - y_start + tile_y - 1) / tile_y, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	}
 
-		accumulate_shader->use();
+	// renders one sample into rows y_start to y_end of the image
+	void samplePass(int path_backend, int y_start, int y_end)
+	{
+		GpuTimer timer(profiler, "sample");
 
-		accumulate_shader->setInt("accumulate_texture", 0);
-		accumulate_shader->setInt("sample_texture", 1);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, accumulate_texture);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, sample_texture);
+		glBindBuffer(GL_UNIFORM_BUFFER, render_data);
+		glBufferSubData(GL_UNIFORM_BUFFER, 80, 4, &current_frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-		glBindVertexArray(quadVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		if (path_backend == COMPUTE_BACKEND)
+		{
+			computeRender(y_start, y_end);
+		}
+		else if (path_backend == WAVEFRONT_BACKEND)
+		{
+			wavefront->render(accumulate_texture, albedo_texture, normal_texture, screen_width, screen_height);
+		}
+		else
+		{
+			curr_shader->use();
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(0, y_start, screen_width, y_end - y_start);
+			sampleRender();
+			glDisable(GL_SCISSOR_TEST);
+		}
+	}
+
+	// moves the samples of the last frame into the current view, the ubo already holds the
+	// new camera. Pixels that were not visible before start with no samples
+	void reprojectRender()
+	{
+		GpuTimer timer(profiler, "reproject");
+
+		unsigned int current[] = { accumulate_texture, albedo_texture, normal_texture };
+		for (int i = 0; i < 3; ++i)
+			glCopyImageSubData(current[i], GL_TEXTURE_2D, 0, 0, 0, 0, prev_textures[i], GL_TEXTURE_2D, 0, 0, 0, 0, last_width, last_height, 1);
+
+		reproject_shader->use();
+		reproject_shader->setInt("prev_accumulate", 3);
+		reproject_shader->setInt("prev_albedo", 4);
+		reproject_shader->setInt("prev_normal", 5);
+		reproject_shader->setMat4("prev_view", last_view);
+		reproject_shader->setVec3("prev_camera_pos", last_camera_pos);
+		glUniform2i(reproject_shader->uniformLoc("prev_size"), last_width, last_height);
+		reproject_shader->setFloat("max_history", max_history);
+		// a sample covers more pixels after the resolution goes up
+		reproject_shader->setFloat("history_scale", glm::min(1.0f, (float)(last_width * last_height) / (float)(screen_width * screen_height)));
+		reproject_shader->setFloat("depth_tolerance", depth_tolerance);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			glActiveTexture(GL_TEXTURE3 + i);
+			glBindTexture(GL_TEXTURE_2D, prev_textures[i]);
+		}
+		glBindImageTexture(0, accumulate_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, albedo_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(2, normal_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, motion_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+		glDispatchCompute((screen_width + 7) / 8, (screen_height + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+		// pixels now hold different sample counts, a split pass starts over at the top
+		band = 0;
+	}
+
+	// feeds finished timer queries to the scheduler without waiting on the GPU
+	void readTimers()
+	{
+		for (int i = 0; i < num_timer_queries; ++i)
+		{
+			if (timer_fractions[i] == 0.0f)
+				continue;
+
+			int available = 0;
+			glGetQueryObjectiv(timer_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(timer_queries[i], GL_QUERY_RESULT, &elapsed);
+			scheduler.record(elapsed * 1e-6f, timer_fractions[i]);
+			timer_fractions[i] = 0.0f;
+		}
 	}
 
-	void copyResultIntoAccumulate()
+	// the cost of a pass changed, measurements still in flight are dropped
+	void resetTimers()
 	{
-		// update accumulate buffer
-		glCopyImageSubData(result_texture, GL_TEXTURE_2D, 0, 0, 0, 0,
-						   accumulate_texture, GL_TEXTURE_2D, 0, 0, 0, 0, 1200, 800, 1); // change to window width and height
+		scheduler.reset();
+		for (int i = 0; i < num_timer_queries; ++i)
+			timer_fractions[i] = 0.0f;
 	}
 
-	void postProcessRender()
+	std::string shaderDefines()
 	{
-		// render post-processed image
+		return "#define MAX_BOUNCES " + std::to_string(max_bounces) + "\n#define BVH_STACK_SIZE " + std::to_string(stack_size) +
+			"\n#define TEXTURE_MAPS " + std::to_string((int)texture_maps) + "\n#define RAY_COUNTERS " + std::to_string((int)ray_counters) +
+			"\n#define STACKLESS_TRAVERSAL " + std::to_string((int)stackless) + "\n";
+	}
+
+	// (re)compiles the debug views and the reprojection, which trace with the traversal
+	// specializations as well
+	void compileViewShaders()
+	{
+		Shader** views[] = { &albedo_shader, &normal_shader, &fresnel_shader, &bvh_shader };
+		const char* files[] = { "Shaders/AlbedoFragment.shader", "Shaders/NormalFragment.shader", "Shaders/FresnelFragment.shader", "Shaders/BVHFragment.shader" };
+		std::string defines = shaderDefines();
+		for (int i = 0; i < 4; ++i)
+		{
+			bool current = curr_shader == *views[i];
+			delete(*views[i]);
+			*views[i] = new Shader("Shaders/Vertex.shader", files[i], defines);
+			if (current)
+				curr_shader = *views[i];
+		}
+
+		delete(reproject_shader);
+		reproject_shader = new Shader("Shaders/ReprojectCompute.shader", defines);
+	}
+
+	// recompiles the path tracers after a specialization changed, variants compiled before
+	// load from the binary cache
+	void compilePathShaders()
+	{
+		bool current = curr_shader == path_shader;
+		delete(path_shader);
+		path_shader = new Shader("Shaders/Vertex.shader", "Shaders/PathTraceFragment.shader", shaderDefines());
+		if (current)
+			curr_shader = path_shader;
+
+		setTileSize(tile_x, tile_y);
+
+		wavefront->max_depth = max_bounces;
+		wavefront->compileShaders(shaderDefines());
+
+		resetAccumulate();
+		resetTimers();
+	}
+
+	void postProcessRender(unsigned int result_texture)
+	{
+		// render post-processed image, upscaled to the window
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, window_width, window_height);
 
 		post_process_shader->use();
 
@@ -95,17 +312,49 @@ class Renderer
 	}
 
 public:
-	Renderer(Camera* camera) : current_frame(1), camera(camera), exposure(1.0f)
+	// path tracer backends, the compute and wavefront ones write straight into the
+	// accumulate texture
+	enum Backend
+	{
+		FRAGMENT_BACKEND,
+		COMPUTE_BACKEND,
+		WAVEFRONT_BACKEND
+	};
+
+	Renderer(Camera* camera) : cost_stat(TraversalHistogram::NODES), max_cost(100.0f), histogram_buffer(0), cpu_histogram_requested(false),
+		backend(COMPUTE_BACKEND), tile_x(8), tile_y(8),
+		max_bounces(8), stack_size(32), stackless(false), bvh_depth(0), texture_maps(true), ray_counters(false), ray_counter_buffer(0),
+		accumulate_buffer(0), accumulate_texture(0), albedo_texture(0), normal_texture(0),
+		reproject(true), max_history(64.0f), depth_tolerance(0.05f), motion_texture(0), last_camera_pos(0.0f), last_width(0), last_height(0), result_texture(0),
+		exposure(1.0f), current_frame(1), sample_offset(0), timer_index(0), last_backend(-1), band(0), num_bands(1),
+		window_width(0), window_height(0), screen_width(0), screen_height(0), render_scale(1.0f), dynamic_resolution(true), motion_scale(0.5f), moving(false),
+		camera(camera), profiler(NULL)
 	{
-		albedo_shader = new Shader("Shaders/Vertex.shader", "Shaders/AlbedoFragment.shader");
-		normal_shader = new Shader("Shaders/Vertex.shader", "Shaders/NormalFragment.shader");
-		fresnel_shader = new Shader("Shaders/Vertex.shader", "Shaders/FresnelFragment.shader");
-		bvh_shader = new Shader("Shaders/Vertex.shader", "Shaders/BVHFragment.shader");
-		path_shader = new Shader("Shaders/Vertex.shader", "Shaders/PathTraceFragment.shader");
+		std::string defines = shaderDefines();
+		albedo_shader = normal_shader = fresnel_shader = bvh_shader = NULL;
+		reproject_shader = NULL;
+		curr_shader = NULL;
+		compileViewShaders();
+		path_shader = new Shader("Shaders/Vertex.shader", "Shaders/PathTraceFragment.shader", defines);
 
 		curr_shader = albedo_shader;
 
-		accumulate_shader = new Shader("Shaders/Vertex.shader", "Shaders/AccumulateFragment.shader");
+		path_compute_shader = NULL;
+		setTileSize(tile_x, tile_y);
+
+		wavefront = new WavefrontPathTracer(defines);
+
+		denoiser = new Denoiser();
+
+		capture = new FrameCapture();
+
+		for (int i = 0; i < 3; ++i)
+			prev_textures[i] = 0;
+
+		glGenQueries(num_timer_queries, timer_queries);
+		for (int i = 0; i < num_timer_queries; ++i)
+			timer_fractions[i] = 0.0f;
+
 		post_process_shader = new Shader("Shaders/Vertex.shader", "Shaders/PostProcessFragment.shader");
 
 		// quad
@@ -137,9 +386,15 @@ public:
 		// ubo
 		glGenBuffers(1, &render_data);
 		glBindBuffer(GL_UNIFORM_BUFFER, render_data);
-		glBufferData(GL_UNIFORM_BUFFER, 64 + 16 + 4 + 4, NULL, GL_STATIC_DRAW);
+		glBufferData(GL_UNIFORM_BUFFER, 64 + 16 + 4 + 4 + 8, NULL, GL_STATIC_DRAW);
 		glBindBufferBase(GL_UNIFORM_BUFFER, 4, render_data);
 		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glGenBuffers(1, &histogram_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogram_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TraversalHistogram), NULL, GL_DYNAMIC_READ);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, histogram_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	}
 
 	~Renderer()
@@ -149,25 +404,41 @@ public:
 		delete(fresnel_shader);
 		delete(bvh_shader);
 		delete(path_shader);
+		delete(path_compute_shader);
+		delete(wavefront);
+		delete(denoiser);
+		delete(capture);
+		delete(reproject_shader);
+		glDeleteTextures(3, prev_textures);
+		glDeleteTextures(1, &motion_texture);
+		glDeleteQueries(num_timer_queries, timer_queries);
+		glDeleteBuffers(1, &ray_counter_buffer);
+		glDeleteBuffers(1, &histogram_buffer);
 
-		delete(accumulate_shader);
 		delete(post_process_shader);
 	}
 
-	void createBuffers(int screen_width, int screen_height)
+	// (re)creates the buffers for a window size, called again when the window is resized
+	void createBuffers(int window_width, int window_height)
 	{
-		glActiveTexture(GL_TEXTURE0);
+		this->window_width = window_width;
+		this->window_height = window_height;
+		screen_width = 0;
+		screen_height = 0;
+		updateResolution();
 
-		// creating sample buffer
-		glGenFramebuffers(1, &sample_buffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, sample_buffer);
+		wavefront->createBuffers(window_width, window_height);
+		denoiser->createBuffers(window_width, window_height);
 
-		glGenTextures(1, &sample_texture);
-		glBindTexture(GL_TEXTURE_2D, sample_texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screen_width, screen_height, 0, GL_RGBA, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sample_texture, 0);
+		if (accumulate_buffer)
+		{
+			glDeleteFramebuffers(1, &accumulate_buffer);
+			glDeleteTextures(1, &accumulate_texture);
+			glDeleteTextures(1, &albedo_texture);
+			glDeleteTextures(1, &normal_texture);
+		}
+
+		glActiveTexture(GL_TEXTURE0);
 
 		// creating accumulate buffer
 		glGenFramebuffers(1, &accumulate_buffer);
@@ -175,21 +446,209 @@ public:
 
 		glGenTextures(1, &accumulate_texture);
 		glBindTexture(GL_TEXTURE_2D, accumulate_texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screen_width, screen_height, 0, GL_RGBA, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, window_width, window_height, 0, GL_RGBA, GL_FLOAT, NULL);
+		// linear for the upscale, at full resolution post processing samples texel centers
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulate_texture, 0);
 
-		// creating result buffer
-		glGenFramebuffers(1, &result_buffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, result_buffer);
+		// feature images, the fragment path tracer writes them as extra color attachments
+		unsigned int* features[] = { &albedo_texture, &normal_texture };
+		for (int i = 0; i < 2; ++i)
+		{
+			glGenTextures(1, features[i]);
+			glBindTexture(GL_TEXTURE_2D, *features[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, window_width, window_height, 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 + i, GL_TEXTURE_2D, *features[i], 0);
+		}
 
-		glGenTextures(1, &result_texture);
-		glBindTexture(GL_TEXTURE_2D, result_texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screen_width, screen_height, 0, GL_RGBA, GL_FLOAT, NULL);
+		// copies of the last frame for reprojection, and the motion it finds
+		glDeleteTextures(3, prev_textures);
+		glDeleteTextures(1, &motion_texture);
+		glGenTextures(3, prev_textures);
+		for (int i = 0; i < 3; ++i)
+		{
+			glBindTexture(GL_TEXTURE_2D, prev_textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, window_width, window_height, 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		glGenTextures(1, &motion_texture);
+		glBindTexture(GL_TEXTURE_2D, motion_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, window_width, window_height, 0, GL_RG, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result_texture, 0);
+
+		resetAccumulate();
+	}
+
+	// picks the render resolution for the current scale, returns true if it changed
+	bool updateResolution()
+	{
+		float scale = render_scale;
+		if (dynamic_resolution && moving)
+			scale *= motion_scale;
+
+		int width = glm::max(1, (int)(window_width * scale));
+		int height = glm::max(1, (int)(window_height * scale));
+		if (width == screen_width && height == screen_height)
+			return false;
+
+		screen_width = width;
+		screen_height = height;
+		return true;
+	}
+
+	// gpu timers around the render passes, NULL disables them
+	void setProfiler(Profiler* profiler)
+	{
+		this->profiler = profiler;
+		wavefront->profiler = profiler;
+	}
+
+	// called every frame with whether the camera moved, the first still frame steps back
+	// up to the full render resolution. The renderer notices the new view by itself
+	void setMoving(bool moving)
+	{
+		this->moving = moving;
+	}
+
+	// scenes without material maps use path tracers compiled without the lookups
+	void setTextureMaps(bool texture_maps)
+	{
+		if (texture_maps == this->texture_maps)
+			return;
+		this->texture_maps = texture_maps;
+		compilePathShaders();
+	}
+
+	// recompiles the compute path tracer for a new workgroup shape
+	void setTileSize(int x, int y)
+	{
+		tile_x = x;
+		tile_y = y;
+
+		std::string defines = "#define TILE_X " + std::to_string(x) + "\n#define TILE_Y " + std::to_string(y) + "\n" + shaderDefines();
+		delete(path_compute_shader);
+		path_compute_shader = new Shader("Shaders/PathTraceCompute.shader", defines);
+	}
+
+	// offline rendering: path tracing at the full resolution, one sample pass per frame so
+	// the sample count is exact
+	void setBatchMode(int backend, bool denoise)
+	{
+		curr_shader = path_shader;
+		this->backend = backend;
+		denoiser->enabled = denoise;
+		render_scale = 1.0f;
+		dynamic_resolution = false;
+		scheduler.mode = SampleScheduler::SINGLE_MODE;
+	}
+
+	// switches every ray tracing shader between the stack and the stackless traversal
+	void setStackless(bool stackless)
+	{
+		if (stackless == this->stackless)
+			return;
+		this->stackless = stackless;
+		compileViewShaders();
+		compilePathShaders();
+	}
+
+	// counts the primary and secondary rays of the compute backend, off by default since
+	// every invocation adds to the same counters
+	void setRayCounters(bool enabled)
+	{
+		if (enabled && !ray_counter_buffer)
+		{
+			unsigned int zero[2] = { 0, 0 };
+			glGenBuffers(1, &ray_counter_buffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, ray_counter_buffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), zero, GL_DYNAMIC_READ);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, ray_counter_buffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		if (enabled == ray_counters)
+			return;
+		ray_counters = enabled;
+		compilePathShaders();
+	}
+
+	// rays counted since the last call, the counters are 32 bit so read them every few
+	// passes. Waits for the GPU
+	void readRayCounts(unsigned int& primary, unsigned int& secondary)
+	{
+		primary = 0;
+		secondary = 0;
+		if (!ray_counter_buffer)
+			return;
+
+		unsigned int counts[2];
+		unsigned int zero[2] = { 0, 0 };
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ray_counter_buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		primary = counts[0];
+		secondary = counts[1];
+	}
+
+	int samples() const
+	{
+		return current_frame - 1;
+	}
+
+	// samples of separate processes are independent when their offsets are at least
+	// their sample counts apart
+	void setSampleOffset(int offset)
+	{
+		sample_offset = offset;
+	}
+
+	// rendered region of a window sized texture, rows bottom up
+	void readTexture(unsigned int texture, std::vector<glm::vec4>& pixels)
+	{
+		std::vector<glm::vec4> data(window_width * window_height);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data.data());
+
+		pixels.resize(screen_width * screen_height);
+		for (int y = 0; y < screen_height; ++y)
+		{
+			for (int x = 0; x < screen_width; ++x)
+				pixels[y * screen_width + x] = data[y * window_width + x];
+		}
+	}
+
+	// linear color of the last frame
+	void readResult(std::vector<glm::vec4>& pixels)
+	{
+		readTexture(result_texture, pixels);
+	}
+
+	// undenoised color and the denoiser features
+	void readAccumulated(std::vector<glm::vec4>& color, std::vector<glm::vec4>& albedo, std::vector<glm::vec4>& normal_depth)
+	{
+		readTexture(accumulate_texture, color);
+		readTexture(albedo_texture, albedo);
+		readTexture(normal_texture, normal_depth);
+	}
+
+	// costs of the pixels the traversal cost view drew last frame. Waits for the GPU
+	void readCostHistogram()
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogram_buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(TraversalHistogram), &gpu_histogram);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	const TraversalHistogram& costHistogram() const
+	{
+		return gpu_histogram;
 	}
 
 	void initImGui(GLFWwindow* window)
@@ -199,22 +658,38 @@ public:
 
 	void render(Scene* scene)
 	{
-		curr_shader->use();
+		// a deeper tree would overflow the stack and lose nodes, the stackless traversal has no limit
+		bvh_depth = scene->bvh_depth;
+		if (bvh_depth > stack_size && !stackless)
+		{
+			dlogln("BVH depth " << bvh_depth << " exceeds the traversal stack, switching to stackless traversal");
+			setStackless(true);
+		}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, scene->base_map);
-		curr_shader->setInt("base_txture", 0);
+		int path_backend = curr_shader == path_shader ? backend : FRAGMENT_BACKEND;
+		Shader* shader = path_backend == COMPUTE_BACKEND ? path_compute_shader : curr_shader;
+
+		bool resized = updateResolution();
+		if (resized)
+			resetTimers();
+		if (path_backend != last_backend)
+		{
+			last_backend = path_backend;
+			resetTimers();
+		}
+		readTimers();
+
+		shader->use();
+
+		scene->bindMaterialTextures();
+		Scene::setMaterialTextureUnits(shader);
 
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, scene->environment_map);
-		curr_shader->setInt("skybox_texture", 1);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, scene->emissive_map);
-		curr_shader->setInt("emissive_texture", 2);
+		shader->setInt("skybox_texture", 1);
 
 		// update camera matrices
-		camera->updateProjection(9.0f / 6.0f);
+		camera->updateProjection((float)screen_width / (float)screen_height);
 		camera->updateView();
 
 		glm::mat4 inverse = glm::inverse(camera->view);
@@ -227,23 +702,111 @@ public:
 		glBufferSubData(GL_UNIFORM_BUFFER, 64, 12, &camera->m_pos);
 		// scene->num_nodes
 		glBufferSubData(GL_UNIFORM_BUFFER, 76, 4, &scene->num_nodes);
-		// current frame
-		glBufferSubData(GL_UNIFORM_BUFFER, 80, 4, &current_frame);
+		glBufferSubData(GL_UNIFORM_BUFFER, 84, 4, &sample_offset);
+		// render resolution
+		int screen_size[2] = { screen_width, screen_height };
+		glBufferSubData(GL_UNIFORM_BUFFER, 88, 8, screen_size);
 		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
+		// a new view or resolution either reprojects the samples or starts a new image
+		if ((resized || camera->view != last_view) && current_frame > 1)
+		{
+			if (reproject && path_backend != FRAGMENT_BACKEND)
+				reprojectRender();
+			else
+				resetAccumulate();
+		}
+		last_view = camera->view;
+		last_camera_pos = camera->m_pos;
+		last_width = screen_width;
+		last_height = screen_height;
+
+		// the cost view collects the costs of the pixels it draws this frame
+		bool cost_view = curr_shader == bvh_shader;
+		if (cost_view)
+		{
+			TraversalHistogram empty;
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogram_buffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(TraversalHistogram), &empty);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+			bvh_shader->setInt("stat", cost_stat);
+			bvh_shader->setFloat("max_heat", max_cost);
+			const int* widths = TraversalHistogram::bin_widths;
+			glUniform4i(bvh_shader->uniformLoc("bin_width"), widths[0], widths[1], widths[2], widths[3]);
+		}
+
 		// clear window
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		sampleRender();
+		// time the sampling work unless every query is still in flight
+		bool timed = timer_fractions[timer_index] == 0.0f;
+		if (timed)
+			glBeginQuery(GL_TIME_ELAPSED, timer_queries[timer_index]);
+
+		// the band count only changes between passes so every pixel gets each sample.
+		// The wavefront queues cover the whole image, it always renders whole passes
+		if (band == 0)
+			num_bands = path_backend == WAVEFRONT_BACKEND ? 1 : scheduler.bands(screen_height);
+
+		float pass_fraction;
+		if (num_bands > 1)
+		{
+			// one band per frame, the sample is complete once the last band is done
+			samplePass(path_backend, band * screen_height / num_bands, (band + 1) * screen_height / num_bands);
+			pass_fraction = 1.0f / (float)num_bands;
+			band = (band + 1) % num_bands;
+			if (band == 0)
+				current_frame++;
+		}
+		else
+		{
+			int passes = scheduler.passes();
+			for (int i = 0; i < passes; ++i)
+			{
+				samplePass(path_backend, 0, screen_height);
+				current_frame++;
+			}
+			pass_fraction = (float)passes;
+		}
+
+		if (timed)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			timer_fractions[timer_index] = pass_fraction;
+			timer_index = (timer_index + 1) % num_timer_queries;
+		}
 
-		accumulateRender();
+		if (cost_view)
+		{
+			readCostHistogram();
+			if (cpu_histogram_requested)
+			{
+				cpu_histogram.clear();
+				BVHTraversal(scene, stackless).primaryCosts(camera, screen_width, screen_height, cpu_histogram);
+				cpu_histogram_requested = false;
+			}
+		}
 
-		copyResultIntoAccumulate();
+		// denoise the path traced image, the debug views are shown as they are
+		result_texture = accumulate_texture;
+		if (denoiser->enabled && curr_shader == path_shader)
+		{
+			GpuTimer timer(profiler, "denoise");
+			result_texture = denoiser->denoise(accumulate_texture, albedo_texture, normal_texture, screen_width, screen_height);
+		}
 
-		postProcessRender();
+		{
+			GpuTimer timer(profiler, "post process");
+			postProcessRender(result_texture);
+		}
 
-		current_frame++;
+		// screenshots and recordings copy the frame, earlier copies go to the encoder
+		{
+			CpuTimer timer(profiler, "capture");
+			capture->update(result_texture, screen_width, screen_height, exposure);
+		}
 	}
 
 	void updateImGui()
@@ -263,7 +826,7 @@ public:
 		ImGui::RadioButton("Albedo", &e, 0);
 		ImGui::RadioButton("Normals", &e, 1);
 		ImGui::RadioButton("Fresnel", &e, 2);
-		ImGui::RadioButton("BVH", &e, 3);
+		ImGui::RadioButton("Traversal Cost", &e, 3);
 		ImGui::RadioButton("Path Trace", &e, 4);
 
 		switch (e)
@@ -284,6 +847,90 @@ public:
 			curr_shader = path_shader;
 		}
 
+		if (curr_shader == bvh_shader)
+			ImGuiDisplayTraversalCost();
+
+		ImGui::NewLine();
+
+		// all backends keep the running average in the accumulate texture, so switching
+		// does not restart accumulation
+		ImGui::Text("Path Trace Backend");
+		ImGui::RadioButton("Fragment", &backend, FRAGMENT_BACKEND);
+		ImGui::RadioButton("Compute", &backend, COMPUTE_BACKEND);
+		ImGui::RadioButton("Wavefront", &backend, WAVEFRONT_BACKEND);
+
+		if (backend == COMPUTE_BACKEND)
+		{
+			static int tile = 0;
+			static const int tile_sizes[][2] = { { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 4 } };
+			int prev_tile = tile;
+			ImGui::RadioButton("8x8", &tile, 0);
+			ImGui::RadioButton("16x8", &tile, 1);
+			ImGui::RadioButton("16x16", &tile, 2);
+			ImGui::RadioButton("32x4", &tile, 3);
+			if (tile != prev_tile)
+				setTileSize(tile_sizes[tile][0], tile_sizes[tile][1]);
+		}
+		else if (backend == WAVEFRONT_BACKEND)
+		{
+			ImGui::SliderInt("Persistent Groups", &wavefront->persistent_groups, 16, 2048);
+		}
+
+		ImGui::NewLine();
+
+		ImGui::Text("Traversal");
+		bool stackless_traversal = stackless;
+		if (ImGui::Checkbox("Stackless", &stackless_traversal) && (stackless_traversal || bvh_depth <= stack_size))
+			setStackless(stackless_traversal);
+		ImGui::Text("BVH depth %d, stack %d", bvh_depth, stack_size);
+
+		ImGui::NewLine();
+
+		ImGui::Text("Sampling");
+		// the path length is compiled into the shaders, recompile once the slider is released
+		static int bounces = max_bounces;
+		ImGui::SliderInt("Bounces", &bounces, 1, 32);
+		if (ImGui::IsItemDeactivatedAfterEdit() && bounces != max_bounces)
+		{
+			max_bounces = bounces;
+			compilePathShaders();
+		}
+		ImGui::RadioButton("One Pass per Frame", &scheduler.mode, SampleScheduler::SINGLE_MODE);
+		ImGui::RadioButton("Frame Budget", &scheduler.mode, SampleScheduler::BUDGET_MODE);
+		ImGui::RadioButton("Frame Budget with Bands", &scheduler.mode, SampleScheduler::TILED_MODE);
+		if (scheduler.mode != SampleScheduler::SINGLE_MODE)
+			ImGui::SliderFloat("Budget (ms)", &scheduler.target_ms, 1.0f, 100.0f, "%.1f");
+		if (num_bands > 1)
+			ImGui::Text("%.2f ms per pass, %d bands", scheduler.passCost(), num_bands);
+		else
+			ImGui::Text("%.2f ms per pass, %d passes", scheduler.passCost(), scheduler.passes());
+
+		ImGui::NewLine();
+
+		ImGui::Text("Camera Motion");
+		ImGui::Checkbox("Reproject", &reproject);
+		if (reproject)
+		{
+			ImGui::SliderFloat("Max History", &max_history, 1.0f, 1024.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Depth Tolerance", &depth_tolerance, 0.001f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+			if (backend == FRAGMENT_BACKEND)
+				ImGui::Text("Fragment backend restarts on motion");
+		}
+
+		ImGui::NewLine();
+
+		ImGui::Text("Resolution");
+		ImGui::SliderFloat("Render Scale", &render_scale, 0.25f, 1.0f, "%.2f");
+		ImGui::Checkbox("Dynamic Resolution", &dynamic_resolution);
+		if (dynamic_resolution)
+			ImGui::SliderFloat("Motion Scale", &motion_scale, 0.125f, 1.0f, "%.3f");
+		ImGui::Text("%d x %d of %d x %d", screen_width, screen_height, window_width, window_height);
+
+		ImGui::NewLine();
+
+		ImGui::Text("Denoising");
+		denoiser->ImGuiDisplaySettings();
+
 		ImGui::NewLine();
 
 		ImGui::Text("Post Processing");
@@ -291,11 +938,43 @@ public:
 
 		ImGui::NewLine();
 
+		ImGui::Text("Capture");
+		capture->ImGuiDisplaySettings();
+
+		ImGui::NewLine();
+
 		ImGui::Text("Frame: %d", current_frame);
 	}
 
+	void ImGuiDisplayTraversalCost()
+	{
+		ImGui::NewLine();
+
+		ImGui::Text("Traversal Cost");
+		for (int i = 0; i < TraversalHistogram::NUM_STATS; ++i)
+			ImGui::RadioButton(TraversalHistogram::name(i), &cost_stat, i);
+		ImGui::SliderFloat("Max Cost", &max_cost, 1.0f, 1000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+
+		// x axis is bin_widths[cost_stat] per bin, the last bin holds everything above
+		float fractions[TraversalHistogram::num_bins];
+		gpu_histogram.fractions(cost_stat, fractions);
+		ImGui::PlotHistogram("GPU", fractions, TraversalHistogram::num_bins, 0, NULL, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+		ImGui::Text("mean %.2f, max %u, %u rays", gpu_histogram.mean(cost_stat), gpu_histogram.max[cost_stat], gpu_histogram.rays);
+
+		// the same primary rays traced on the CPU, slow for large images
+		if (ImGui::Button("CPU Traversal"))
+			cpu_histogram_requested = true;
+		if (cpu_histogram.rays > 0)
+		{
+			cpu_histogram.fractions(cost_stat, fractions);
+			ImGui::PlotHistogram("CPU", fractions, TraversalHistogram::num_bins, 0, NULL, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+			ImGui::Text("mean %.2f, max %u, %u rays", cpu_histogram.mean(cost_stat), cpu_histogram.max[cost_stat], cpu_histogram.rays);
+		}
+	}
+
 	void resetAccumulate()
 	{
 		current_frame = 1;
+		band = 0;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Decides how much path tracing work goes into each displayed frame from the measured
+// GPU cost of a sample pass. Budget mode issues as many whole passes as fit the target
+// frame time, tiled mode also splits a pass into horizontal bands when one pass is
+// over budget so the UI keeps responding on heavy scenes.
+class SampleScheduler
+{
+	float pass_ms; // running estimate of one full pass, 0 until the first measurement
+
+public:
+	enum Mode
+	{
+		SINGLE_MODE, // one pass per frame
+		BUDGET_MODE,
+		TILED_MODE
+	};
+	int mode;
+
+	float target_ms; // GPU time to spend on sampling per displayed frame
+	int max_passes;
+
+	SampleScheduler() : pass_ms(0.0f), mode(BUDGET_MODE), target_ms(12.0f), max_passes(64)
+	{
+
+	}
+
+	// adds a measurement of gpu_ms for the given fraction of a pass
+	void record(float gpu_ms, float pass_fraction)
+	{
+		if (pass_fraction <= 0.0f)
+			return;
+
+		float sample = gpu_ms / pass_fraction;
+		// the first measurement replaces the estimate, later ones are smoothed
+		pass_ms = pass_ms == 0.0f ? sample : glm::mix(pass_ms, sample, 0.2f);
+	}
+
+	// drops the estimate, e.g. when the resolution or backend changes the cost of a pass
+	void reset()
+	{
+		pass_ms = 0.0f;
+	}
+
+	float passCost() const
+	{
+		return pass_ms;
+	}
+
+	// whole passes for the next frame
+	int passes() const
+	{
+		if (mode == SINGLE_MODE || pass_ms == 0.0f)
+			return 1;
+		return glm::clamp((int)(target_ms / pass_ms), 1, max_passes);
+	}
+
+	// bands a pass is split into, 1 unless tiled mode and a pass is over budget
+	int bands(int max_bands) const
+	{
+		if (mode != TILED_MODE || pass_ms <= target_ms)
+			return 1;
+		return glm::clamp((int)ceilf(pass_ms / target_ms), 1, max_bands);
+	}
+};
@@ -1,72 +1,191 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
 #include "Debug.h"
 #include "Material.h"
+#include "Environment.h"
+#include "LightTree.h"
 #include "Shader.h"
 #include "ImGuiRenderer.h"
 
 // all vertex, normal, and texture data for the scene
+// vertices are unified so one index addresses the position, normal, and texture coordinate
 struct SceneData
 {
-	glm::vec4 vertices[200000];
-	glm::vec4 normals[200000];
-	glm::vec2 texture[200000];
+	static const int max_vertices = 200000;
+
+	glm::vec4 vertices[max_vertices];
+	glm::vec4 normals[max_vertices];
+	glm::vec2 texture[max_vertices];
 	int vertex_size = 0;
-	int normal_size = 0;
-	int texture_size = 0;
 };
 
-// primitive triangle data
+// Analytic shapes keep their parameters in unified vertices so they move with the object
+// transform like triangles do. The type is stored in the top bits of vertex_c
+enum PrimitiveType
+{
+	TRIANGLE_PRIMITIVE,
+	SPHERE_PRIMITIVE, // center a, a point on the surface b
+	PLANE_PRIMITIVE, // parallelogram with corner a and edges to b and c
+	BOX_PRIMITIVE // axis aligned, opposite corners a and b
+};
+
+// primitive triangle or shape data (16 bytes)
 struct Primitive
 {
-	// indices of each vertex
+	static const unsigned int type_shift = 30;
+	static const unsigned int index_mask = (1u << type_shift) - 1u;
+
+	// indices of each unified vertex
 	unsigned int vertex_a;
 	unsigned int vertex_b;
 	unsigned int vertex_c;
 
-	// indices of each vertex normal
-	unsigned int normal_a;
-	unsigned int normal_b;
-	unsigned int normal_c;
-
-	// indices of each texture coordinate
-	unsigned int texture_a;
-	unsigned int texture_b;
-	unsigned int texture_c;
-
 	// index ID of the material
 	unsigned int material;
+
+	PrimitiveType type() const
+	{
+		return (PrimitiveType)(vertex_c >> type_shift);
+	}
+
+	unsigned int vertexC() const
+	{
+		return vertex_c & index_mask;
+	}
 };
 
-// flattened BVH node
+// OBJ vertex, texture, and normal indices of one face corner
+struct VertexKey
+{
+	int vertex;
+	int texture;
+	int normal;
+
+	bool operator==(const VertexKey& other) const
+	{
+		return vertex == other.vertex && texture == other.texture && normal == other.normal;
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& key) const
+	{
+		size_t h = std::hash<int>()(key.vertex);
+		h ^= std::hash<int>()(key.texture) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= std::hash<int>()(key.normal) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		return h;
+	}
+};
+
+// an object parsed from an OBJ file, staged before being merged into the scene
+struct ObjectData
+{
+	std::string name;
+	glm::vec3 offset;
+	glm::vec3 scale;
+
+	// unified vertices local to the object, untransformed
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec4> normals;
+	std::vector<glm::vec2> texture;
+
+	// vertex indices are local and material indexes material_refs
+	std::vector<Primitive> primitives;
+
+	// material names used by usemtl, index 0 is the default material
+	std::vector<std::string> material_refs;
+
+	// materials from each mtl file referenced by the object
+	std::vector<std::string> material_files;
+	std::vector<unsigned int> material_file_starts;
+	std::vector<Material> materials;
+	std::vector<std::string> material_names;
+	std::vector<MaterialMaps> material_maps;
+};
+
+// flattened BVH node, parent fills the padding after min so the std430 layout stays 48 bytes
 struct Node
 {
 	int axis;
 	int left;
 	int prim_count;
 	int prim_index;
-	glm::vec4 min;
-	glm::vec4 max;
+	glm::vec3 min;
+	int parent; // -1 for the root, links for the stackless traversal
+	glm::vec3 max;
+	int pad;
 };
 
-struct Sphere
+// an object merged into the scene. It owns a contiguous range of vertices and primitives
+// and its own BVH subtree, so it can be edited without touching the rest of the scene
+struct SceneObject
 {
-	glm::vec3 pos;
-	glm::vec3 col;
-	float radius;
+	std::string name;
+	glm::vec3 offset;
+	glm::vec3 scale;
+
+	unsigned int vertex_start;
+	unsigned int vertex_count;
+	unsigned int prim_start;
+	unsigned int prim_count;
+
+	// positions before offset and scale are applied
+	std::vector<glm::vec4> local_vertices;
+
+	// BVH subtree, child indices are local to the subtree and prim_index is global
+	std::vector<Node> nodes;
+	int node_start; // index of the subtree root in the flattened nodes, -1 if not placed
+
+	bool removed;
 };
 
-struct Plane
+// element ranges changed since the last upload, as [start, end) pairs
+struct DirtyRanges
 {
-	glm::vec3 pos;
-	glm::vec3 normal;
-	glm::vec3 col;
+	std::vector<glm::ivec2> ranges;
+
+	void add(int start, int end)
+	{
+		if (start < end)
+			ranges.push_back(glm::ivec2(start, end));
+	}
+	bool empty() const
+	{
+		return ranges.empty();
+	}
+	void clear()
+	{
+		ranges.clear();
+	}
+	// sorts and merges overlapping or adjacent ranges
+	std::vector<glm::ivec2>& merged()
+	{
+		std::sort(ranges.begin(), ranges.end(), [](const glm::ivec2& a, const glm::ivec2& b) {
+			return a.x < b.x;
+		});
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < ranges.size(); ++i)
+		{
+			if (count > 0 && ranges[i].x <= ranges[count - 1].y)
+				ranges[count - 1].y = glm::max(ranges[count - 1].y, ranges[i].y);
+			else
+				ranges[count++] = ranges[i];
+		}
+		ranges.resize(count);
+		return ranges;
+	}
 };
 
 class Scene
@@ -74,26 +193,64 @@ class Scene
 private:
 	bool checkLoadedMaterialFile(std::string& filename)
 	{
-		for (unsigned int i = 0; i < loaded_material_files.size(); ++i)
-		{
-			if (loaded_material_files[i] == filename)
-				return true;
-		}
-		return false;
+		return material_files.find(filename) != material_files.end();
 	}
 	void setCurrentMaterial(std::string& material_name, unsigned int* curr_material)
 	{
-		*curr_material = 0u;
-		for (unsigned int i = 0; i < material_names.size(); ++i)
+		auto it = material_ids.find(material_name);
+		*curr_material = it != material_ids.end() ? it->second : 0u;
+	}
+	int addTexture(const std::string& filename, bool srgb)
+	{
+		if (filename.empty())
+			return -1;
+
+		std::unordered_map<std::string, int>& indices = srgb ? color_texture_indices : data_texture_indices;
+		std::vector<std::string>& files = srgb ? color_texture_files : data_texture_files;
+
+		auto it = indices.find(filename);
+		if (it != indices.end())
+			return it->second;
+
+		int index = files.size();
+		files.push_back(filename);
+		indices.emplace(filename, index);
+		return index;
+	}
+	// adds a material, reusing one with the same name and parameters if it was already added
+	// from another file. Named materials that only share parameters stay separate so
+	// editing one does not change the other
+	unsigned int addMaterial(Material material, MaterialMaps& maps, std::string& name)
+	{
+		material.base_map = addTexture(maps.base, true);
+		material.emissive_map = addTexture(maps.emissive, true);
+		material.specular_map = addTexture(maps.specular, true);
+		material.roughness_map = addTexture(maps.roughness, false);
+		material.metallic_map = addTexture(maps.metallic, false);
+		material.normal_map = addTexture(maps.normal, false);
+		material.opacity_map = addTexture(maps.opacity, false);
+
+		std::string key = name + '\0' + std::string((char*)&material, sizeof(Material));
+		unsigned int id;
+		auto it = material_dedup.find(key);
+		if (it != material_dedup.end())
 		{
-			if (material_names[i] == material_name)
-			{
-				*curr_material = i;
-				return;
-			}
+			id = it->second;
 		}
+		else
+		{
+			id = materials.size();
+			materials.push_back(material);
+			material_names.push_back(name);
+			material_dedup.emplace(key, id);
+			dirty_materials.add(id, id + 1);
+		}
+
+		// the first material registered under a name is the one usemtl finds
+		material_ids.emplace(name, id);
+		return id;
 	}
-	glm::ivec3 parseFaceIndex(std::string& face_data)
+	glm::ivec3 parseFaceIndex(std::string& face_data) const
 	{
 		glm::ivec3 data = glm::ivec3(0, 0, 0); // vertex, texture, normal
 
@@ -113,7 +270,7 @@ private:
 
 		if (slash_count == 0)
 		{
-			data[0] = std::stoi(face_data);
+			data[0] = std::stoi(face_data) - 1;
 		}
 		else if (slash_count == 2)
 		{
@@ -124,226 +281,489 @@ private:
 		}
 		return data;
 	}
+	// returns the unified vertex index for an OBJ face corner, creating it on first use
+	unsigned int getUnifiedVertex(glm::ivec3& face_index, std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals,
+		std::vector<glm::vec2>& textures, std::unordered_map<VertexKey, unsigned int, VertexKeyHash>& vertex_map, ObjectData& object) const
+	{
+		VertexKey key = { face_index.x, face_index.y, face_index.z };
+		auto it = vertex_map.find(key);
+		if (it != vertex_map.end())
+			return it->second;
+
+		unsigned int index = object.vertices.size();
+		object.vertices.push_back(face_index.x >= 0 && face_index.x < (int)positions.size() ? positions[face_index.x] : glm::vec4(0.0f));
+		object.normals.push_back(face_index.z >= 0 && face_index.z < (int)normals.size() ? normals[face_index.z] : glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		object.texture.push_back(face_index.y >= 0 && face_index.y < (int)textures.size() ? textures[face_index.y] : glm::vec2(0.0f));
+
+		vertex_map.emplace(key, index);
+		return index;
+	}
+	// adds a unified vertex for a point of an analytic shape, the OBJ axes are converted like
+	// vertex positions
+	unsigned int addShapeVertex(const std::vector<std::string>& tokens, unsigned int first, ObjectData& object) const
+	{
+		unsigned int index = object.vertices.size();
+		object.vertices.push_back(glm::vec4(std::stof(tokens[first]), -std::stof(tokens[first + 2]), std::stof(tokens[first + 1]), 1.0f));
+		object.normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		object.texture.push_back(glm::vec2(0.0f));
+		return index;
+	}
+	void addShape(PrimitiveType type, unsigned int a, unsigned int b, unsigned int c, unsigned int material, ObjectData& object) const
+	{
+		Primitive p;
+		p.vertex_a = a;
+		p.vertex_b = b;
+		p.vertex_c = c | ((unsigned int)type << Primitive::type_shift);
+		p.material = material;
+		object.primitives.push_back(p);
+	}
+	unsigned int getMaterialRef(std::string& material_name, ObjectData& object) const
+	{
+		for (unsigned int i = 1; i < object.material_refs.size(); ++i)
+		{
+			if (object.material_refs[i] == material_name)
+				return i;
+		}
+		object.material_refs.push_back(material_name);
+		return object.material_refs.size() - 1;
+	}
 public:
 
 	unsigned int data_buffer;
 	unsigned int material_buffer;
 	unsigned int primitive_buffer;
 	unsigned int bvh_buffer;
+	unsigned int light_buffer;
+	unsigned int light_tree_buffer;
 
 	unsigned int sample_buffer;
 	unsigned int accumulate_buffer;
 
-	std::vector<std::string> loaded_material_files;
+	// materials are deduplicated by name and content, material_ids maps names to ids and
+	// material_files maps mtl paths to the ids of their materials
 	std::vector<Material> materials;
 	std::vector<std::string> material_names;
+	std::unordered_map<std::string, unsigned int> material_ids;
+	std::unordered_map<std::string, unsigned int> material_dedup;
+	std::unordered_map<std::string, std::vector<unsigned int>> material_files;
+
+	// texture files referenced by materials, the maps of a Material index these
+	std::vector<std::string> color_texture_files;
+	std::vector<std::string> data_texture_files;
+	std::unordered_map<std::string, int> color_texture_indices;
+	std::unordered_map<std::string, int> data_texture_indices;
+	// where each texture file went in the texture arrays, the size class in the top bits and
+	// the layer in the low 16. Map indices are replaced by these when materials are uploaded
+	std::vector<int> color_map_slots;
+	std::vector<int> data_map_slots;
 
 	SceneData scene_data;
 
+	static const int max_primitives = 200000;
 	int num_primitives;
-	Primitive primitives[200000];
+	Primitive primitives[max_primitives];
 
 	int num_nodes;
 	Node nodes[100000];
 
-	unsigned int base_map;
-	unsigned int environment_map;
-	unsigned int emissive_map;
+	// emissive primitives of objects in the scene in index order, sampled for next event
+	// estimation through the light tree
+	std::vector<int> lights;
+	LightTree light_tree;
 
-	Scene() : num_nodes(0)
+	// objects in merge order, removed objects keep their slot so indices stay valid
+	std::vector<SceneObject> objects;
+	// flattened indices of the top level nodes above the object subtrees
+	std::vector<int> top_nodes;
+	int bvh_depth; // interior nodes on the longest path, the entries a traversal stack needs
+
+	// changes not uploaded yet, in elements of each buffer
+	DirtyRanges dirty_vertices;
+	DirtyRanges dirty_primitives;
+	DirtyRanges dirty_nodes;
+	DirtyRanges dirty_materials;
+	unsigned int material_capacity;
+
+	unsigned int environment_map;
+	EnvironmentMap environment; // importance sampling table of environment_map
+	unsigned int environment_buffer;
+	// maps are grouped by size into texture arrays so a large map does not grow every layer,
+	// matches MAP_CLASSES in Shaders/Include/TextureLOD.shader
+	static const int map_classes = 3;
+	static const int map_class_size = 512; // largest side of class 0, each class doubles it
+	static const int map_unit = 6; // first texture unit of the map arrays
+	unsigned int color_textures[map_classes]; // sRGB texture arrays for base, emissive, and specular maps
+	unsigned int data_textures[map_classes]; // linear texture arrays for roughness, metallic, normal, and opacity maps
+
+	Scene() : light_buffer(0), light_tree_buffer(0), num_primitives(0), num_nodes(0), bvh_depth(0), material_capacity(0), environment_map(0), environment_buffer(0), color_textures{}, data_textures{}
 	{
 		// creating default material
 		materials.emplace_back(Material());
 		Material& default_material = materials[0];
 		default_material.albedo = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
 		material_names.emplace_back("Default_Material");
+		material_ids.emplace("Default_Material", 0);
 	}
 
-	void loadObject(const std::string& path, const std::string& filename, glm::vec3 offset, glm::vec3 scale)
+	// parses an OBJ file and its mtl files into object without touching the scene, so
+	// several objects can be parsed at once on worker threads
+	void parseObject(const std::string& path, const std::string& filename, glm::vec3 offset, glm::vec3 scale, ObjectData& object) const
 	{
 		unsigned int curr_material = 0;
+		object.material_refs.push_back("");
 
-		glm::vec4 offs = glm::vec4(offset.x, offset.y, offset.z, 0.0f);
-		glm::vec4 sc   = glm::vec4(scale.x, scale.y, scale.z, 1.0f);
+		// positions stay local, the transform is applied when merging
+		object.name = path + filename;
+		object.offset = offset;
+		object.scale = scale;
 
 		std::string text;
 		std::ifstream file(path + filename);
 
-		unsigned int vertex_offset = scene_data.vertex_size;
-		unsigned int texture_offset = scene_data.texture_size;
-		unsigned int normal_offset = scene_data.normal_size;
+		// OBJ indexes positions, normals, and texture coordinates separately, so they are
+		// staged here and remapped into unified vertices as faces reference them
+		std::vector<glm::vec4> positions;
+		std::vector<glm::vec4> normals;
+		std::vector<glm::vec2> textures;
+		std::unordered_map<VertexKey, unsigned int, VertexKeyHash> vertex_map;
 
 		while (std::getline(file, text))
 		{
-			unsigned int token_length = 0;
-			std::string tokens[8];
+			std::vector<std::string> tokens;
+			std::string token;
 
 			std::stringstream ss(text);
-			while (ss >> tokens[token_length])
+			while (ss >> token)
 			{
-				token_length++;
+				tokens.push_back(token);
 			}
+			unsigned int token_length = tokens.size();
 
 			if (token_length > 0)
 			{
-				if (tokens[0] == "v")
+				if (tokens[0] == "v" && token_length > 3)
 				{
 					// add vertex
 					glm::vec4 v = glm::vec4(std::stof(tokens[1]),
 						-std::stof(tokens[3]),
 						std::stof(tokens[2]), 1.0f);
 
-					scene_data.vertices[scene_data.vertex_size] = v * sc + offs;
-					scene_data.vertex_size++;
-					//mesh.vertices[mesh.vertex_size] = v * sc + offs;
-					//mesh.vertex_size++;
-
-					//std::cout << "v: " << v.x << ", " << v.y << ", " << v.z << std::endl;
+					positions.push_back(v);
 				}
-				else if (tokens[0] == "vn")
+				else if (tokens[0] == "vn" && token_length > 3)
 				{
 					glm::vec4 v = glm::vec4(std::stof(tokens[1]),
 						-std::stof(tokens[3]),
 						std::stof(tokens[2]), 1.0f);
 
-					scene_data.normals[scene_data.normal_size] = v;
-					scene_data.normal_size++;
-					//mesh.normals[mesh.normal_size] = v;
-					//mesh.normal_size++;
+					normals.push_back(v);
 				}
-				else if (tokens[0] == "vt")
+				else if (tokens[0] == "vt" && token_length > 2)
 				{
 					glm::vec2 v = glm::vec2(std::stof(tokens[1]), std::stof(tokens[2]));
 
-					scene_data.texture[scene_data.texture_size] = v;
-					scene_data.texture_size++;
-					/*mesh.texture[mesh.texture_size] = v;
-					mesh.texture_size++;*/
+					textures.push_back(v);
 				}
-				else if (tokens[0] == "f")
+				else if (tokens[0] == "f" && token_length > 3)
 				{
 					glm::ivec3 i1 = parseFaceIndex(tokens[1]);
 					glm::ivec3 i2 = parseFaceIndex(tokens[2]);
 					glm::ivec3 i3 = parseFaceIndex(tokens[3]);
 
-					primitives[num_primitives] = Primitive();
-					Primitive& p = primitives[num_primitives];
-					p.vertex_a = i1.x + vertex_offset;
-					p.vertex_b = i2.x + vertex_offset;
-					p.vertex_c = i3.x + vertex_offset;
-					p.texture_a = i1.y + texture_offset;
-					p.texture_b = i2.y + texture_offset;
-					p.texture_c = i3.y + texture_offset;
-					p.normal_a = i1.z + normal_offset;
-					p.normal_b = i2.z + normal_offset;
-					p.normal_c = i3.z + normal_offset;
+					unsigned int v1 = getUnifiedVertex(i1, positions, normals, textures, vertex_map, object);
+					unsigned int v2 = getUnifiedVertex(i2, positions, normals, textures, vertex_map, object);
+					unsigned int v3 = getUnifiedVertex(i3, positions, normals, textures, vertex_map, object);
+
+					Primitive p;
+					p.vertex_a = v1;
+					p.vertex_b = v2;
+					p.vertex_c = v3;
 					p.material = curr_material;
-					num_primitives++;
+					object.primitives.push_back(p);
 
-					if (token_length == 5)
+					// polygons are split into a fan around the first corner
+					unsigned int prev = v3;
+					for (unsigned int i = 4; i < token_length; ++i)
 					{
-						glm::ivec3 i4 = parseFaceIndex(tokens[4]);
-
-						primitives[num_primitives] = Primitive();
-						Primitive& q = primitives[num_primitives];
-						q.vertex_b = i4.x + vertex_offset;
-						q.vertex_a = i3.x + vertex_offset;
-						q.vertex_c = i1.x + vertex_offset;
-						q.texture_a = i3.y + texture_offset;
-						q.texture_b = i4.y + texture_offset;
-						q.texture_c = i1.y + texture_offset;
-						q.normal_a = i3.z + normal_offset;
-						q.normal_b = i4.z + normal_offset;
-						q.normal_c = i1.z + normal_offset;
+						glm::ivec3 index = parseFaceIndex(tokens[i]);
+						unsigned int next = getUnifiedVertex(index, positions, normals, textures, vertex_map, object);
+
+						Primitive q;
+						q.vertex_a = prev;
+						q.vertex_b = next;
+						q.vertex_c = v1;
 						q.material = curr_material;
-						num_primitives++;
+						object.primitives.push_back(q);
+						prev = next;
 					}
-
-					//// add indices
-					//int i1 = std::stoi(tokens[1].substr(0, tokens[1].find('/'))) - 1;
-					//int i2 = std::stoi(tokens[2].substr(0, tokens[2].find('/'))) - 1;
-					//int i3 = std::stoi(tokens[3].substr(0, tokens[3].find('/'))) - 1;
-
-					//mesh.indices[mesh.index_size] = mesh.index_size;// i1 + index_offset;
-					//mesh.indices[mesh.index_size + 1] = mesh.index_size + 1; //i2 + index_offset;
-					//mesh.indices[mesh.index_size + 2] = mesh.index_size + 2; //i3 + index_offset;
-
-					//mesh.vertices[mesh.vertex_size] = position[i1];
-					//mesh.vertices[mesh.vertex_size + 1] = position[i2];
-					//mesh.vertices[mesh.vertex_size + 2] = position[i3];
-
-					//mesh.normals[mesh.normal_size] = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
-					//mesh.normals[mesh.normal_size + 1] = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
-					//mesh.normals[mesh.normal_size + 2] = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
-
-					//std::cout << "f: " << i1 << ", " << i2 << ", " << i3 << std::endl;
-
-					//if (token_length == 5) // quad
-					//{
-					//	int i4 = std::stoi(tokens[4].substr(0, tokens[4].find('/'))) + index_offset;
-					//	mesh.indices[mesh.index_size + 3] = i3 - 1;
-					//	mesh.indices[mesh.index_size + 4] = i4 - 1;
-					//	mesh.indices[mesh.index_size + 5] = i1 - 1;
-					//	mesh.index_size += 3;
-					//}
-					/*mesh.index_size += 3;
-					mesh.vertex_size += 3;
-					mesh.normal_size += 3;*/
 				}
-				else if (tokens[0] == "mtlib" || tokens[0] == "mtllib")
+				else if (tokens[0] == "sphere" && token_length > 4)
 				{
-					// check if mtl file was already loaded
-					if (!checkLoadedMaterialFile(tokens[1]))
-					{
-						loaded_material_files.push_back(tokens[1]);
+					// sphere x y z radius, the radius is kept as a point on the surface
+					unsigned int center = addShapeVertex(tokens, 1, object);
+					object.vertices.push_back(object.vertices[center] + glm::vec4(std::stof(tokens[4]), 0.0f, 0.0f, 0.0f));
+					object.normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+					object.texture.push_back(glm::vec2(0.0f));
+					addShape(SPHERE_PRIMITIVE, center, center + 1, center, curr_material, object);
+				}
+				else if (tokens[0] == "plane" && token_length > 9)
+				{
+					// plane x y z ux uy uz vx vy vz, a corner and the two edges from it
+					unsigned int corner = addShapeVertex(tokens, 1, object);
+					unsigned int u = addShapeVertex(tokens, 4, object);
+					unsigned int v = addShapeVertex(tokens, 7, object);
+					object.vertices[u] += glm::vec4(glm::vec3(object.vertices[corner]), 0.0f);
+					object.vertices[v] += glm::vec4(glm::vec3(object.vertices[corner]), 0.0f);
+					addShape(PLANE_PRIMITIVE, corner, u, v, curr_material, object);
+				}
+				else if (tokens[0] == "box" && token_length > 6)
+				{
+					// box x0 y0 z0 x1 y1 z1, two opposite corners
+					unsigned int a = addShapeVertex(tokens, 1, object);
+					unsigned int b = addShapeVertex(tokens, 4, object);
+					addShape(BOX_PRIMITIVE, a, b, a, curr_material, object);
+				}
+				else if ((tokens[0] == "mtlib" || tokens[0] == "mtllib") && token_length > 1)
+				{
+					// load mtl file, the scene skips it when merging if it was already loaded
+					object.material_files.push_back(path + tokens[1]);
+					object.material_file_starts.push_back(object.materials.size());
 
-						// load mtl file
-						MaterialLoader mat_loader;
-						mat_loader.loadMaterials(path + tokens[1], &materials, &material_names);
-					}
+					MaterialLoader mat_loader;
+					mat_loader.loadMaterials(path + tokens[1], &object.materials, &object.material_names, &object.material_maps);
 				}
-				else if (tokens[0] == "usemtl")
+				else if (tokens[0] == "usemtl" && token_length > 1)
 				{
-					// search for material and set current material
-					setCurrentMaterial(tokens[1], &curr_material);
+					// materials are resolved by name when the object is merged
+					curr_material = getMaterialRef(tokens[1], object);
 				}
 			}
 		}
 		file.close();
+
+		// files without normals get smooth ones from the face windings
+		if (normals.empty())
+		{
+			for (unsigned int i = 0; i < object.normals.size(); ++i)
+				object.normals[i] = glm::vec4(0.0f);
+			for (const Primitive& p : object.primitives)
+			{
+				if (p.type() != TRIANGLE_PRIMITIVE)
+					continue;
+				glm::vec3 a = glm::vec3(object.vertices[p.vertex_a]);
+				glm::vec3 face = glm::cross(glm::vec3(object.vertices[p.vertex_b]) - a, glm::vec3(object.vertices[p.vertex_c]) - a);
+				object.normals[p.vertex_a] += glm::vec4(face, 0.0f);
+				object.normals[p.vertex_b] += glm::vec4(face, 0.0f);
+				object.normals[p.vertex_c] += glm::vec4(face, 0.0f);
+			}
+			for (unsigned int i = 0; i < object.normals.size(); ++i)
+			{
+				glm::vec3 n = glm::vec3(object.normals[i]);
+				float length = glm::length(n);
+				object.normals[i] = length > 0.0f ? glm::vec4(n / length, 1.0f) : glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			}
+		}
+	}
+
+	// appends a parsed object to the scene and returns its index, or -1 if it does not fit.
+	// Objects must be merged in the same order every run for the primitive and material ids
+	// to be deterministic
+	int mergeObject(ObjectData& object)
+	{
+		if (object.vertices.size() > (size_t)(SceneData::max_vertices - scene_data.vertex_size) ||
+			object.primitives.size() > (size_t)(max_primitives - num_primitives))
+		{
+			dlogln("object " << object.name << " does not fit in the scene: " << object.vertices.size() << " vertices and " << object.primitives.size() <<
+				" primitives, " << SceneData::max_vertices - scene_data.vertex_size << " and " << max_primitives - num_primitives << " left");
+			return -1;
+		}
+
+		// add materials from mtl files that have not been loaded yet. Names resolve to the
+		// object's own materials first, then to any material in the scene
+		std::unordered_map<std::string, unsigned int> local_ids;
+		for (unsigned int i = 0; i < object.material_files.size(); ++i)
+		{
+			unsigned int start = object.material_file_starts[i];
+			unsigned int end = i + 1 < object.material_files.size() ? object.material_file_starts[i + 1] : object.materials.size();
+
+			if (!checkLoadedMaterialFile(object.material_files[i]))
+			{
+				std::vector<unsigned int> ids;
+				for (unsigned int j = start; j < end; ++j)
+					ids.push_back(addMaterial(object.materials[j], object.material_maps[j], object.material_names[j]));
+				material_files.emplace(object.material_files[i], ids);
+			}
+
+			std::vector<unsigned int>& ids = material_files[object.material_files[i]];
+			for (unsigned int j = start; j < end && j - start < ids.size(); ++j)
+				local_ids.emplace(object.material_names[j], ids[j - start]);
+		}
+
+		// resolve material names to scene ids
+		std::vector<unsigned int> ref_ids(object.material_refs.size(), 0u);
+		for (unsigned int i = 1; i < object.material_refs.size(); ++i)
+		{
+			auto it = local_ids.find(object.material_refs[i]);
+			if (it != local_ids.end())
+				ref_ids[i] = it->second;
+			else
+				setCurrentMaterial(object.material_refs[i], &ref_ids[i]);
+		}
+
+		SceneObject scene_object;
+		scene_object.name = object.name;
+		scene_object.vertex_start = scene_data.vertex_size;
+		scene_object.vertex_count = object.vertices.size();
+		scene_object.prim_start = num_primitives;
+		scene_object.prim_count = object.primitives.size();
+		scene_object.local_vertices = std::move(object.vertices);
+		scene_object.node_start = -1;
+		scene_object.removed = false;
+
+		unsigned int vertex_offset = scene_data.vertex_size;
+		for (unsigned int i = 0; i < scene_object.vertex_count; ++i)
+		{
+			scene_data.normals[vertex_offset + i] = object.normals[i];
+			scene_data.texture[vertex_offset + i] = object.texture[i];
+		}
+		scene_data.vertex_size += scene_object.vertex_count;
+
+		for (unsigned int i = 0; i < object.primitives.size(); ++i)
+		{
+			Primitive& p = primitives[num_primitives];
+			p.vertex_a = object.primitives[i].vertex_a + vertex_offset;
+			p.vertex_b = object.primitives[i].vertex_b + vertex_offset;
+			p.vertex_c = object.primitives[i].vertex_c + vertex_offset; // keeps the type bits
+			p.material = ref_ids[object.primitives[i].material];
+			num_primitives++;
+		}
+		dirty_primitives.add(scene_object.prim_start, num_primitives);
+
+		objects.push_back(std::move(scene_object));
+		transformObject(objects.size() - 1, object.offset, object.scale);
+		return (int)objects.size() - 1;
+	}
+
+	// takes back the last merged object's vertices and primitives, its materials stay loaded
+	void unmergeLastObject()
+	{
+		SceneObject& object = objects.back();
+		scene_data.vertex_size = object.vertex_start;
+		num_primitives = object.prim_start;
+		objects.pop_back();
+	}
+
+	void loadObject(const std::string& path, const std::string& filename, glm::vec3 offset, glm::vec3 scale)
+	{
+		ObjectData object;
+		parseObject(path, filename, offset, scale, object);
+		mergeObject(object);
+	}
+
+	// moves and scales an object's vertices, the BVH has to be refit afterwards. Spheres
+	// stay round, their radius scales by the largest axis
+	void transformObject(unsigned int index, glm::vec3 offset, glm::vec3 scale)
+	{
+		SceneObject& object = objects[index];
+		object.offset = offset;
+		object.scale = scale;
+
+		glm::vec4 offs = glm::vec4(offset.x, offset.y, offset.z, 0.0f);
+		glm::vec4 sc   = glm::vec4(scale.x, scale.y, scale.z, 1.0f);
+		for (unsigned int i = 0; i < object.vertex_count; ++i)
+			scene_data.vertices[object.vertex_start + i] = object.local_vertices[i] * sc + offs;
+
+		float radius_scale = std::max(std::abs(scale.x), std::max(std::abs(scale.y), std::abs(scale.z)));
+		bool uniform = std::abs(scale.x) == std::abs(scale.y) && std::abs(scale.y) == std::abs(scale.z);
+		bool has_spheres = false;
+		for (unsigned int i = object.prim_start; i < object.prim_start + object.prim_count; ++i)
+		{
+			const Primitive& p = primitives[i];
+			if (p.type() != SPHERE_PRIMITIVE)
+				continue;
+			// the surface point is kept in the radius' direction, scaled like the center
+			glm::vec4 radius = object.local_vertices[p.vertex_b - object.vertex_start] - object.local_vertices[p.vertex_a - object.vertex_start];
+			scene_data.vertices[p.vertex_b] = scene_data.vertices[p.vertex_a] + radius * radius_scale;
+			has_spheres = true;
+		}
+		if (has_spheres && !uniform)
+			dlogln("object " << object.name << " has spheres, they cannot be scaled per axis and use the largest scale");
+
+		dirty_vertices.add(object.vertex_start, object.vertex_start + object.vertex_count);
+	}
+
+	// marks a material for upload after it was edited
+	void updateMaterial(unsigned int id)
+	{
+		dirty_materials.add(id, id + 1);
 	}
 
 	void createSceneBuffer()
 	{
 		//std::cout << "mesh size: " << sizeof(mesh) << std::endl;
-		dlogln("vertices: " << scene_data.vertex_size << " | normals: " << scene_data.normal_size << " | textures: " << scene_data.texture_size << " | primitives: " << num_primitives);
-		dlogln("BVH nodes: " << num_nodes);
+		dlogln("vertices: " << scene_data.vertex_size << " | objects: " << objects.size());
 
 		glGenBuffers(1, &data_buffer);
 		
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, data_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(scene_data), &scene_data, GL_DYNAMIC_READ);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(scene_data), &scene_data, GL_DYNAMIC_DRAW);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, data_buffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		dirty_vertices.clear();
+	}
+
+	static int mapSlot(int map, const std::vector<int>& slots)
+	{
+		return map >= 0 && map < (int)slots.size() ? slots[map] : -1;
+	}
+
+	// materials [start, end) as the shaders see them, with the maps pointing into the texture
+	// arrays. Maps without a slot yet are dropped
+	std::vector<Material> gpuMaterials(unsigned int start, unsigned int end) const
+	{
+		std::vector<Material> gpu_materials(materials.begin() + start, materials.begin() + end);
+		for (Material& material : gpu_materials)
+		{
+			material.base_map = mapSlot(material.base_map, color_map_slots);
+			material.emissive_map = mapSlot(material.emissive_map, color_map_slots);
+			material.specular_map = mapSlot(material.specular_map, color_map_slots);
+			material.roughness_map = mapSlot(material.roughness_map, data_map_slots);
+			material.metallic_map = mapSlot(material.metallic_map, data_map_slots);
+			material.normal_map = mapSlot(material.normal_map, data_map_slots);
+			material.opacity_map = mapSlot(material.opacity_map, data_map_slots);
+		}
+		return gpu_materials;
 	}
 
 	void createMaterialBuffer()
 	{
+		// leave room for materials added by later edits
+		material_capacity = glm::max(64u, (unsigned int)materials.size() * 2);
+
 		glGenBuffers(1, &material_buffer);
 
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Material) * materials.size(), &materials[0], GL_DYNAMIC_READ);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Material) * material_capacity, NULL, GL_DYNAMIC_DRAW);
+		std::vector<Material> gpu_materials = gpuMaterials(0, materials.size());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Material) * gpu_materials.size(), gpu_materials.data());
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, material_buffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		dirty_materials.clear();
 	}
 
 	void createPrimitiveBuffer()
 	{
+		dlogln("primitives: " << num_primitives << " (" << sizeof(Primitive) * num_primitives << " bytes)");
+
 		glGenBuffers(1, &primitive_buffer);
 
+		// allocated at full capacity so objects can be added without reallocating
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, primitive_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(primitives), &primitives, GL_DYNAMIC_READ);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(primitives), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Primitive) * num_primitives, &primitives);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, primitive_buffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		dirty_primitives.clear();
 	}
 
 	void createBVHBuffer()
@@ -353,31 +773,222 @@ public:
 		glGenBuffers(1, &bvh_buffer);
 
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_buffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(nodes), &nodes, GL_DYNAMIC_READ);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(nodes), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Node) * num_nodes, &nodes);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvh_buffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		dirty_nodes.clear();
 	}
 
-	void updateMaterialBuffer()
+	// finds the primitives with an emissive material and builds the light tree over them,
+	// must run after the BVH reorders them
+	void updateLights()
 	{
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_buffer);
-		GLvoid* p = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-		memcpy(p, &materials[0], sizeof(Material) * materials.size());
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		lights.clear();
+		for (unsigned int i = 0; i < objects.size(); ++i)
+		{
+			SceneObject& object = objects[i];
+			if (object.removed)
+				continue;
+			for (unsigned int j = object.prim_start; j < object.prim_start + object.prim_count; ++j)
+			{
+				// shapes are not sampled as lights, they still emit when hit
+				if (primitives[j].type() != TRIANGLE_PRIMITIVE)
+					continue;
+				Material& mat = materials[primitives[j].material];
+				if ((glm::length(glm::vec3(mat.emissive)) > 0.0f && mat.emission > 0.0f) || mat.emissive_map >= 0)
+					lights.push_back(j);
+			}
+		}
+		// sorted so a light hit finds its index with a binary search
+		std::sort(lights.begin(), lights.end());
+
+		std::vector<LightBounds> bounds(lights.size());
+		for (unsigned int i = 0; i < lights.size(); ++i)
+		{
+			const Primitive& prim = primitives[lights[i]];
+			const Material& mat = materials[prim.material];
+			glm::vec3 a = scene_data.vertices[prim.vertex_a];
+			glm::vec3 b = scene_data.vertices[prim.vertex_b];
+			glm::vec3 c = scene_data.vertices[prim.vertex_c];
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float area = glm::length(n) * 0.5f;
+
+			// radiance like the shaders, emissive maps are taken as white
+			float strength = mat.emissive_map >= 0 ? 1.0f : glm::length(glm::vec3(mat.emissive));
+			float albedo = glm::dot(glm::vec3(mat.albedo), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			bounds[i].min = glm::min(glm::min(a, b), c);
+			bounds[i].max = glm::max(glm::max(a, b), c);
+			bounds[i].power = area * albedo * (strength * mat.emission + 1.0f);
+			bounds[i].axis = area > 0.0f ? n / (area * 2.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+			bounds[i].cos_theta_o = 1.0f;
+			bounds[i].cos_theta_e = 0.0f; // diffuse emitters light the whole hemisphere
+		}
+		light_tree.build(bounds);
+	}
+
+	void createLightBuffer()
+	{
+		updateLights();
+
+		if (light_buffer == 0)
+			glGenBuffers(1, &light_buffer);
+
+		// int num_lights followed by the primitive indices
+		int num_lights = lights.size();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, light_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(int) * (lights.size() + 1), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &num_lights);
+		if (num_lights > 0)
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(int), sizeof(int) * num_lights, &lights[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, light_buffer);
+
+		// light tree nodes, one placeholder keeps the buffer bindable without lights
+		if (light_tree_buffer == 0)
+			glGenBuffers(1, &light_tree_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, light_tree_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(LightNode) * glm::max((int)light_tree.nodes.size(), 1), NULL, GL_DYNAMIC_DRAW);
+		if (!light_tree.nodes.empty())
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(LightNode) * light_tree.nodes.size(), light_tree.nodes.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, light_tree_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// the environment is sampled like the lights
+		if (environment_buffer == 0)
+			createEnvironmentBuffer();
+	}
+
+	// size of the environment table followed by its entries, a zero size turns sampling off
+	void createEnvironmentBuffer()
+	{
+		if (environment_buffer == 0)
+			glGenBuffers(1, &environment_buffer);
+
+		int size[4] = { environment.width, environment.height, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, environment_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(size) + sizeof(EnvironmentEntry) * environment.entries.size(), NULL, GL_STATIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(size), size);
+		if (!environment.entries.empty())
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(size), sizeof(EnvironmentEntry) * environment.entries.size(), environment.entries.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, environment_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// bytes of scene data in the GPU buffers, which are allocated at fixed capacities
+	size_t dataBytes() const
+	{
+		size_t vertex_bytes = sizeof(glm::vec4) * 2 + sizeof(glm::vec2);
+		return scene_data.vertex_size * vertex_bytes + num_primitives * sizeof(Primitive) + num_nodes * sizeof(Node) +
+			materials.size() * sizeof(Material) + (lights.size() + 1) * sizeof(int) +
+			light_tree.nodes.size() * sizeof(LightNode) + environment.entries.size() * sizeof(EnvironmentEntry);
 	}
 
-	void setBaseMap(unsigned int map)
+	// uploads only the ranges changed since the buffers were created or last updated,
+	// returns true if anything was uploaded
+	bool updateBuffers()
 	{
-		base_map = map;
+		bool updated = false;
+
+		// primitive, material, and object edits can change which primitives are lights
+		if (!dirty_primitives.empty() || !dirty_materials.empty() || !dirty_nodes.empty())
+			createLightBuffer();
+
+		if (!dirty_vertices.empty())
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, data_buffer);
+			for (glm::ivec2& r : dirty_vertices.merged())
+			{
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(SceneData, vertices) + sizeof(glm::vec4) * r.x, sizeof(glm::vec4) * (r.y - r.x), &scene_data.vertices[r.x]);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(SceneData, normals) + sizeof(glm::vec4) * r.x, sizeof(glm::vec4) * (r.y - r.x), &scene_data.normals[r.x]);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(SceneData, texture) + sizeof(glm::vec2) * r.x, sizeof(glm::vec2) * (r.y - r.x), &scene_data.texture[r.x]);
+			}
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(SceneData, vertex_size), sizeof(int), &scene_data.vertex_size);
+			dirty_vertices.clear();
+			updated = true;
+		}
+
+		if (!dirty_primitives.empty())
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, primitive_buffer);
+			for (glm::ivec2& r : dirty_primitives.merged())
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Primitive) * r.x, sizeof(Primitive) * (r.y - r.x), &primitives[r.x]);
+			dirty_primitives.clear();
+			updated = true;
+		}
+
+		if (!dirty_nodes.empty())
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_buffer);
+			for (glm::ivec2& r : dirty_nodes.merged())
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Node) * r.x, sizeof(Node) * (r.y - r.x), &nodes[r.x]);
+			dirty_nodes.clear();
+			updated = true;
+		}
+
+		if (!dirty_materials.empty())
+		{
+			if (materials.size() > material_capacity)
+			{
+				// out of room, reallocate with the new materials
+				glDeleteBuffers(1, &material_buffer);
+				createMaterialBuffer();
+			}
+			else
+			{
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_buffer);
+				for (glm::ivec2& r : dirty_materials.merged())
+				{
+					std::vector<Material> gpu_materials = gpuMaterials(r.x, r.y);
+					glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Material) * r.x, sizeof(Material) * (r.y - r.x), gpu_materials.data());
+				}
+				dirty_materials.clear();
+			}
+			updated = true;
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return updated;
 	}
 
 	void setEnvironmentMap(unsigned int map)
 	{
 		environment_map = map;
+		environment.build(map);
+		if (environment_buffer != 0)
+			createEnvironmentBuffer();
 	}
-	void setEmissiveMap(unsigned int map)
+	// texture arrays of each size class and the slot of every texture file in them
+	void setMaterialTextures(const unsigned int* color, const unsigned int* data, const std::vector<int>& color_slots, const std::vector<int>& data_slots)
 	{
-		emissive_map = map;
+		for (int i = 0; i < map_classes; ++i)
+		{
+			color_textures[i] = color[i];
+			data_textures[i] = data[i];
+		}
+		color_map_slots = color_slots;
+		data_map_slots = data_slots;
+		dirty_materials.add(0, materials.size());
+	}
+
+	void bindMaterialTextures()
+	{
+		for (int i = 0; i < map_classes; ++i)
+		{
+			glActiveTexture(GL_TEXTURE0 + map_unit + i);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, color_textures[i]);
+			glActiveTexture(GL_TEXTURE0 + map_unit + map_classes + i);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, data_textures[i]);
+		}
+	}
+
+	// points the map samplers of a shader at the units bindMaterialTextures() uses
+	static void setMaterialTextureUnits(Shader* shader)
+	{
+		for (int i = 0; i < map_classes; ++i)
+		{
+			shader->setInt("color_textures[" + std::to_string(i) + "]", map_unit + i);
+			shader->setInt("data_textures[" + std::to_string(i) + "]", map_unit + map_classes + i);
+		}
 	}
 
 	bool ImGuiDisplayMaterialTree()
@@ -403,22 +1014,22 @@ public:
 				// display properties
 				if (ImGui::ColorEdit3("Albedo", (float*)&mat.albedo, ImGuiColorEditFlags_Float | ImGuiConfigFlags_IsSRGB))
 				{
-					updateMaterialBuffer();
+					updateMaterial(i);
 					updated = true;
 				}
 				if (ImGui::SliderFloat("Roughness", &mat.roughness, 0.0f, 1.0f))
 				{
-					updateMaterialBuffer();
+					updateMaterial(i);
 					updated = true;
 				}
 				if (ImGui::SliderFloat("Metallic", &mat.metal, 0.0f, 1.0f))
 				{
-					updateMaterialBuffer();
+					updateMaterial(i);
 					updated = true;
 				}
 				if (ImGui::SliderFloat("Emission", &mat.emission, 1.0f, 50.0f, "%.3f", ImGuiSliderFlags_Logarithmic))
 				{
-					updateMaterialBuffer();
+					updateMaterial(i);
 					updated = true;
 				}
 				ImGui::TreePop();
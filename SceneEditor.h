@@ -0,0 +1,168 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Debug.h"
+#include "Scene.h"
+#include "BVH.h"
+#include "ImGuiRenderer.h"
+
+// Edits a loaded scene in place. Edits rebuild or refit only the touched object's BVH
+// subtree and mark the changed ranges, update() uploads them with glBufferSubData
+// instead of recreating the scene buffers.
+class SceneEditor
+{
+	Scene* scene;
+	BVH* bvh;
+
+	// maps added after the texture arrays were built at load time have no layer to sample
+	void clearNewMaps(unsigned int first_material, int color_layers, int data_layers)
+	{
+		for (unsigned int i = first_material; i < scene->materials.size(); ++i)
+		{
+			Material& mat = scene->materials[i];
+			int* color_maps[] = { &mat.base_map, &mat.emissive_map, &mat.specular_map };
+			int* data_maps[] = { &mat.roughness_map, &mat.metallic_map, &mat.normal_map, &mat.opacity_map };
+			for (int* map : color_maps)
+			{
+				if (*map >= color_layers)
+					*map = -1;
+			}
+			for (int* map : data_maps)
+			{
+				if (*map >= data_layers)
+					*map = -1;
+			}
+		}
+	}
+
+public:
+	SceneEditor(Scene* scene) : scene(scene)
+	{
+		bvh = new BVH(scene);
+	}
+	~SceneEditor()
+	{
+		delete(bvh);
+	}
+
+	// loads an object on the calling thread, returns its index or -1 if it or its BVH does
+	// not fit
+	int addObject(const std::string& path, const std::string& filename, glm::vec3 offset, glm::vec3 scale)
+	{
+		unsigned int first_material = scene->materials.size();
+		int color_layers = scene->color_texture_files.size();
+		int data_layers = scene->data_texture_files.size();
+
+		ObjectData object;
+		scene->parseObject(path, filename, offset, scale, object);
+		int index = scene->mergeObject(object);
+		if (index < 0)
+			return -1;
+
+		if ((int)scene->color_texture_files.size() > color_layers || (int)scene->data_texture_files.size() > data_layers)
+		{
+			dlogln("texture maps of " << path + filename << " are loaded on the next run");
+			clearNewMaps(first_material, color_layers, data_layers);
+		}
+
+		bvh->buildObject(index);
+		if (!bvh->flatten())
+		{
+			scene->unmergeLastObject();
+			return -1;
+		}
+		return index;
+	}
+
+	// the object's vertices and primitives stay allocated, it is only dropped from the BVH
+	void removeObject(unsigned int index)
+	{
+		if (scene->objects[index].removed)
+			return;
+		scene->objects[index].removed = true;
+		bvh->flatten();
+	}
+
+	void transformObject(unsigned int index, glm::vec3 offset, glm::vec3 scale)
+	{
+		scene->transformObject(index, offset, scale);
+		bvh->refitObject(index);
+	}
+
+	// rebuilds the top level tree, moving objects far only refits it
+	void rebuildTopLevel()
+	{
+		bvh->flatten();
+	}
+
+	void editMaterial(unsigned int id, const Material& material)
+	{
+		scene->materials[id] = material;
+		scene->updateMaterial(id);
+	}
+
+	// uploads pending edits, returns true if the image needs to be reset
+	bool update()
+	{
+		return scene->updateBuffers();
+	}
+
+	bool ImGuiDisplayObjectTree()
+	{
+		bool updated = false;
+
+		static ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_BordersOuterH | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg | ImGuiTableFlags_NoBordersInBody;
+		static ImGuiTreeNodeFlags tree_node_flags = ImGuiTreeNodeFlags_SpanAllColumns;
+
+		ImGui::BeginTable("Objects", 1, flags);
+		ImGui::TableSetupColumn("Objects", ImGuiTableColumnFlags_NoHide);
+		ImGui::TableHeadersRow();
+
+		for (unsigned int i = 0; i < scene->objects.size(); ++i)
+		{
+			SceneObject& object = scene->objects[i];
+			if (object.removed)
+				continue;
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::PushID(i);
+			bool open = ImGui::TreeNodeEx(object.name.c_str(), tree_node_flags);
+
+			if (open)
+			{
+				glm::vec3 offset = object.offset;
+				glm::vec3 scale = object.scale;
+				bool moved = ImGui::DragFloat3("Offset", (float*)&offset, 0.1f);
+				bool released = ImGui::IsItemDeactivatedAfterEdit();
+				moved |= ImGui::DragFloat3("Scale", (float*)&scale, 0.01f);
+				released |= ImGui::IsItemDeactivatedAfterEdit();
+				if (moved)
+				{
+					transformObject(i, offset, scale);
+					updated = true;
+				}
+				// refitting keeps the top level split from the load, rebuild it once the drag ends
+				if (released)
+				{
+					rebuildTopLevel();
+				}
+				if (ImGui::Button("Remove"))
+				{
+					removeObject(i);
+					updated = true;
+				}
+				ImGui::TreePop();
+			}
+			ImGui::PopID();
+		}
+
+		ImGui::EndTable();
+
+		return updated;
+	}
+};
@@ -1,92 +1,324 @@
 #pragma once
 #include <glad/glad.h>
 
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <filesystem>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
+#include "Debug.h"
+
+// header of a cached program binary
+struct ProgramCacheHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned long long key;
+	unsigned int format;
+	int length;
+};
+
+// Shader program built from source files. Sources are preprocessed before compiling:
+// #include "file" pastes a file relative to the including one, once per program, and the
+// defines string is inserted after the #version line so one file compiles to specialized
+// variants. Linked programs are cached as driver binaries in ShaderCache/, keyed by a hash
+// of the preprocessed sources and the driver, so later runs skip compiling.
 class Shader
 {
-public:
-	unsigned int m_ID;
+	static const unsigned int cache_version = 1;
 
-	Shader(const char* vertex_path, const char* fragment_path)
+	struct Stage
 	{
-		// retrieve code from path
-		std::string vertex_code;
-		std::string fragment_code;
+		GLenum type;
+		const char* name;
+		std::string code;
+		std::vector<std::string> files; // indexed by the source numbers in compile errors
+	};
 
-		std::ifstream v_shader_file;
-		std::ifstream f_shader_file;
+	mutable std::unordered_map<std::string, int> uniform_locations;
 
-		v_shader_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		f_shader_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	static bool readFile(const std::string& path, std::string& code)
+	{
+		std::ifstream file;
+		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 		try
 		{
-			v_shader_file.open(vertex_path);
-			f_shader_file.open(fragment_path);
-			std::stringstream v_shader_stream, f_shader_stream;
+			file.open(path);
+			std::stringstream stream;
+			stream << file.rdbuf();
+			file.close();
+			code = stream.str();
+		}
+		catch (std::ifstream::failure e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// appends the file to code with its includes resolved, #line directives keep compile
+	// errors pointing at the right file and line
+	static bool preprocess(const std::string& path, const std::string& defines, std::string& code, std::vector<std::string>& files)
+	{
+		std::string source;
+		if (!readFile(path, source))
+			return false;
 
-			v_shader_stream << v_shader_file.rdbuf();
-			f_shader_stream << f_shader_file.rdbuf();
+		int file_index = files.size();
+		files.push_back(path);
+		size_t code_start = code.size();
+		bool defines_added = file_index != 0;
+
+		std::istringstream lines(source);
+		std::string line;
+		int line_number = 0;
+		while (std::getline(lines, line))
+		{
+			line_number++;
 
-			v_shader_file.close();
-			f_shader_file.close();
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0)
+			{
+				size_t open = line.find('"', start);
+				size_t close = line.find('"', open + 1);
+				if (open == std::string::npos || close == std::string::npos)
+				{
+					std::cout << "ERROR::SHADER::INVALID_INCLUDE: " << path << "(" << line_number << ")" << std::endl;
+					return false;
+				}
+				std::filesystem::path include = std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1);
+				std::string include_path = include.lexically_normal().generic_string();
 
-			vertex_code = v_shader_stream.str();
-			fragment_code = f_shader_stream.str();
+				bool included = false;
+				for (const std::string& file : files)
+					included |= file == include_path;
+				if (!included)
+				{
+					code += "#line 1 " + std::to_string(files.size()) + "\n";
+					if (!preprocess(include_path, "", code, files))
+						return false;
+					code += "#line " + std::to_string(line_number + 1) + " " + std::to_string(file_index) + "\n";
+				}
+				else
+					code += "\n";
+				continue;
+			}
+
+			code += line + "\n";
+
+			// specializations go right after #version, only comments may come before it
+			if (!defines_added && start != std::string::npos && line.compare(start, 8, "#version") == 0)
+			{
+				code += defines + "#line " + std::to_string(line_number + 1) + " 0\n";
+				defines_added = true;
+			}
 		}
-		catch (std::ifstream::failure e)
+
+		// without a #version line the defines lead the source
+		if (!defines_added)
+			code.insert(code_start, defines + "#line 1 0\n");
+		return true;
+	}
+
+	static bool loadStage(GLenum type, const char* name, const char* path, const std::string& defines, std::vector<Stage>& stages)
+	{
+		Stage stage = { type, name, "", {} };
+		if (!preprocess(path, defines, stage.code, stage.files))
+			return false;
+		stages.push_back(stage);
+		return true;
+	}
+
+	// FNV-1a of the sources and the driver, binaries only load on the driver that wrote them
+	static unsigned long long cacheKey(const std::vector<Stage>& stages)
+	{
+		std::string driver;
+		GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum s : strings)
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+			const char* value = (const char*)glGetString(s);
+			driver += value ? value : "";
+			driver += "\n";
 		}
-		const char* v_shader_code = vertex_code.c_str();
-		const char* f_shader_code = fragment_code.c_str();
 
-		// compile shaders
-		unsigned int vertex, fragment;
-		int success;
-		char infolog[512];
+		unsigned long long hash = 14695981039346656037ull;
+		auto add = [&hash](const std::string& data)
+		{
+			for (unsigned char c : data)
+			{
+				hash ^= c;
+				hash *= 1099511628211ull;
+			}
+		};
+		add(driver);
+		for (const Stage& stage : stages)
+		{
+			add(std::to_string(stage.type));
+			add(stage.code);
+		}
+		return hash;
+	}
+
+	static std::string cacheName(unsigned long long key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", key);
+		return "ShaderCache/" + std::string(name);
+	}
+
+	bool readCache(unsigned long long key)
+	{
+		std::ifstream file(cacheName(key), std::ios::binary);
+		if (!file)
+			return false;
+
+		ProgramCacheHeader header;
+		file.read((char*)&header, sizeof(header));
+		if (!file || std::string(header.magic, 4) != "RTPB" || header.version != cache_version || header.key != key || header.length <= 0)
+			return false;
+
+		std::vector<char> binary(header.length);
+		file.read(binary.data(), header.length);
+		if (!file)
+			return false;
 
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &v_shader_code, NULL);
-		glCompileShader(vertex);
+		m_ID = glCreateProgram();
+		glProgramBinary(m_ID, header.format, binary.data(), header.length);
 
-		glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+		// drivers reject binaries they can no longer load, e.g. after an update
+		int success;
+		glGetProgramiv(m_ID, GL_LINK_STATUS, &success);
 		if (!success)
 		{
-			glGetShaderInfoLog(vertex, 512, NULL, infolog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infolog << std::endl;
+			glDeleteProgram(m_ID);
+			m_ID = 0;
+			return false;
 		}
+		return true;
+	}
+
+	void writeCache(unsigned long long key)
+	{
+		int length = 0;
+		glGetProgramiv(m_ID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
 
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &f_shader_code, NULL);
-		glCompileShader(fragment);
+		ProgramCacheHeader header;
+		memcpy(header.magic, "RTPB", 4);
+		header.version = cache_version;
+		header.key = key;
 
-		glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-		if (!success)
+		std::vector<char> binary(length);
+		glGetProgramBinary(m_ID, length, &header.length, &header.format, binary.data());
+		if (header.length <= 0)
+			return;
+
+		std::error_code ec;
+		std::filesystem::create_directories("ShaderCache", ec);
+		std::ofstream file(cacheName(key), std::ios::binary);
+		if (!file)
 		{
-			glGetShaderInfoLog(fragment, 512, NULL, infolog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infolog << std::endl;
+			dlogln("could not write shader cache: " << cacheName(key));
+			return;
+		}
+		file.write((char*)&header, sizeof(header));
+		file.write(binary.data(), header.length);
+	}
+
+	void build(const std::vector<Stage>& stages)
+	{
+		unsigned long long key = 0;
+		if (use_binary_cache)
+		{
+			int formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			if (formats > 0)
+			{
+				key = cacheKey(stages);
+				if (readCache(key))
+					return;
+			}
+		}
+
+		// compile shaders
+		int success;
+		char infolog[1024];
+		std::vector<unsigned int> shaders;
+		for (const Stage& stage : stages)
+		{
+			const char* code = stage.code.c_str();
+			unsigned int shader = glCreateShader(stage.type);
+			glShaderSource(shader, 1, &code, NULL);
+			glCompileShader(shader);
+
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(shader, sizeof(infolog), NULL, infolog);
+				std::cout << "ERROR::SHADER::" << stage.name << "::COMPILATION_FAILED\n" << infolog;
+				for (unsigned int i = 0; i < stage.files.size(); ++i)
+					std::cout << "source " << i << ": " << stage.files[i] << "\n";
+				std::cout << std::endl;
+			}
+			shaders.push_back(shader);
 		}
 
 		m_ID = glCreateProgram();
-		glAttachShader(m_ID, vertex);
-		glAttachShader(m_ID, fragment);
+		for (unsigned int shader : shaders)
+			glAttachShader(m_ID, shader);
+		if (key)
+			glProgramParameteri(m_ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(m_ID);
 
 		glGetProgramiv(m_ID, GL_LINK_STATUS, &success);
 		if (!success)
 		{
-			glGetProgramInfoLog(m_ID, 512, NULL, infolog);
+			glGetProgramInfoLog(m_ID, sizeof(infolog), NULL, infolog);
 			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infolog << std::endl;
 		}
 
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
+		for (unsigned int shader : shaders)
+			glDeleteShader(shader);
+
+		if (success && key)
+			writeCache(key);
+	}
+
+public:
+	unsigned int m_ID;
+
+	// set to false to always compile from source
+	static inline bool use_binary_cache = true;
+
+	// defines are inserted after the #version line of both stages
+	Shader(const char* vertex_path, const char* fragment_path, const std::string& defines = "") : m_ID(0)
+	{
+		std::vector<Stage> stages;
+		loadStage(GL_VERTEX_SHADER, "VERTEX", vertex_path, defines, stages);
+		loadStage(GL_FRAGMENT_SHADER, "FRAGMENT", fragment_path, defines, stages);
+		build(stages);
+	}
+
+	// compute shader program, defines are inserted after the #version line
+	Shader(const char* compute_path, const std::string& defines = "") : m_ID(0)
+	{
+		std::vector<Stage> stages;
+		loadStage(GL_COMPUTE_SHADER, "COMPUTE", compute_path, defines, stages);
+		build(stages);
+	}
+
+	~Shader()
+	{
+		glDeleteProgram(m_ID);
 	}
 
 	void addGeometryShader(const char* path)
@@ -99,40 +331,55 @@ public:
 		glUseProgram(m_ID);
 	}
 
+	// locations are looked up once per name
+	int location(const std::string& name) const
+	{
+		auto it = uniform_locations.find(name);
+		if (it != uniform_locations.end())
+			return it->second;
+		int loc = glGetUniformLocation(m_ID, name.c_str());
+		uniform_locations[name] = loc;
+		return loc;
+	}
+
 	unsigned int uniformLoc(const char* name)
 	{
-		return glGetUniformLocation(m_ID, name);
+		return location(name);
 	}
 	unsigned int uniformLoc(std::string& name)
 	{
-		return glGetUniformLocation(m_ID, name.c_str());
+		return location(name);
 	}
 	void setInt(const std::string& name, int val) const
 	{
-		glUniform1i(glGetUniformLocation(m_ID, name.c_str()), val);
+		glUniform1i(location(name), val);
 	}
 	void setFloat(const std::string& name, float val) const
 	{
-		glUniform1f(glGetUniformLocation(m_ID, name.c_str()), val);
+		glUniform1f(location(name), val);
 	}
 	void setVec2(const std::string& name, glm::vec2& vec) const
 	{
-		glUniform2f(glGetUniformLocation(m_ID, name.c_str()), vec.x, vec.y);
+		glUniform2f(location(name), vec.x, vec.y);
 	}
 	void setVec2(const std::string& name, const glm::vec2& vec) const
 	{
-		glUniform2f(glGetUniformLocation(m_ID, name.c_str()), vec.x, vec.y);
+		glUniform2f(location(name), vec.x, vec.y);
 	}
 	void setVec2(const std::string& name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(m_ID, name.c_str()), x, y);
+		glUniform2f(location(name), x, y);
 	}
 	void setVec3(const std::string& name, glm::vec3& vec) const
 	{
-		glUniform3f(glGetUniformLocation(m_ID, name.c_str()), vec.x, vec.y, vec.z);
+		glUniform3f(location(name), vec.x, vec.y, vec.z);
 	}
 	void setVec3(const std::string& name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(m_ID, name.c_str()), x, y, z);
+		glUniform3f(location(name), x, y, z);
+	}
+	void setMat4(const std::string& name, const glm::mat4& mat) const
+	{
+		glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
-};
\ No newline at end of file
+};
@@ -4,32 +4,10 @@ out vec4 FragColor;
 
 in vec2 TexCoord;
 
-uniform sampler2D dragon_texture;
-uniform sampler2D skybox_texture;
-const float pi = 3.14189265;
+// traversal cost view, the cost of each primary ray as a heatmap
+#define TRAVERSAL_STATS 1
 
-struct Node
-{
-	int axis;
-	int left;
-	int num_tris;
-	int tri_index;
-	vec3 min;
-	vec3 max;
-};
-
-layout(std140, binding = 4) uniform renderData
-{
-	mat4 camera;
-	vec3 camera_pos;
-	int num_nodes;
-	int curr_frame;
-};
-
-layout(std430, binding = 3) buffer bvhBuffer
-{
-	Node nodes[];
-};
+#include "Include/Scene.shader"
 
 struct Ray
 {
@@ -40,33 +18,33 @@ struct Ray
 	bool terminate;
 };
 
-bool intersect(Ray ray, Node aabb)
-{
-	float tx1 = (aabb.min.x - ray.start.x) * ray.inv.x;
-	float tx2 = (aabb.max.x - ray.start.x) * ray.inv.x;
-
-	float tmin = min(tx1, tx2);
-	float tmax = max(tx1, tx2);
-
-	float ty1 = (aabb.min.y - ray.start.y) * ray.inv.y;
-	float ty2 = (aabb.max.y - ray.start.y) * ray.inv.y;
-
-	tmin = max(tmin, min(ty1, ty2));
-	tmax = min(tmax, max(ty1, ty2));
+#include "Include/Intersect.shader"
+#include "Include/Traverse.shader"
 
-	float tz1 = (aabb.min.z - ray.start.z) * ray.inv.z;
-	float tz2 = (aabb.max.z - ray.start.z) * ray.inv.z;
+// histogram of the costs of every shaded pixel, matches TraversalHistogram in Traversal.h
+#define NUM_BINS 64
+layout(std430, binding = 13) buffer traversalHistogram
+{
+	uint rays;
+	uint sums[4];
+	uint max_cost[4];
+	uint bins[4 * NUM_BINS];
+};
 
-	tmin = max(tmin, min(tz1, tz2));
-	tmax = min(tmax, max(tz1, tz2));
+uniform int stat; // 0 nodes, 1 leaves, 2 triangles, 3 stack depth
+uniform float max_heat; // cost shown as the hottest color
+uniform ivec4 bin_width;
 
-	return tmax > tmin && tmax > 0.0;
+vec3 heat(float x)
+{
+	return clamp(vec3(1.5) - abs(4.0 * x - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
 }
 
 void main()
 {
 	vec4 ray_start = vec4(0.0, 0.0, 0.0, 1.0);
-	vec4 ray_end = vec4((TexCoord.x - 0.5) * (3.0 / 2.0), TexCoord.y - 0.5, -1.0, 1.0);
+	float aspect = float(screen_size.x) / float(screen_size.y);
+	vec4 ray_end = vec4((TexCoord.x - 0.5) * aspect, TexCoord.y - 0.5, -1.0, 1.0);
 
 	vec3 start = (camera * ray_start).xyz;
 	vec3 end = (camera * ray_end).xyz;
@@ -79,14 +57,19 @@ void main()
 	ray.col = vec3(1.0);
 	ray.terminate = false;
 
-	vec3 bvh_col = vec3(0.0, 0.0, 0.0);
+	float t, u, v;
+	int prim;
+	closestHit(ray, t, u, v, prim);
+
+	ivec4 cost = ivec4(traversal_stats.nodes, traversal_stats.leaves, traversal_stats.triangles, traversal_stats.max_stack);
 
-	for (int i = 0; i < num_nodes; ++i)
+	atomicAdd(rays, 1u);
+	for (int i = 0; i < 4; ++i)
 	{
-		if (intersect(ray, nodes[i]))
-		{
-			bvh_col[nodes[i].axis] += 0.02;
-		}
+		atomicAdd(sums[i], uint(cost[i]));
+		atomicMax(max_cost[i], uint(cost[i]));
+		atomicAdd(bins[i * NUM_BINS + min(cost[i] / bin_width[i], NUM_BINS - 1)], 1u);
 	}
-	FragColor = vec4(bvh_col, 1.0);
-}
\ No newline at end of file
+
+	FragColor = vec4(heat(clamp(float(cost[stat]) / max_heat, 0.0, 1.0)), 1.0);
+}
@@ -0,0 +1,89 @@
+#version 430 core
+
+// one iteration of the edge-avoiding a-trous wavelet filter (Dammertz et al. 2010). The
+// first iteration divides the color by the albedo so texture detail is not blurred, the
+// last one multiplies it back
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba32f, binding = 0) uniform writeonly image2D result_image;
+
+uniform sampler2D color_texture;
+uniform sampler2D albedo_texture;
+uniform sampler2D normal_texture; // normal and first hit distance, zero on a miss
+
+uniform int step_size; // distance between the taps, doubles every iteration
+uniform bool first_iteration;
+uniform bool last_iteration;
+
+uniform float color_phi; // for one sample, divided by the square root of the pixel's count
+uniform float normal_phi;
+uniform float depth_phi;
+
+#include "Include/RenderData.shader"
+
+// B3 spline taps at offsets 0, 1 and 2
+const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+vec3 albedoAt(ivec2 coord)
+{
+	return max(texelFetch(albedo_texture, coord, 0).rgb, vec3(0.001));
+}
+
+vec3 colorAt(ivec2 coord)
+{
+	vec3 color = texelFetch(color_texture, coord, 0).rgb;
+	return first_iteration ? color / albedoAt(coord) : color;
+}
+
+void main()
+{
+	ivec2 screen_coord = ivec2(gl_GlobalInvocationID.xy);
+	if (screen_coord.x >= screen_size.x || screen_coord.y >= screen_size.y)
+		return;
+
+	vec3 color = colorAt(screen_coord);
+	// every iteration passes the sample count on in alpha
+	float samples = texelFetch(color_texture, screen_coord, 0).a;
+	float phi = color_phi / sqrt(max(samples, 1.0));
+	vec4 normal_depth = texelFetch(normal_texture, screen_coord, 0);
+
+	// misses have nothing to filter against
+	if (normal_depth.w > 0.0)
+	{
+		vec3 normal = normalize(normal_depth.xyz);
+
+		vec3 sum = vec3(0.0);
+		float weight_sum = 0.0;
+		for (int y = -2; y <= 2; ++y)
+		{
+			for (int x = -2; x <= 2; ++x)
+			{
+				ivec2 coord = screen_coord + ivec2(x, y) * step_size;
+				if (coord.x < 0 || coord.y < 0 || coord.x >= screen_size.x || coord.y >= screen_size.y)
+					continue;
+
+				vec4 tap_normal_depth = texelFetch(normal_texture, coord, 0);
+				if (tap_normal_depth.w <= 0.0)
+					continue;
+
+				vec3 tap_color = colorAt(coord);
+				vec3 color_diff = tap_color - color;
+				float color_weight = exp(-dot(color_diff, color_diff) / (phi * phi));
+				float normal_weight = pow(max(dot(normal, normalize(tap_normal_depth.xyz)), 0.0), normal_phi);
+				// depth along a slanted surface changes with the tap distance
+				float depth_weight = exp(-abs(tap_normal_depth.w - normal_depth.w) / (depth_phi * normal_depth.w * float(step_size)));
+
+				float weight = kernel[abs(x)] * kernel[abs(y)] * color_weight * normal_weight * depth_weight;
+				sum += tap_color * weight;
+				weight_sum += weight;
+			}
+		}
+		color = sum / weight_sum;
+	}
+
+	if (last_iteration)
+		color *= albedoAt(screen_coord);
+
+	imageStore(result_image, screen_coord, vec4(color, samples));
+}
@@ -0,0 +1,169 @@
+// metallic-roughness BSDF like glTF: a GGX specular lobe (Walter et al. 2007) over a
+// Lambertian diffuse lobe that the metallic blend and the Fresnel term take energy from.
+// The specular lobe is sampled from the visible normals (Heitz 2018) and the diffuse lobe
+// by the cosine. Include after Sampling.shader
+
+#define BSDF_PI 3.14159265
+// narrowest lobe, smaller widths lose the peak of the distribution to float precision
+#define MIN_ALPHA 0.002
+
+struct BSDF
+{
+	vec3 base;
+	float metallic;
+	float alpha; // GGX width, the squared roughness
+	vec3 f0; // reflectance at normal incidence
+	float specular_chance; // chance of sampling the specular lobe
+	// shading frame, normal is on the side the light leaves from
+	vec3 tangent;
+	vec3 bitangent;
+	vec3 normal;
+};
+
+// orthonormal basis around a unit vector (Duff et al. 2017)
+void orthonormalBasis(vec3 n, out vec3 t, out vec3 b)
+{
+	float s = n.z >= 0.0 ? 1.0 : -1.0;
+	float a = -1.0 / (s + n.z);
+	float c = n.x * n.y * a;
+	t = vec3(1.0 + s * n.x * n.x * a, s * c, -s * n.x);
+	b = vec3(c, s + n.y * n.y * a, -n.y);
+}
+
+float luminance(vec3 c)
+{
+	return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 fresnelSchlick(vec3 f0, float cos_theta)
+{
+	float m = clamp(1.0 - cos_theta, 0.0, 1.0);
+	float m2 = m * m;
+	return f0 + (1.0 - f0) * (m2 * m2 * m);
+}
+
+// wo points away from the surface toward where the light goes, normal is on its side
+BSDF makeBSDF(vec3 base, float metallic, float roughness, float ior, vec3 normal, vec3 wo)
+{
+	BSDF bsdf;
+	bsdf.base = base;
+	bsdf.metallic = clamp(metallic, 0.0, 1.0);
+	bsdf.alpha = max(roughness * roughness, MIN_ALPHA);
+	// exporters write Ni 0 for materials without one, below 1 f0 climbs toward a mirror
+	ior = max(ior, 1.0);
+	float r = (ior - 1.0) / (ior + 1.0);
+	bsdf.f0 = mix(vec3(r * r), base, bsdf.metallic);
+	bsdf.normal = normal;
+	orthonormalBasis(normal, bsdf.tangent, bsdf.bitangent);
+
+	// lobes picked by their reflectance toward wo
+	float specular = luminance(fresnelSchlick(bsdf.f0, max(dot(normal, wo), 0.0)));
+	float diffuse = (1.0 - bsdf.metallic) * luminance(base) * (1.0 - specular);
+	bsdf.specular_chance = specular + diffuse > 0.0 ? specular / (specular + diffuse) : 1.0;
+	return bsdf;
+}
+
+vec3 toLocal(BSDF bsdf, vec3 v)
+{
+	return vec3(dot(v, bsdf.tangent), dot(v, bsdf.bitangent), dot(v, bsdf.normal));
+}
+
+vec3 toWorld(BSDF bsdf, vec3 v)
+{
+	return v.x * bsdf.tangent + v.y * bsdf.bitangent + v.z * bsdf.normal;
+}
+
+// normal distribution, h in the local frame
+float ggxD(vec3 h, float alpha)
+{
+	float a2 = alpha * alpha;
+	float t = (h.x * h.x + h.y * h.y) / a2 + h.z * h.z;
+	return 1.0 / (BSDF_PI * a2 * t * t);
+}
+
+// Smith masking term, G1 = 1 / (1 + lambda)
+float ggxLambda(vec3 v, float alpha)
+{
+	float tan2 = (v.x * v.x + v.y * v.y) / max(v.z * v.z, 1e-12);
+	return 0.5 * (sqrt(1.0 + alpha * alpha * tan2) - 1.0);
+}
+
+// microfacet normal visible from v, v in the local frame
+vec3 sampleGGXVNDF(vec3 v, float alpha, float u1, float u2)
+{
+	// stretch to the unit hemisphere configuration
+	vec3 vh = normalize(vec3(alpha * v.x, alpha * v.y, v.z));
+	float len2 = vh.x * vh.x + vh.y * vh.y;
+	vec3 t1 = len2 > 0.0 ? vec3(-vh.y, vh.x, 0.0) * inversesqrt(len2) : vec3(1.0, 0.0, 0.0);
+	vec3 t2 = cross(vh, t1);
+
+	// point on the projected disk, squeezed into the visible half
+	float r = sqrt(u1);
+	float phi = 2.0 * BSDF_PI * u2;
+	float p1 = r * cos(phi);
+	float p2 = r * sin(phi);
+	float s = 0.5 * (1.0 + vh.z);
+	p2 = (1.0 - s) * sqrt(1.0 - p1 * p1) + s * p2;
+
+	vec3 nh = p1 * t1 + p2 * t2 + sqrt(max(0.0, 1.0 - p1 * p1 - p2 * p2)) * vh;
+	return normalize(vec3(alpha * nh.x, alpha * nh.y, max(nh.z, 0.0)));
+}
+
+// BSDF times the cosine toward wi, pdf is the density sampleBSDF() picks wi with
+vec3 evalBSDF(BSDF bsdf, vec3 wo, vec3 wi, out float pdf)
+{
+	pdf = 0.0;
+	vec3 o = toLocal(bsdf, wo);
+	vec3 i = toLocal(bsdf, wi);
+	if (o.z <= 0.0 || i.z <= 0.0)
+		return vec3(0.0);
+
+	vec3 h = normalize(o + i);
+	float d = ggxD(h, bsdf.alpha);
+	float lambda_o = ggxLambda(o, bsdf.alpha);
+	float lambda_i = ggxLambda(i, bsdf.alpha);
+	vec3 f = fresnelSchlick(bsdf.f0, dot(o, h));
+
+	// height correlated masking and shadowing, the cosine cancels the one in the denominator
+	vec3 specular = f * d / (4.0 * o.z * (1.0 + lambda_o + lambda_i));
+	vec3 diffuse = (1.0 - bsdf.metallic) * (1.0 - f) * bsdf.base * (i.z / BSDF_PI);
+
+	float specular_pdf = d / (4.0 * o.z * (1.0 + lambda_o));
+	float diffuse_pdf = i.z / BSDF_PI;
+	pdf = mix(diffuse_pdf, specular_pdf, bsdf.specular_chance);
+	return specular + diffuse;
+}
+
+// picks the direction light is gathered from and returns the BSDF times the cosine over
+// the pdf. specular is true if the glossy lobe was sampled, for the ray cone
+vec3 sampleBSDF(BSDF bsdf, vec3 wo, inout uint seed, out vec3 wi, out float pdf, out bool specular)
+{
+	vec3 o = toLocal(bsdf, wo);
+	if (o.z <= 0.0)
+	{
+		// a normal map can turn the shading normal away from the ray
+		wi = bsdf.normal;
+		pdf = 0.0;
+		specular = false;
+		return vec3(0.0);
+	}
+	float u1 = rand_float(seed);
+	float u2 = rand_float(seed);
+	vec3 i;
+	specular = rand_float(seed) < bsdf.specular_chance;
+	if (specular)
+	{
+		vec3 h = sampleGGXVNDF(o, bsdf.alpha, u1, u2);
+		i = 2.0 * dot(o, h) * h - o;
+	}
+	else
+	{
+		float r = sqrt(u1);
+		float phi = 2.0 * BSDF_PI * u2;
+		i = vec3(r * cos(phi), r * sin(phi), sqrt(max(1.0 - u1, 0.0)));
+	}
+
+	wi = toWorld(bsdf, i);
+	vec3 f = evalBSDF(bsdf, wo, wi, pdf);
+	return pdf > 0.0 ? f / pdf : vec3(0.0);
+}
@@ -0,0 +1,76 @@
+// environment map lookups and importance sampling, include after Sampling.shader. The
+// including shader declares skybox_texture, the alias table is built by EnvironmentMap in
+// Environment.h
+
+// matches EnvironmentEntry in Environment.h
+struct EnvironmentEntry
+{
+	float probability; // chance to keep this pixel instead of taking the alias
+	int alias;
+	float pdf; // chance the pixel is picked
+	float pad;
+};
+
+layout(std430, binding = 14) buffer environmentBuffer
+{
+	int environment_width; // 0 without a map, nothing is sampled
+	int environment_height;
+	int environment_pad0;
+	int environment_pad1;
+	EnvironmentEntry environment_entries[];
+};
+
+#define ENVIRONMENT_PI 3.14159265
+
+vec2 environmentUV(vec3 dir)
+{
+	float u = (atan(dir.y, dir.x) + ENVIRONMENT_PI / 2.0) / (ENVIRONMENT_PI * 2.0);
+	float v = (asin(clamp(dir.z, -1.0, 1.0)) + ENVIRONMENT_PI / 2.0) / ENVIRONMENT_PI;
+	return vec2(fract(u), v);
+}
+
+vec3 environmentDirection(vec2 uv)
+{
+	float phi = uv.x * ENVIRONMENT_PI * 2.0 - ENVIRONMENT_PI / 2.0;
+	float latitude = uv.y * ENVIRONMENT_PI - ENVIRONMENT_PI / 2.0;
+	return vec3(cos(latitude) * cos(phi), cos(latitude) * sin(phi), sin(latitude));
+}
+
+vec3 environmentRadiance(vec3 dir)
+{
+	return textureLod(skybox_texture, environmentUV(dir), 0.0).rgb;
+}
+
+bool environmentSampling()
+{
+	return environment_width > 0;
+}
+
+// solid angle density of sampleEnvironment()
+float environmentPdf(vec3 dir)
+{
+	if (!environmentSampling())
+		return 0.0;
+	vec2 uv = environmentUV(dir);
+	int x = min(int(uv.x * float(environment_width)), environment_width - 1);
+	int y = min(int(uv.y * float(environment_height)), environment_height - 1);
+	float cos_latitude = sqrt(max(1.0 - dir.z * dir.z, 0.0));
+	float pixels = float(environment_width * environment_height);
+	return environment_entries[y * environment_width + x].pdf * pixels / (2.0 * ENVIRONMENT_PI * ENVIRONMENT_PI * max(cos_latitude, 0.000001));
+}
+
+// direction picked in proportion to the radiance, a random pixel is kept or swapped for
+// its alias and the direction is jittered inside it
+vec3 sampleEnvironment(inout uint seed, out float pdf)
+{
+	int count = environment_width * environment_height;
+	int i = min(int(rand_float(seed) * float(count)), count - 1);
+	if (rand_float(seed) >= environment_entries[i].probability)
+		i = environment_entries[i].alias;
+
+	vec2 uv = vec2((float(i % environment_width) + rand_float(seed)) / float(environment_width),
+		(float(i / environment_width) + rand_float(seed)) / float(environment_height));
+	vec3 dir = environmentDirection(uv);
+	pdf = environmentPdf(dir);
+	return dir;
+}
@@ -0,0 +1,123 @@
+// ray intersection tests, the including shader defines a Ray with start, dir and inv
+
+// entries of the traversal stack, can be overridden by the renderer's defines
+#ifndef BVH_STACK_SIZE
+#define BVH_STACK_SIZE 32
+#endif
+
+// Moller-Trumbore, returns the distance and the barycentrics of b and c or 0 on a miss. A
+// parallelogram spans a + u * e1 + v * e2 with u and v up to 1
+vec3 intersectTriangle(Ray ray, vec3 a, vec3 e1, vec3 e2, bool parallelogram)
+{
+	vec3 ray_cross_e2 = cross(ray.dir, e2);
+
+	float det = dot(e1, ray_cross_e2);
+
+	if (det > -0.0000001 && det < 0.0000001)
+		return vec3(0.0);
+
+	float inv_det = 1.0 / det;
+	vec3 s = ray.start - a;
+
+	float u = inv_det * dot(s, ray_cross_e2);
+
+	if (u < 0 || u > 1)
+		return vec3(0.0);
+
+	vec3 s_cross_e1 = cross(s, e1);
+
+	float v = inv_det * dot(ray.dir, s_cross_e1);
+
+	if (v < 0 || (parallelogram ? v > 1 : u + v > 1))
+		return vec3(0.0);
+
+	float t = inv_det * dot(e2, s_cross_e1);
+
+	return t > 0.00001 ? vec3(t, u, v) : vec3(0.0);
+}
+
+// nearest of the two distances in front of the ray, the far one from inside
+float nearestRoot(float t_near, float t_far)
+{
+	if (t_near > 0.00001)
+		return t_near;
+	return t_far > 0.00001 ? t_far : 0.0;
+}
+
+float intersectSphere(Ray ray, vec3 center, float radius)
+{
+	vec3 oc = ray.start - center;
+	float a = dot(ray.dir, ray.dir);
+	float b = dot(oc, ray.dir);
+	float c = dot(oc, oc) - radius * radius;
+	float h = b * b - a * c;
+	if (h < 0.0)
+		return 0.0;
+	h = sqrt(h);
+	return nearestRoot((-b - h) / a, (-b + h) / a);
+}
+
+float intersectBox(Ray ray, vec3 box_min, vec3 box_max)
+{
+	vec3 inv = 1.0 / ray.dir;
+	vec3 t1 = (box_min - ray.start) * inv;
+	vec3 t2 = (box_max - ray.start) * inv;
+	vec3 t_near = min(t1, t2);
+	vec3 t_far = max(t1, t2);
+	float tmin = max(max(t_near.x, t_near.y), t_near.z);
+	float tmax = min(min(t_far.x, t_far.y), t_far.z);
+	if (tmax < tmin)
+		return 0.0;
+	return nearestRoot(tmin, tmax);
+}
+
+// distance along the ray and the primitive's u and v, 0 on a miss. Only triangles and
+// planes have u and v, the other shapes find their surface from the hit position
+vec3 intersect(Ray ray, Primitive prim)
+{
+	vec3 a = vertices[prim.vertex_a];
+	vec3 b = vertices[prim.vertex_b];
+	uint type = primitiveType(prim);
+	if (type == TRIANGLE_PRIMITIVE)
+		return intersectTriangle(ray, a, b - a, vertices[prim.vertex_c] - a, false);
+	if (type == SPHERE_PRIMITIVE)
+		return vec3(intersectSphere(ray, a, length(b - a)), 0.0, 0.0);
+	if (type == PLANE_PRIMITIVE)
+		return intersectTriangle(ray, a, b - a, vertices[prim.vertex_c & PRIMITIVE_INDEX_MASK] - a, true);
+	return vec3(intersectBox(ray, min(a, b), max(a, b)), 0.0, 0.0);
+}
+
+// ray terms of the slab test, inv and start * inv turn each slab into one fma. Zero direction
+// components are nudged so no slab computes 0 * inf
+struct BoxRay
+{
+	vec3 inv;
+	vec3 org_inv;
+};
+
+BoxRay boxRay(Ray ray)
+{
+	vec3 eps = vec3(1e-12);
+	vec3 dir = mix(ray.dir, mix(eps, -eps, lessThan(ray.dir, vec3(0.0))), lessThan(abs(ray.dir), eps));
+	BoxRay box;
+	box.inv = 1.0 / dir;
+	box.org_inv = ray.start * box.inv;
+	return box;
+}
+
+// returned by the box test for boxes that are missed or entered beyond max_dist
+#define BOX_MISS 1e30
+
+// distance the ray enters the box, 0 from inside. Boxes beyond max_dist are missed
+float intersect(BoxRay ray, Node aabb, float max_dist)
+{
+	vec3 t1 = fma(aabb.min, ray.inv, -ray.org_inv);
+	vec3 t2 = fma(aabb.max, ray.inv, -ray.org_inv);
+	vec3 t_near = min(t1, t2);
+	vec3 t_far = max(t1, t2);
+
+	float tmin = max(max(t_near.x, t_near.y), max(t_near.z, 0.0));
+	float tmax = min(min(t_far.x, t_far.y), min(t_far.z, max_dist));
+
+	return tmin <= tmax ? tmin : BOX_MISS;
+}
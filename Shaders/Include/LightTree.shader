@@ -0,0 +1,137 @@
+// light selection through the light tree, include after Scene.shader. The tree is built by
+// LightTree in LightTree.h, its leaf of light i is at num_lights - 1 + i
+
+// matches LightNode in LightTree.h
+struct LightNode
+{
+	vec4 min; // w is the power
+	vec4 max; // w is cos_theta_o
+	vec4 axis; // w is cos_theta_e
+	int children[2]; // -1 in a leaf
+	int parent; // -1 at the root
+	int light; // index into lights in a leaf, -1 in an interior node
+};
+
+layout(std430, binding = 15) buffer lightTreeBuffer
+{
+	LightNode light_nodes[];
+};
+
+float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+}
+
+float sinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+// upper bound of the light a node sends toward pos, normal is the outward surface normal
+float lightImportance(int index, vec3 pos, vec3 normal)
+{
+	LightNode node = light_nodes[index];
+	vec3 center = (node.min.xyz + node.max.xyz) * 0.5;
+	vec3 to_pos = pos - center;
+	float dist2 = dot(to_pos, to_pos);
+	float radius2 = dot(node.max.xyz - center, node.max.xyz - center);
+	float d2 = max(dist2, length(node.max.xyz - node.min.xyz) * 0.5);
+	if (dist2 <= radius2)
+		return node.min.w / d2;
+
+	// angle from the normal cone to pos, less the angle the bounds cover from pos
+	vec3 wi = to_pos / sqrt(dist2);
+	float cos_w = abs(dot(node.axis.xyz, wi));
+	float sin_w = sqrt(max(1.0 - cos_w * cos_w, 0.0));
+	float cos_b = sqrt(max(1.0 - radius2 / dist2, 0.0));
+	float sin_b = sqrt(max(1.0 - cos_b * cos_b, 0.0));
+	float cos_o = node.max.w;
+	float sin_o = sqrt(max(1.0 - cos_o * cos_o, 0.0));
+	float cos_x = cosSubClamped(sin_w, cos_w, sin_o, cos_o);
+	float sin_x = sinSubClamped(sin_w, cos_w, sin_o, cos_o);
+	float cos_p = cosSubClamped(sin_x, cos_x, sin_b, cos_b);
+	if (cos_p <= node.axis.w)
+		return 0.0;
+
+	// lights below the horizon of the surface do not reach it
+	float cos_i = dot(-wi, normal);
+	float sin_i = sqrt(max(1.0 - cos_i * cos_i, 0.0));
+	float cos_pi = cosSubClamped(sin_i, cos_i, sin_b, cos_b);
+	return max(node.min.w * cos_p * cos_pi / d2, 0.0);
+}
+
+// light index picked by walking down the tree with one random number and the chance it
+// was picked, -1 if no light reaches pos
+int sampleLightTree(vec3 pos, vec3 normal, float u, out float pmf)
+{
+	pmf = 0.0;
+	if (num_lights == 0 || lightImportance(0, pos, normal) <= 0.0)
+		return -1;
+	pmf = 1.0;
+	int index = 0;
+	while (light_nodes[index].light < 0)
+	{
+		int first_child = light_nodes[index].children[0];
+		int second_child = light_nodes[index].children[1];
+		float first = lightImportance(first_child, pos, normal);
+		float second = lightImportance(second_child, pos, normal);
+		if (first + second <= 0.0)
+		{
+			pmf = 0.0;
+			return -1;
+		}
+		// the random number is rescaled and reused at the next level
+		float p = first / (first + second);
+		if (u < p)
+		{
+			index = first_child;
+			u = min(u / p, 0.99999994);
+			pmf *= p;
+		}
+		else
+		{
+			index = second_child;
+			u = min((u - p) / (1.0 - p), 0.99999994);
+			pmf *= 1.0 - p;
+		}
+	}
+	return light_nodes[index].light;
+}
+
+// chance sampleLightTree() picks the light at pos
+float lightTreePmf(vec3 pos, vec3 normal, int light)
+{
+	if (light < 0 || lightImportance(0, pos, normal) <= 0.0)
+		return 0.0;
+	float pmf = 1.0;
+	int index = num_lights - 1 + light;
+	while (light_nodes[index].parent >= 0)
+	{
+		int parent = light_nodes[index].parent;
+		float first = lightImportance(light_nodes[parent].children[0], pos, normal);
+		float second = lightImportance(light_nodes[parent].children[1], pos, normal);
+		if (first + second <= 0.0)
+			return 0.0;
+		pmf *= (index == light_nodes[parent].children[0] ? first : second) / (first + second);
+		index = parent;
+	}
+	return pmf;
+}
+
+// index into lights of an emissive primitive, the list is sorted. -1 if it is not a light
+int lightIndex(int prim)
+{
+	int low = 0;
+	int high = num_lights - 1;
+	while (low <= high)
+	{
+		int mid = (low + high) / 2;
+		if (lights[mid] == prim)
+			return mid;
+		if (lights[mid] < prim)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+	return -1;
+}
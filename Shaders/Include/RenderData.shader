@@ -0,0 +1,11 @@
+// per frame camera and image data, written by Renderer::render()
+
+layout(std140, binding = 4) uniform renderData
+{
+	mat4 camera;
+	vec3 camera_pos;
+	int num_nodes;
+	int curr_frame;
+	int sample_offset; // added to the frame in the seeds, processes sharing a render use different ranges
+	ivec2 screen_size; // render resolution, the bottom left of the accumulate texture
+};
@@ -0,0 +1,26 @@
+vec3 reflect(vec3 vec, vec3 normal)
+{
+	vec3 n = normalize(normal);
+	float dot = dot(n, vec);
+	vec3 temp = n * 2 * dot;
+	return vec - temp;
+}
+
+uint pcg_hash(uint x)
+{
+	uint state = x * 747796705u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+float rand_float(inout uint seed)
+{
+	seed = pcg_hash(seed);
+	return float(seed) / float(0xffffffffu);
+}
+
+// power heuristic
+float misWeight(float pdf, float other_pdf)
+{
+	return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
@@ -0,0 +1,88 @@
+// scene data shared by the ray tracing shaders, the layouts match the buffers written by Scene
+
+struct Material
+{
+	float roughness;
+	float metallic;
+	float emission;
+	float ior;
+	vec4 albedo;
+	vec4 specular;
+	vec4 emissive;
+
+	// color_textures slots, see TextureLOD.shader
+	int base_map;
+	int emissive_map;
+	int specular_map;
+
+	// data_textures slots
+	int roughness_map;
+	int metallic_map;
+	int normal_map;
+	int opacity_map;
+	int pad;
+};
+
+struct Primitive
+{
+	uint vertex_a;
+	uint vertex_b;
+	uint vertex_c; // the top bits hold the primitive type
+
+	uint material;
+};
+
+// analytic primitives keep their parameters in the vertices, see PrimitiveType in Scene.h
+#define TRIANGLE_PRIMITIVE 0u
+#define SPHERE_PRIMITIVE 1u // center a, a point on the surface b
+#define PLANE_PRIMITIVE 2u // parallelogram with corner a and edges to b and c
+#define BOX_PRIMITIVE 3u // axis aligned, opposite corners a and b
+#define PRIMITIVE_INDEX_MASK 0x3FFFFFFFu
+
+uint primitiveType(Primitive prim)
+{
+	return prim.vertex_c >> 30;
+}
+
+struct Node
+{
+	int axis;
+	int left;
+	int prim_count;
+	int prim_index;
+	vec3 min;
+	int parent; // -1 for the root
+	vec3 max;
+	int pad;
+};
+
+#include "RenderData.shader"
+
+layout(std430, binding = 0) buffer sceneBuffer
+{
+	vec3 vertices[200000];
+	vec3 normals[200000];
+	vec2 textures[200000];
+	int vertices_size;
+};
+
+layout(std430, binding = 1) buffer materialBuffer
+{
+	Material materials[];
+};
+
+layout(std430, binding = 2) buffer primitiveBuffer
+{
+	Primitive primitives[];
+};
+
+layout(std430, binding = 3) buffer bvhBuffer
+{
+	Node nodes[];
+};
+
+layout(std430, binding = 5) buffer lightBuffer
+{
+	int num_lights;
+	int lights[]; // emissive primitives
+};
@@ -0,0 +1,109 @@
+// shading attributes at a hit, include after Scene.shader. u and v are the ones the
+// intersection returned and pos is the hit position
+
+// face of a box a point is on, as a signed axis
+vec3 boxFace(vec3 pos, vec3 box_min, vec3 box_max)
+{
+	vec3 d = (pos - 0.5 * (box_min + box_max)) / max(0.5 * (box_max - box_min), vec3(1e-8));
+	vec3 a = abs(d);
+	if (a.x >= a.y && a.x >= a.z)
+		return vec3(sign(d.x), 0.0, 0.0);
+	if (a.y >= a.z)
+		return vec3(0.0, sign(d.y), 0.0);
+	return vec3(0.0, 0.0, sign(d.z));
+}
+
+// outward normal like the stored vertex normals, not normalized
+vec3 surfaceNormal(Primitive prim, vec3 pos, float u, float v)
+{
+	uint type = primitiveType(prim);
+	if (type == TRIANGLE_PRIMITIVE)
+		return (1 - u - v) * normals[prim.vertex_a] + (u * normals[prim.vertex_b]) + (v * normals[prim.vertex_c]);
+
+	vec3 a = vertices[prim.vertex_a];
+	vec3 b = vertices[prim.vertex_b];
+	if (type == SPHERE_PRIMITIVE)
+		return pos - a;
+	if (type == PLANE_PRIMITIVE)
+		return cross(b - a, vertices[prim.vertex_c & PRIMITIVE_INDEX_MASK] - a);
+	return boxFace(pos, min(a, b), max(a, b));
+}
+
+// texture coordinate, spheres are mapped by longitude and latitude and each box face
+// covers the whole texture
+vec2 surfaceUV(Primitive prim, vec3 pos, float u, float v)
+{
+	uint type = primitiveType(prim);
+	if (type == TRIANGLE_PRIMITIVE)
+		return (1 - u - v) * textures[prim.vertex_a] + u * textures[prim.vertex_b] + v * textures[prim.vertex_c];
+	if (type == PLANE_PRIMITIVE)
+		return vec2(u, v);
+
+	vec3 a = vertices[prim.vertex_a];
+	vec3 b = vertices[prim.vertex_b];
+	if (type == SPHERE_PRIMITIVE)
+	{
+		vec3 n = normalize(pos - a);
+		return vec2(atan(n.y, n.x) * 0.15915494 + 0.5, acos(clamp(n.z, -1.0, 1.0)) * 0.31830989);
+	}
+
+	vec3 box_min = min(a, b);
+	vec3 box_max = max(a, b);
+	vec3 p = (pos - box_min) / max(box_max - box_min, vec3(1e-8));
+	vec3 face = abs(boxFace(pos, box_min, box_max));
+	return face.x > 0.0 ? p.yz : (face.y > 0.0 ? p.xz : p.xy);
+}
+
+// directions the texture coordinates grow in, along u and v
+void surfaceTangents(Primitive prim, vec3 pos, out vec3 tangent, out vec3 bitangent)
+{
+	uint type = primitiveType(prim);
+	vec3 a = vertices[prim.vertex_a];
+	vec3 b = vertices[prim.vertex_b];
+	if (type == TRIANGLE_PRIMITIVE)
+	{
+		vec3 e1 = b - a;
+		vec3 e2 = vertices[prim.vertex_c] - a;
+		vec2 t1 = textures[prim.vertex_b] - textures[prim.vertex_a];
+		vec2 t2 = textures[prim.vertex_c] - textures[prim.vertex_a];
+		float det = t1.x * t2.y - t2.x * t1.y;
+		tangent = abs(det) > 1e-12 ? (e1 * t2.y - e2 * t1.y) / det : e1;
+		bitangent = abs(det) > 1e-12 ? (e2 * t1.x - e1 * t2.x) / det : e2;
+	}
+	else if (type == PLANE_PRIMITIVE)
+	{
+		tangent = b - a;
+		bitangent = vertices[prim.vertex_c & PRIMITIVE_INDEX_MASK] - a;
+	}
+	else if (type == SPHERE_PRIMITIVE)
+	{
+		// u follows the longitude and v the angle from the +z pole
+		vec3 n = normalize(pos - a);
+		tangent = vec3(-n.y, n.x, 0.0);
+		bitangent = vec3(n.z * n.x, n.z * n.y, -(n.x * n.x + n.y * n.y));
+	}
+	else
+	{
+		vec3 face = abs(boxFace(pos, min(a, b), max(a, b)));
+		tangent = face.x > 0.0 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+		bitangent = face.z > 0.0 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+	}
+}
+
+// outward normal bent by a tangent space normal map texel, +y along v like OpenGL
+vec3 normalMapped(Primitive prim, vec3 pos, vec3 normal, vec3 texel)
+{
+	vec3 tangent;
+	vec3 bitangent;
+	surfaceTangents(prim, pos, tangent, bitangent);
+	tangent -= normal * dot(normal, tangent);
+	if (dot(tangent, tangent) < 1e-12)
+		return normal;
+	tangent = normalize(tangent);
+	// keeps the handedness of the texture coordinates
+	vec3 side = cross(normal, tangent);
+	side *= dot(side, bitangent) < 0.0 ? -1.0 : 1.0;
+
+	vec3 m = texel * 2.0 - 1.0;
+	return normalize(m.x * tangent + m.y * side + m.z * normal);
+}
@@ -0,0 +1,78 @@
+// 0 compiles out texture map lookups for scenes without maps
+#ifndef TEXTURE_MAPS
+#define TEXTURE_MAPS 1
+#endif
+
+// maps are in texture arrays by size class, see Scene::map_classes. A material map holds
+// the class in the top bits and the layer in the low 16
+#define MAP_CLASSES 3
+uniform sampler2DArray color_textures[MAP_CLASSES]; // base, emissive, and specular maps
+uniform sampler2DArray data_textures[MAP_CLASSES]; // roughness, metallic, normal, and opacity maps
+// LOD that reads the base level of any map
+#define BASE_LOD -64.0
+
+// texture LOD from a ray cone (Akenine-Moller et al. 2019), the texture size is added per map
+float triangleLOD(Primitive prim)
+{
+	uint type = primitiveType(prim);
+	if (type != TRIANGLE_PRIMITIVE)
+	{
+		// the texture covers a whole sphere, plane or box face
+		vec3 a = vertices[prim.vertex_a];
+		vec3 b = vertices[prim.vertex_b];
+		float area;
+		if (type == SPHERE_PRIMITIVE)
+			area = 12.566371 * dot(b - a, b - a);
+		else if (type == PLANE_PRIMITIVE)
+			area = length(cross(b - a, vertices[prim.vertex_c & PRIMITIVE_INDEX_MASK] - a));
+		else
+		{
+			vec3 e = abs(b - a);
+			area = (e.x * e.y + e.y * e.z + e.z * e.x) / 3.0;
+		}
+		return area > 0.0 ? -0.5 * log2(area) : 0.0;
+	}
+
+	vec2 t1 = textures[prim.vertex_b] - textures[prim.vertex_a];
+	vec2 t2 = textures[prim.vertex_c] - textures[prim.vertex_a];
+	float t_area = abs(t1.x * t2.y - t2.x * t1.y);
+	float p_area = length(cross(vertices[prim.vertex_b] - vertices[prim.vertex_a], vertices[prim.vertex_c] - vertices[prim.vertex_a]));
+	if (t_area <= 0.0 || p_area <= 0.0)
+		return 0.0;
+	return 0.5 * log2(t_area / p_area);
+}
+
+// LOD of a map with one texel per unit of uv, the size of the map's array is added per lookup
+float coneLOD(float triangle_lod, float cone_width, vec3 normal, vec3 dir)
+{
+	float lod = triangle_lod + log2(max(abs(cone_width), 1e-8));
+	lod -= log2(max(abs(dot(normal, dir)), 0.0001));
+	return lod;
+}
+
+vec4 mapLookup(sampler2DArray tex, int map, vec2 uv, float lod)
+{
+	vec2 size = vec2(textureSize(tex, 0).xy);
+	return textureLod(tex, vec3(uv, map & 0xFFFF), lod + 0.5 * log2(size.x * size.y));
+}
+
+// sampler arrays are only indexed with constants, materials differ between invocations
+vec4 colorMap(int map, vec2 uv, float lod)
+{
+	int size_class = map >> 16;
+	if (size_class == 0)
+		return mapLookup(color_textures[0], map, uv, lod);
+	if (size_class == 1)
+		return mapLookup(color_textures[1], map, uv, lod);
+	return mapLookup(color_textures[2], map, uv, lod);
+}
+
+vec4 dataMap(int map, vec2 uv, float lod)
+{
+	int size_class = map >> 16;
+	if (size_class == 0)
+		return mapLookup(data_textures[0], map, uv, lod);
+	if (size_class == 1)
+		return mapLookup(data_textures[1], map, uv, lod);
+	return mapLookup(data_textures[2], map, uv, lod);
+}
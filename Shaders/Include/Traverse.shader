@@ -0,0 +1,335 @@
+// BVH traversal shared by the ray tracing shaders, include after Intersect.shader
+
+// counting the traversal cost is compiled in by the shaders that need it
+#ifndef TRAVERSAL_STATS
+#define TRAVERSAL_STATS 0
+#endif
+
+#if TRAVERSAL_STATS
+// cost of the rays traced since the shader last reset it, matches TraversalStats in Traversal.h
+struct TraversalStats
+{
+	int nodes; // bounds tested
+	int leaves;
+	int triangles;
+	int max_stack; // deepest the stack got
+};
+
+TraversalStats traversal_stats = TraversalStats(0, 0, 0, 0);
+#endif
+
+// the stackless traversal replaces the stack with the parent links of the nodes
+#ifndef STACKLESS_TRAVERSAL
+#define STACKLESS_TRAVERSAL 0
+#endif
+
+#if STACKLESS_TRAVERSAL
+// Stackless traversal with parent links. The state says how the current node was reached,
+// which is enough to find the next node without remembering the far children. Climbing
+// back up has to find the near child again, so children are ordered by the split axis
+// instead of by entry distance. Nodes beyond the closest hit are still skipped
+#define FROM_PARENT 0
+#define FROM_SIBLING 1
+#define FROM_CHILD 2
+
+// child visited first, the first child is right after its parent and the second is in left
+int nearChild(int index, Node node, vec3 dir, bool ordered)
+{
+	return ordered && dir[node.axis] < 0 ? node.left : index + 1;
+}
+
+// moves past a node that was missed or is a leaf, to its sibling if it was the near child
+void skipNode(inout int current, inout int state, int parent)
+{
+	if (state == FROM_PARENT)
+	{
+		current = current == parent + 1 ? nodes[parent].left : parent + 1;
+		state = FROM_SIBLING;
+	}
+	else
+	{
+		current = parent;
+		state = FROM_CHILD;
+	}
+}
+
+// climbs out of a finished subtree, the far sibling of a near child is still to visit
+void leaveSubtree(inout int current, inout int state, vec3 dir, bool ordered)
+{
+	int parent = nodes[current].parent;
+	Node node = nodes[parent];
+	if (current == nearChild(parent, node, dir, ordered))
+	{
+		current = current == parent + 1 ? node.left : parent + 1;
+		state = FROM_SIBLING;
+	}
+	else
+	{
+		current = parent;
+		state = FROM_CHILD;
+	}
+}
+
+// closest triangle along the ray, prim is -1 and t is 999999.9 on a miss
+bool closestHit(Ray ray, out float t, out float u, out float v, out int prim)
+{
+	t = 999999.9;
+	u = 0.0;
+	v = 0.0;
+	prim = -1;
+
+	// the root has no sibling, reaching its parent (-1) ends the traversal
+	BoxRay box = boxRay(ray);
+	int current = 0;
+	int state = FROM_SIBLING;
+	while (current >= 0)
+	{
+		if (state == FROM_CHILD)
+		{
+			if (current == 0)
+				break;
+			leaveSubtree(current, state, ray.dir, true);
+			continue;
+		}
+
+		Node node = nodes[current];
+#if TRAVERSAL_STATS
+		traversal_stats.nodes++;
+#endif
+		if (intersect(box, node, t) < BOX_MISS)
+		{
+			if (node.prim_index > -1) // leaf
+			{
+#if TRAVERSAL_STATS
+				traversal_stats.leaves++;
+				traversal_stats.triangles += node.prim_count;
+#endif
+				for (int i = 0; i < node.prim_count; ++i)
+				{
+					vec3 intersection = intersect(ray, primitives[node.prim_index + i]);
+					if (intersection.x > 0.0 && intersection.x < t)
+					{
+						t = intersection.x;
+						u = intersection.y;
+						v = intersection.z;
+						prim = node.prim_index + i;
+					}
+				}
+				skipNode(current, state, node.parent);
+			}
+			else // interior
+			{
+				current = nearChild(current, node, ray.dir, true);
+				state = FROM_PARENT;
+			}
+		}
+		else
+		{
+			skipNode(current, state, node.parent);
+		}
+	}
+	return prim >= 0;
+}
+
+// true if anything is hit closer than max_dist, the first hit ends the traversal so the
+// children are not ordered
+bool anyHit(Ray ray, float max_dist)
+{
+	BoxRay box = boxRay(ray);
+	int current = 0;
+	int state = FROM_SIBLING;
+	while (current >= 0)
+	{
+		if (state == FROM_CHILD)
+		{
+			if (current == 0)
+				break;
+			leaveSubtree(current, state, ray.dir, false);
+			continue;
+		}
+
+		Node node = nodes[current];
+#if TRAVERSAL_STATS
+		traversal_stats.nodes++;
+#endif
+		if (intersect(box, node, max_dist) < BOX_MISS)
+		{
+			if (node.prim_index > -1) // leaf
+			{
+#if TRAVERSAL_STATS
+				traversal_stats.leaves++;
+#endif
+				for (int i = 0; i < node.prim_count; ++i)
+				{
+#if TRAVERSAL_STATS
+					traversal_stats.triangles++;
+#endif
+					vec3 intersection = intersect(ray, primitives[node.prim_index + i]);
+					if (intersection.x > 0.0 && intersection.x < max_dist)
+						return true;
+				}
+				skipNode(current, state, node.parent);
+			}
+			else // interior
+			{
+				current = current + 1;
+				state = FROM_PARENT;
+			}
+		}
+		else
+		{
+			skipNode(current, state, node.parent);
+		}
+	}
+	return false;
+}
+#else
+// closest triangle along the ray, prim is -1 and t is 999999.9 on a miss. Both children of
+// a node are tested together and the one the ray enters first is visited first, nodes
+// entered beyond the closest hit so far are skipped
+bool closestHit(Ray ray, out float t, out float u, out float v, out int prim)
+{
+	t = 999999.9;
+	u = 0.0;
+	v = 0.0;
+	prim = -1;
+
+	BoxRay box = boxRay(ray);
+#if TRAVERSAL_STATS
+	traversal_stats.nodes++;
+#endif
+	if (intersect(box, nodes[0], t) == BOX_MISS)
+		return false;
+
+	// far children still to visit and the distance the ray enters them
+	int to_visit_offset = 0;
+	int nodes_to_visit[BVH_STACK_SIZE];
+	float dist_to_visit[BVH_STACK_SIZE];
+	int current_node = 0;
+	while (true)
+	{
+		Node node = nodes[current_node];
+		if (node.prim_index > -1) // leaf
+		{
+#if TRAVERSAL_STATS
+			traversal_stats.leaves++;
+			traversal_stats.triangles += node.prim_count;
+#endif
+			// intersect ray with primitive(s) in leaf node
+			for (int i = 0; i < node.prim_count; ++i)
+			{
+				vec3 intersection = intersect(ray, primitives[node.prim_index + i]);
+				if (intersection.x > 0.0 && intersection.x < t)
+				{
+					t = intersection.x;
+					u = intersection.y;
+					v = intersection.z;
+					prim = node.prim_index + i;
+				}
+			}
+			current_node = -1;
+		}
+		else // interior
+		{
+			int near_node = current_node + 1;
+			int far_node = node.left;
+			float near_dist = intersect(box, nodes[near_node], t);
+			float far_dist = intersect(box, nodes[far_node], t);
+#if TRAVERSAL_STATS
+			traversal_stats.nodes += 2;
+#endif
+			if (far_dist < near_dist)
+			{
+				int swap_node = near_node;
+				near_node = far_node;
+				far_node = swap_node;
+				float swap_dist = near_dist;
+				near_dist = far_dist;
+				far_dist = swap_dist;
+			}
+
+			// advance to near node, put far node on stack
+			current_node = near_dist < BOX_MISS ? near_node : -1;
+			if (far_dist < BOX_MISS)
+			{
+				nodes_to_visit[to_visit_offset] = far_node;
+				dist_to_visit[to_visit_offset++] = far_dist;
+#if TRAVERSAL_STATS
+				traversal_stats.max_stack = max(traversal_stats.max_stack, to_visit_offset);
+#endif
+			}
+		}
+
+		// nodes pushed before a closer hit was found may be behind it now
+		while (current_node < 0 && to_visit_offset > 0)
+		{
+			--to_visit_offset;
+			if (dist_to_visit[to_visit_offset] < t)
+				current_node = nodes_to_visit[to_visit_offset];
+		}
+		if (current_node < 0)
+			break;
+	}
+	return prim >= 0;
+}
+
+// true if anything is hit closer than max_dist, the first hit ends the traversal so the
+// children are not ordered
+bool anyHit(Ray ray, float max_dist)
+{
+	BoxRay box = boxRay(ray);
+#if TRAVERSAL_STATS
+	traversal_stats.nodes++;
+#endif
+	if (intersect(box, nodes[0], max_dist) == BOX_MISS)
+		return false;
+
+	int to_visit_offset = 0;
+	int nodes_to_visit[BVH_STACK_SIZE];
+	int current_node = 0;
+	while (true)
+	{
+		Node node = nodes[current_node];
+		if (node.prim_index > -1) // leaf
+		{
+#if TRAVERSAL_STATS
+			traversal_stats.leaves++;
+#endif
+			for (int i = 0; i < node.prim_count; ++i)
+			{
+#if TRAVERSAL_STATS
+				traversal_stats.triangles++;
+#endif
+				vec3 intersection = intersect(ray, primitives[node.prim_index + i]);
+				if (intersection.x > 0.0 && intersection.x < max_dist)
+					return true;
+			}
+			current_node = -1;
+		}
+		else // interior
+		{
+			bool first = intersect(box, nodes[current_node + 1], max_dist) < BOX_MISS;
+			bool second = intersect(box, nodes[node.left], max_dist) < BOX_MISS;
+#if TRAVERSAL_STATS
+			traversal_stats.nodes += 2;
+#endif
+			if (first && second)
+			{
+				nodes_to_visit[to_visit_offset++] = node.left;
+#if TRAVERSAL_STATS
+				traversal_stats.max_stack = max(traversal_stats.max_stack, to_visit_offset);
+#endif
+			}
+			current_node = first ? current_node + 1 : (second ? node.left : -1);
+		}
+
+		if (current_node < 0)
+		{
+			if (to_visit_offset == 0)
+				break;
+			current_node = nodes_to_visit[--to_visit_offset];
+		}
+	}
+	return false;
+}
+#endif
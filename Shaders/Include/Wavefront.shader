@@ -0,0 +1,86 @@
+// queues and per path state of the wavefront path tracer
+
+// ray state of one path between passes
+struct Path
+{
+	vec4 origin; // w is the cone width
+	vec4 dir; // w is the cone spread
+	vec4 throughput; // w is the pdf of the BSDF sample that made the ray, 0 if no light was sampled
+	uint pixel;
+	uint seed;
+	uint depth;
+	uint normal; // packed outward normal of the vertex the ray left, for the light tree pdf
+};
+
+// octahedral encoding of a unit vector in 32 bits
+uint packNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return packSnorm2x16(e);
+}
+
+vec3 unpackNormal(uint encoded)
+{
+	vec2 e = unpackSnorm2x16(encoded);
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+struct Hit
+{
+	float t;
+	float u;
+	float v;
+	int prim; // -1 on a miss
+};
+
+struct ShadowRay
+{
+	vec4 origin; // w is the distance to the light
+	vec4 dir;
+	vec4 radiance; // added to the pixel if the light is visible
+	uint pixel;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout(std430, binding = 6) buffer pathBuffer
+{
+	Path paths[]; // two queues of max_paths, the current one is selected by queue
+};
+
+layout(std430, binding = 7) buffer hitBuffer
+{
+	Hit hits[];
+};
+
+layout(std430, binding = 8) buffer shadowBuffer
+{
+	ShadowRay shadow_rays[];
+};
+
+layout(std430, binding = 9) buffer radianceBuffer
+{
+	vec4 radiance[]; // radiance of the current frame per pixel
+};
+
+layout(std430, binding = 10) buffer queueBuffer
+{
+	uint path_count[2];
+	uint shadow_count;
+	uint extend_fetch;
+	uint shade_fetch;
+	uint shadow_fetch;
+};
+
+layout(std430, binding = 11) buffer featureBuffer
+{
+	vec4 features[]; // albedo and normal with first hit distance per pixel, for the denoiser
+};
+
+uniform int queue;
+uniform int max_paths;
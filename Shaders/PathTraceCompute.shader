@@ -0,0 +1,243 @@
+#version 430 core
+
+// tile shape of a workgroup and path length, defined by the renderer when it compiles the shader
+#ifndef TILE_X
+#define TILE_X 8
+#endif
+#ifndef TILE_Y
+#define TILE_Y 8
+#endif
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 8
+#endif
+#ifndef RAY_COUNTERS
+#define RAY_COUNTERS 0
+#endif
+
+layout(local_size_x = TILE_X, local_size_y = TILE_Y) in;
+
+// running average of all samples, updated in place
+layout(rgba32f, binding = 0) uniform image2D accumulate_image;
+// denoiser features, averaged the same way
+layout(rgba32f, binding = 1) uniform image2D albedo_image;
+layout(rgba32f, binding = 2) uniform image2D normal_image; // normal and first hit distance, zero on a miss
+
+// first pixel of the dispatch, passes split into bands dispatch one band at a time
+uniform ivec2 tile_offset;
+uniform int band_end; // first row past the band, the last workgroups can reach beyond it
+
+#if RAY_COUNTERS
+// rays traced since the renderer last cleared them, for benchmarks
+layout(std430, binding = 12) buffer rayCounters
+{
+	uint primary_rays;
+	uint secondary_rays;
+};
+#endif
+
+uniform sampler2D skybox_texture;
+const float pi = 3.14189265;
+
+#include "Include/Scene.shader"
+
+struct Ray
+{
+	vec3 start;
+	vec3 dir;
+	vec3 inv;
+	vec3 col;
+	bool terminate;
+	float cone_width;
+	float cone_spread;
+	float pdf; // density of the BSDF sample that made the ray, 0 if the environment was not sampled
+};
+
+#include "Include/Sampling.shader"
+#include "Include/BSDF.shader"
+#include "Include/Intersect.shader"
+#include "Include/Traverse.shader"
+#include "Include/TextureLOD.shader"
+#include "Include/Surface.shader"
+#include "Include/Environment.shader"
+
+// albedo and normal_depth return the features of the hit for the denoiser, zero on a miss.
+// light adds the environment sampled at the hit, sample_light is false on the last bounce
+Ray traceRay(Ray ray, inout uint seed, bool sample_light, inout vec3 light, out vec3 albedo, out vec4 normal_depth)
+{
+	float dist = 999999.9;
+	vec3 col = vec3(0.0);
+	vec3 normal = vec3(0.0, 0.0, 1.0);
+	bool terminate = true;
+	Material mat;
+	// closest hit, then the material at it
+	float u, v;
+	int prim_index;
+	if (closestHit(ray, dist, u, v, prim_index))
+	{
+		Primitive prim = primitives[prim_index];
+		vec3 pos = ray.start + ray.dir * dist;
+		vec2 uv = surfaceUV(prim, pos, u, v);
+		normal = surfaceNormal(prim, pos, u, v);
+		normal = -normalize(normal);
+		// shade the side the ray arrived from
+		if (dot(normal, ray.dir) < 0.0)
+			normal = -normal;
+
+		mat = materials[prim.material];
+		col = mat.albedo.rgb;
+		vec3 emissive = mat.emissive.rgb;
+#if TEXTURE_MAPS
+		// pick texture LOD from the width of the ray cone at the hit
+		float cone_width = ray.cone_width + ray.cone_spread * dist;
+		float triangle_lod = triangleLOD(prim);
+		float lod = coneLOD(triangle_lod, cone_width, normal, ray.dir);
+
+		if (mat.base_map >= 0)
+			col *= colorMap(mat.base_map, uv, lod).xyz; //vec3(0.7, 1.0, 0.2); vec3(1 - intersection.y - intersection.z, intersection.yz);
+		if (mat.emissive_map >= 0)
+			emissive = colorMap(mat.emissive_map, uv, lod).xyz;
+		if (mat.roughness_map >= 0)
+			mat.roughness = dataMap(mat.roughness_map, uv, lod).g;
+		if (mat.metallic_map >= 0)
+			mat.metallic = dataMap(mat.metallic_map, uv, lod).b;
+		if (mat.normal_map >= 0)
+			normal = -normalMapped(prim, pos, -normal, dataMap(mat.normal_map, uv, lod).rgb);
+#endif
+		mat.emission = length(emissive) * mat.emission + 1.0;
+		//col = (0.8 * max(dot(normal, vec3(0.0, 0.0, -1.0)), 0.0) + 0.2) * col;
+		terminate = false;
+	}
+
+	bool hit = dist < 999999.9;
+	albedo = hit ? col : vec3(0.0);
+	normal_depth = hit ? vec4(normal, dist) : vec4(0.0);
+
+	// misses see the environment, weighted against the sample taken at the last hit
+	if (!hit)
+	{
+		col = environmentRadiance(ray.dir);
+		if (ray.pdf > 0.0)
+			col *= misWeight(ray.pdf, environmentPdf(ray.dir));
+	}
+
+	if (hit && mat.emission > 1.0)
+	{
+		terminate = true;
+		col *= mat.emission;
+	}
+
+	// the cone keeps its width at the hit, glossy bounces widen it by the roughness and
+	// diffuse bounces open it to roughly a hemisphere
+	vec3 start = ray.start + ray.dir * dist * 0.999;
+	vec3 dir = ray.dir;
+	float cone_spread = ray.cone_spread;
+	float pdf = 0.0;
+	if (!terminate)
+	{
+		BSDF bsdf = makeBSDF(col, mat.metallic, mat.roughness, mat.ior, -normal, -ray.dir);
+
+		// connect to a direction drawn from the environment, weighted against the BSDF sample
+		if (sample_light && environmentSampling())
+		{
+			float light_pdf;
+			vec3 light_dir = sampleEnvironment(seed, light_pdf);
+			float light_bsdf_pdf;
+			vec3 f = evalBSDF(bsdf, -ray.dir, light_dir, light_bsdf_pdf);
+			Ray shadow;
+			shadow.start = start;
+			shadow.dir = light_dir;
+			shadow.inv = 1.0 / light_dir;
+			if (light_pdf > 0.0 && light_bsdf_pdf > 0.0 && !anyHit(shadow, 999999.9))
+				light += ray.col * f * environmentRadiance(light_dir) * misWeight(light_pdf, light_bsdf_pdf) / light_pdf;
+		}
+
+		bool specular;
+		col = sampleBSDF(bsdf, -ray.dir, seed, dir, pdf, specular);
+		cone_spread += specular ? mat.roughness : 1.0;
+		// a sample under the surface ends the path with nothing gathered
+		terminate = pdf <= 0.0;
+		if (!sample_light || !environmentSampling())
+			pdf = 0.0;
+	}
+	return Ray(start, dir, 1.0 / dir, ray.col * col, terminate, ray.cone_width + ray.cone_spread * dist, cone_spread, pdf);
+}
+
+void main()
+{
+	ivec2 screen_coord = ivec2(gl_GlobalInvocationID.xy) + tile_offset;
+	if (screen_coord.x >= screen_size.x || screen_coord.y >= band_end)
+		return;
+
+	vec2 TexCoord = (vec2(screen_coord) + 0.5) / vec2(screen_size);
+	uint seed = uint(screen_coord.y * screen_size.x + screen_coord.x + (curr_frame + sample_offset) * screen_size.x * screen_size.y);
+	float aspect = float(screen_size.x) / float(screen_size.y);
+
+	vec3 color = vec3(0.0);
+	vec3 albedo = vec3(0.0);
+	vec4 normal_depth = vec4(0.0);
+	uint rays = 0;
+
+	int num_samples = 1;
+	for (uint j = 0; j < num_samples; ++j)
+	{
+		vec4 ray_start = vec4(0.0, 0.0, 0.0, 1.0);
+		vec4 ray_end = vec4((TexCoord.x - 0.5) * aspect + rand_float(seed) / float(screen_size.x), TexCoord.y - 0.5 + rand_float(seed) / float(screen_size.y), -1.0, 1.0);
+
+		vec3 start = (camera * ray_start).xyz;
+		vec3 end = (camera * ray_end).xyz;
+
+		vec3 dir = normalize(end - start);
+		Ray ray;
+		ray.start = start;
+		ray.dir = dir;
+		ray.inv = 1.0 / dir;
+		ray.col = vec3(1.0);
+		ray.terminate = false;
+		// primary cone starts at the eye and spreads by one pixel
+		ray.cone_width = 0.0;
+		ray.cone_spread = 1.0 / float(screen_size.y);
+		ray.pdf = 0.0;
+		vec3 light = vec3(0.0);
+
+		for (uint i = 0; i < MAX_BOUNCES; ++i)
+		{
+			vec3 hit_albedo;
+			vec4 hit_normal_depth;
+			ray = traceRay(ray, seed, i + 1 < MAX_BOUNCES, light, hit_albedo, hit_normal_depth);
+			rays++;
+			// the denoiser's features come from the first hit
+			if (i == 0)
+			{
+				albedo += hit_albedo;
+				normal_depth += hit_normal_depth;
+			}
+			if (ray.terminate)
+				break;
+		}
+
+		if (!ray.terminate)
+			ray.col = vec3(0.0);
+
+		color += ray.col + light;
+	}
+	color /= float(num_samples);
+	albedo /= float(num_samples);
+	normal_depth /= float(num_samples);
+
+#if RAY_COUNTERS
+	atomicAdd(primary_rays, uint(num_samples));
+	atomicAdd(secondary_rays, rays - uint(num_samples));
+#endif
+
+	// each invocation owns its pixel, so the average is updated without a copy. Alpha
+	// counts the samples of the pixel, after reprojection it differs between pixels
+	vec4 accumulated = curr_frame > 1 ? imageLoad(accumulate_image, screen_coord) : vec4(0.0);
+	float samples = accumulated.a + 1.0;
+	float inv_frame = 1.0 / samples;
+	imageStore(accumulate_image, screen_coord, vec4(inv_frame * color + (1.0 - inv_frame) * accumulated.rgb, samples));
+
+	vec3 accumulated_albedo = curr_frame > 1 ? imageLoad(albedo_image, screen_coord).rgb : vec3(0.0);
+	vec4 accumulated_normal = curr_frame > 1 ? imageLoad(normal_image, screen_coord) : vec4(0.0);
+	imageStore(albedo_image, screen_coord, vec4(inv_frame * albedo + (1.0 - inv_frame) * accumulated_albedo, 1.0));
+	imageStore(normal_image, screen_coord, inv_frame * normal_depth + (1.0 - inv_frame) * accumulated_normal);
+}
@@ -8,9 +8,14 @@ uniform sampler2D result_texture;
 
 uniform float exposure;
 
+#include "Include/RenderData.shader"
+
 void main()
 {
-	vec3 result = texture(result_texture, TexCoord).rgb;
+	// bilinear upscale of the rendered region, clamped so it never filters in texels
+	// outside of it
+	vec2 coord = clamp(TexCoord * vec2(screen_size), vec2(0.5), vec2(screen_size) - 0.5);
+	vec3 result = texture(result_texture, coord / vec2(textureSize(result_texture, 0))).rgb;
 	// hdr tone mapping
 	result = vec3(1.0) - exp(-result * exposure);
 	// gamma correction
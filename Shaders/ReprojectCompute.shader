@@ -0,0 +1,140 @@
+#version 430 core
+
+// moves the accumulated image into a new camera view. Every pixel traces its primary ray,
+// projects the hit into the previous view and reuses the samples there where the depth
+// and normal agree. Disoccluded pixels restart with no samples
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba32f, binding = 0) uniform writeonly image2D accumulate_image;
+layout(rgba32f, binding = 1) uniform writeonly image2D albedo_image;
+layout(rgba32f, binding = 2) uniform writeonly image2D normal_image;
+layout(rg32f, binding = 3) uniform writeonly image2D motion_image; // pixels to the previous position
+
+// last frame, sample counts in the alpha of the accumulated color
+uniform sampler2D prev_accumulate;
+uniform sampler2D prev_albedo;
+uniform sampler2D prev_normal;
+
+uniform mat4 prev_view;
+uniform vec3 prev_camera_pos;
+uniform ivec2 prev_size;
+
+uniform float max_history; // reused samples are capped so the image keeps following the view
+uniform float history_scale; // less history when the resolution went up
+uniform float depth_tolerance; // relative
+
+#include "Include/Scene.shader"
+
+struct Ray
+{
+	vec3 start;
+	vec3 dir;
+	vec3 inv;
+};
+
+#include "Include/Intersect.shader"
+#include "Include/Traverse.shader"
+#include "Include/Surface.shader"
+
+// normal and distance of the closest hit, zero on a miss
+vec4 primaryHit(Ray ray)
+{
+	float dist, u, v;
+	int prim_index;
+	if (!closestHit(ray, dist, u, v, prim_index))
+		return vec4(0.0);
+
+	Primitive prim = primitives[prim_index];
+	vec3 normal = -normalize(surfaceNormal(prim, ray.start + ray.dir * dist, u, v));
+	return vec4(normal, dist);
+}
+
+// the previous pixel shows the same surface when its depth and normal match, misses
+// only match misses
+bool sameSurface(ivec2 coord, vec3 position, vec4 new_normal_depth)
+{
+	if (coord.x < 0 || coord.y < 0 || coord.x >= prev_size.x || coord.y >= prev_size.y)
+		return false;
+
+	vec4 normal_depth = texelFetch(prev_normal, coord, 0);
+	if (new_normal_depth.w <= 0.0 || normal_depth.w <= 0.0)
+		return new_normal_depth.w <= 0.0 && normal_depth.w <= 0.0;
+
+	float expected = length(position - prev_camera_pos);
+	return abs(normal_depth.w - expected) <= depth_tolerance * expected && dot(normalize(normal_depth.xyz), new_normal_depth.xyz) > 0.9;
+}
+
+void main()
+{
+	ivec2 screen_coord = ivec2(gl_GlobalInvocationID.xy);
+	if (screen_coord.x >= screen_size.x || screen_coord.y >= screen_size.y)
+		return;
+
+	// primary ray through the pixel center
+	vec2 TexCoord = (vec2(screen_coord) + 0.5) / vec2(screen_size);
+	float aspect = float(screen_size.x) / float(screen_size.y);
+	vec3 start = (camera * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+	vec3 end = (camera * vec4((TexCoord.x - 0.5) * aspect, TexCoord.y - 0.5, -1.0, 1.0)).xyz;
+
+	Ray ray;
+	ray.start = start;
+	ray.dir = normalize(end - start);
+	ray.inv = 1.0 / ray.dir;
+
+	vec4 normal_depth = primaryHit(ray);
+
+	vec4 color = vec4(0.0);
+	vec3 albedo = vec3(0.0);
+	vec2 motion = vec2(0.0);
+
+	// misses see the environment at infinity, only their direction moves
+	vec3 position = ray.start + ray.dir * normal_depth.w;
+	vec3 view_pos = normal_depth.w > 0.0 ? (prev_view * vec4(position, 1.0)).xyz : mat3(prev_view) * ray.dir;
+
+	// the previous camera looks down -z with the image plane at distance 1
+	if (view_pos.z < 0.0)
+	{
+		float prev_aspect = float(prev_size.x) / float(prev_size.y);
+		vec2 prev_uv = vec2(view_pos.x / (-view_pos.z * prev_aspect), view_pos.y / -view_pos.z) + 0.5;
+		vec2 prev_pixel = prev_uv * vec2(prev_size);
+		motion = prev_pixel - (vec2(screen_coord) + 0.5);
+
+		// bilinear taps, each one only counts if it saw the same surface
+		vec2 pos = prev_pixel - 0.5;
+		ivec2 base = ivec2(floor(pos));
+		vec2 f = pos - floor(pos);
+		float weights[4] = float[](
+			(1.0 - f.x) * (1.0 - f.y),
+			f.x * (1.0 - f.y),
+			(1.0 - f.x) * f.y,
+			f.x * f.y);
+
+		float weight_sum = 0.0;
+		vec4 color_sum = vec4(0.0);
+		vec3 albedo_sum = vec3(0.0);
+		for (int i = 0; i < 4; ++i)
+		{
+			ivec2 coord = base + ivec2(i & 1, i >> 1);
+			if (!sameSurface(coord, position, normal_depth))
+				continue;
+
+			color_sum += texelFetch(prev_accumulate, coord, 0) * weights[i];
+			albedo_sum += texelFetch(prev_albedo, coord, 0).rgb * weights[i];
+			weight_sum += weights[i];
+		}
+
+		if (weight_sum > 0.01)
+		{
+			color = color_sum / weight_sum;
+			albedo = albedo_sum / weight_sum;
+			color.a = min(color.a * history_scale, max_history);
+		}
+	}
+
+	// depth is the new view's, the next samples average into it
+	imageStore(accumulate_image, screen_coord, color);
+	imageStore(albedo_image, screen_coord, vec4(albedo, 1.0));
+	imageStore(normal_image, screen_coord, normal_depth);
+	imageStore(motion_image, screen_coord, vec4(motion, 0.0, 0.0));
+}
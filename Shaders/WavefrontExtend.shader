@@ -0,0 +1,42 @@
+#version 430 core
+
+// finds the closest hit of every path in the current queue
+
+layout(local_size_x = 64) in;
+
+#include "Include/Scene.shader"
+#include "Include/Wavefront.shader"
+
+struct Ray
+{
+	vec3 start;
+	vec3 dir;
+	vec3 inv;
+};
+
+#include "Include/Intersect.shader"
+#include "Include/Traverse.shader"
+
+void extend(uint index)
+{
+	Path path = paths[queue * max_paths + index];
+
+	Ray ray;
+	ray.start = path.origin.xyz;
+	ray.dir = path.dir.xyz;
+	ray.inv = 1.0 / ray.dir;
+
+	Hit hit;
+	closestHit(ray, hit.t, hit.u, hit.v, hit.prim);
+
+	hits[index] = hit;
+}
+
+// persistent threads, every invocation fetches work until the queue is empty. Fetching
+// per invocation keeps barrier() out of the loop
+void main()
+{
+	uint count = path_count[queue];
+	for (uint index = atomicAdd(extend_fetch, 1); index < count; index = atomicAdd(extend_fetch, 1))
+		extend(index);
+}
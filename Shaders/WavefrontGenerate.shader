@@ -0,0 +1,43 @@
+#version 430 core
+
+// first pass of the wavefront path tracer, writes one camera ray per pixel into queue 0
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#include "Include/RenderData.shader"
+#include "Include/Wavefront.shader"
+
+#include "Include/Sampling.shader"
+
+void main()
+{
+	ivec2 screen_coord = ivec2(gl_GlobalInvocationID.xy);
+	if (screen_coord.x >= screen_size.x || screen_coord.y >= screen_size.y)
+		return;
+
+	uint pixel = uint(screen_coord.y * screen_size.x + screen_coord.x);
+	vec2 TexCoord = (vec2(screen_coord) + 0.5) / vec2(screen_size);
+	uint seed = pixel + uint((curr_frame + sample_offset) * screen_size.x * screen_size.y);
+	float aspect = float(screen_size.x) / float(screen_size.y);
+
+	vec4 ray_start = vec4(0.0, 0.0, 0.0, 1.0);
+	vec4 ray_end = vec4((TexCoord.x - 0.5) * aspect + rand_float(seed) / float(screen_size.x), TexCoord.y - 0.5 + rand_float(seed) / float(screen_size.y), -1.0, 1.0);
+
+	vec3 start = (camera * ray_start).xyz;
+	vec3 end = (camera * ray_end).xyz;
+
+	Path path;
+	// primary cone starts at the eye and spreads by one pixel
+	path.origin = vec4(start, 0.0);
+	path.dir = vec4(normalize(end - start), 1.0 / float(screen_size.y));
+	path.throughput = vec4(1.0, 1.0, 1.0, 0.0);
+	path.pixel = pixel;
+	path.seed = seed;
+	path.depth = 0;
+	paths[pixel] = path;
+
+	radiance[pixel] = vec4(0.0);
+	// stays zero on a miss
+	features[pixel * 2] = vec4(0.0);
+	features[pixel * 2 + 1] = vec4(0.0);
+}
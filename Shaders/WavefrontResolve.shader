@@ -0,0 +1,33 @@
+#version 430 core
+
+// adds the frame's radiance to the running average in the accumulate texture
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba32f, binding = 0) uniform image2D accumulate_image;
+layout(rgba32f, binding = 1) uniform image2D albedo_image;
+layout(rgba32f, binding = 2) uniform image2D normal_image;
+
+#include "Include/RenderData.shader"
+#include "Include/Wavefront.shader"
+
+void main()
+{
+	ivec2 screen_coord = ivec2(gl_GlobalInvocationID.xy);
+	if (screen_coord.x >= screen_size.x || screen_coord.y >= screen_size.y)
+		return;
+
+	vec3 color = radiance[screen_coord.y * screen_size.x + screen_coord.x].rgb;
+
+	// alpha counts the samples of the pixel
+	vec4 accumulated = curr_frame > 1 ? imageLoad(accumulate_image, screen_coord) : vec4(0.0);
+	float samples = accumulated.a + 1.0;
+	float inv_frame = 1.0 / samples;
+	imageStore(accumulate_image, screen_coord, vec4(inv_frame * color + (1.0 - inv_frame) * accumulated.rgb, samples));
+
+	int pixel = screen_coord.y * screen_size.x + screen_coord.x;
+	vec3 accumulated_albedo = curr_frame > 1 ? imageLoad(albedo_image, screen_coord).rgb : vec3(0.0);
+	vec4 accumulated_normal = curr_frame > 1 ? imageLoad(normal_image, screen_coord) : vec4(0.0);
+	imageStore(albedo_image, screen_coord, vec4(inv_frame * features[pixel * 2].rgb + (1.0 - inv_frame) * accumulated_albedo, 1.0));
+	imageStore(normal_image, screen_coord, inv_frame * features[pixel * 2 + 1] + (1.0 - inv_frame) * accumulated_normal);
+}
@@ -0,0 +1,229 @@
+#version 430 core
+
+// shades the hits of the current queue. Light hits add to the pixel, other paths
+// bounce into the next queue and queue a shadow ray to a light or the environment
+
+layout(local_size_x = 64) in;
+
+uniform sampler2D skybox_texture;
+uniform int max_depth;
+
+#include "Include/Scene.shader"
+#include "Include/Wavefront.shader"
+
+#include "Include/Sampling.shader"
+#include "Include/BSDF.shader"
+#include "Include/TextureLOD.shader"
+#include "Include/Surface.shader"
+#include "Include/Environment.shader"
+#include "Include/LightTree.shader"
+
+float triangleArea(Primitive prim)
+{
+	return 0.5 * length(cross(vertices[prim.vertex_b] - vertices[prim.vertex_a], vertices[prim.vertex_c] - vertices[prim.vertex_a]));
+}
+
+// chance a light sample is drawn from the environment instead of the emissive triangles
+float environmentSelect()
+{
+	if (!environmentSampling())
+		return 0.0;
+	return num_lights > 0 ? 0.5 : 1.0;
+}
+
+// material at a surface point with its maps applied, emission > 1 marks a light
+Material surfaceMaterial(Primitive prim, vec2 uv, float lod, out vec3 col)
+{
+	Material mat = materials[prim.material];
+	col = mat.albedo.rgb;
+	vec3 emissive = mat.emissive.rgb;
+#if TEXTURE_MAPS
+	if (mat.base_map >= 0)
+		col *= colorMap(mat.base_map, uv, lod).xyz;
+	if (mat.emissive_map >= 0)
+		emissive = colorMap(mat.emissive_map, uv, lod).xyz;
+	if (mat.roughness_map >= 0)
+		mat.roughness = dataMap(mat.roughness_map, uv, lod).g;
+	if (mat.metallic_map >= 0)
+		mat.metallic = dataMap(mat.metallic_map, uv, lod).b;
+#endif
+	mat.emission = length(emissive) * mat.emission + 1.0;
+	return mat;
+}
+
+void shade(uint index)
+{
+	Path path = paths[queue * max_paths + index];
+	Hit hit = hits[index];
+
+	// misses see the environment, weighted against the light sample taken at the previous vertex
+	if (hit.prim < 0)
+	{
+		float weight = 1.0;
+		if (path.throughput.w > 0.0)
+			weight = misWeight(path.throughput.w, environmentSelect() * environmentPdf(path.dir.xyz));
+		radiance[path.pixel] += vec4(path.throughput.rgb * environmentRadiance(path.dir.xyz) * weight, 0.0);
+		return;
+	}
+
+	vec3 dir = path.dir.xyz;
+	float dist = hit.t;
+	float u = hit.u;
+	float v = hit.v;
+	Primitive prim = primitives[hit.prim];
+	uint seed = path.seed;
+
+	vec3 pos = path.origin.xyz + dir * dist;
+	vec2 uv = surfaceUV(prim, pos, u, v);
+	vec3 normal = -normalize(surfaceNormal(prim, pos, u, v));
+	// shade the side the ray arrived from
+	if (dot(normal, dir) < 0.0)
+		normal = -normal;
+
+	// pick texture LOD from the width of the ray cone at the hit
+	float cone_width = path.origin.w + path.dir.w * dist;
+#if TEXTURE_MAPS
+	float triangle_lod = triangleLOD(prim);
+	float lod = coneLOD(triangle_lod, cone_width, normal, dir);
+#else
+	float lod = 0.0;
+#endif
+
+	vec3 col;
+	Material mat = surfaceMaterial(prim, uv, lod, col);
+#if TEXTURE_MAPS
+	if (mat.normal_map >= 0)
+		normal = -normalMapped(prim, pos, -normal, dataMap(mat.normal_map, uv, lod).rgb);
+#endif
+
+	if (path.depth == 0)
+	{
+		features[path.pixel * 2] = vec4(col, 0.0);
+		features[path.pixel * 2 + 1] = vec4(normal, dist);
+	}
+
+	if (mat.emission > 1.0)
+	{
+		// light hit, weighted against the light sample taken at the previous vertex. Only
+		// triangles are in the light list
+		float weight = 1.0;
+		if (path.throughput.w > 0.0 && primitiveType(prim) == TRIANGLE_PRIMITIVE)
+		{
+			vec3 light_normal = normalize(cross(vertices[prim.vertex_b] - vertices[prim.vertex_a], vertices[prim.vertex_c] - vertices[prim.vertex_a]));
+			float cos_light = max(abs(dot(light_normal, dir)), 0.0001);
+			float light_pmf = lightTreePmf(path.origin.xyz, unpackNormal(path.normal), lightIndex(hit.prim));
+			float light_pdf = (1.0 - environmentSelect()) * light_pmf * dist * dist / (cos_light * triangleArea(prim));
+			weight = misWeight(path.throughput.w, light_pdf);
+		}
+		radiance[path.pixel] += vec4(path.throughput.rgb * col * mat.emission * weight, 0.0);
+		return;
+	}
+
+	if (path.depth + 1 >= max_depth)
+		return;
+
+	vec3 start = path.origin.xyz + dir * dist * 0.999;
+	BSDF bsdf = makeBSDF(col, mat.metallic, mat.roughness, mat.ior, -normal, -dir);
+	// the light tree sees the normal the next vertex will read back from the path
+	uint packed_normal = packNormal(-normal);
+
+	// connect to a point on a light picked by the light tree or to a direction drawn from
+	// the environment, weighted against the BSDF sample
+	float environment_select = environmentSelect();
+	bool sample_light = (num_lights > 0 || environment_select > 0.0) && path.depth + 2 < max_depth;
+	if (sample_light)
+	{
+		if (rand_float(seed) < environment_select)
+		{
+			float light_pdf;
+			vec3 light_dir = sampleEnvironment(seed, light_pdf);
+			light_pdf *= environment_select;
+			float light_bsdf_pdf;
+			vec3 f = evalBSDF(bsdf, -dir, light_dir, light_bsdf_pdf);
+			if (light_pdf > 0.0 && light_bsdf_pdf > 0.0)
+			{
+				float weight = misWeight(light_pdf, light_bsdf_pdf);
+
+				ShadowRay shadow;
+				shadow.origin = vec4(start, 999999.9);
+				shadow.dir = vec4(light_dir, 0.0);
+				shadow.radiance = vec4(path.throughput.rgb * f * environmentRadiance(light_dir) * weight / light_pdf, 0.0);
+				shadow.pixel = path.pixel;
+				shadow_rays[atomicAdd(shadow_count, 1)] = shadow;
+			}
+		}
+		else
+		{
+			float light_pmf;
+			int light_slot = sampleLightTree(start, unpackNormal(packed_normal), rand_float(seed), light_pmf);
+			int light_index = lights[max(light_slot, 0)];
+			Primitive light = primitives[light_index];
+			float r1 = sqrt(rand_float(seed));
+			float r2 = rand_float(seed);
+			float lu = r1 * (1.0 - r2);
+			float lv = r1 * r2;
+			vec3 light_pos = (1 - lu - lv) * vertices[light.vertex_a] + lu * vertices[light.vertex_b] + lv * vertices[light.vertex_c];
+
+			vec3 to_light = light_pos - start;
+			float light_dist = length(to_light);
+			vec3 light_dir = to_light / max(light_dist, 0.000001);
+			vec3 light_normal = normalize(cross(vertices[light.vertex_b] - vertices[light.vertex_a], vertices[light.vertex_c] - vertices[light.vertex_a]));
+			float cos_light = abs(dot(light_normal, light_dir));
+			float light_bsdf_pdf;
+			vec3 f = evalBSDF(bsdf, -dir, light_dir, light_bsdf_pdf);
+
+			if (light_slot >= 0 && light_bsdf_pdf > 0.0 && cos_light > 0.0001 && light_dist > 0.0001)
+			{
+				vec2 light_uv = (1 - lu - lv) * textures[light.vertex_a] + lu * textures[light.vertex_b] + lv * textures[light.vertex_c];
+				vec3 light_col;
+				Material light_mat = surfaceMaterial(light, light_uv, BASE_LOD, light_col);
+				if (light_mat.emission > 1.0)
+				{
+					float light_pdf = (1.0 - environment_select) * light_pmf * light_dist * light_dist / (cos_light * triangleArea(light));
+					float weight = misWeight(light_pdf, light_bsdf_pdf);
+
+					ShadowRay shadow;
+					shadow.origin = vec4(start, light_dist * 0.999);
+					shadow.dir = vec4(light_dir, 0.0);
+					shadow.radiance = vec4(path.throughput.rgb * f * light_col * light_mat.emission * weight / light_pdf, 0.0);
+					shadow.pixel = path.pixel;
+					shadow_rays[atomicAdd(shadow_count, 1)] = shadow;
+				}
+			}
+		}
+	}
+
+	vec3 next_dir;
+	float bsdf_pdf;
+	bool specular;
+	vec3 throughput = path.throughput.rgb * sampleBSDF(bsdf, -dir, seed, next_dir, bsdf_pdf, specular);
+	// a sample under the surface ends the path
+	if (bsdf_pdf <= 0.0)
+		return;
+	// the cone keeps its width at the hit, glossy bounces widen it by the roughness and
+	// diffuse bounces open it to roughly a hemisphere
+	float cone_spread = path.dir.w + (specular ? mat.roughness : 1.0);
+	// hits of the next ray are weighted against the light sample only if one was taken
+	if (!sample_light)
+		bsdf_pdf = 0.0;
+
+	// compact surviving paths into the next queue
+	Path next;
+	next.origin = vec4(start, cone_width);
+	next.dir = vec4(next_dir, cone_spread);
+	next.throughput = vec4(throughput, bsdf_pdf);
+	next.pixel = path.pixel;
+	next.seed = seed;
+	next.depth = path.depth + 1;
+	next.normal = packed_normal;
+	paths[(1 - queue) * max_paths + atomicAdd(path_count[1 - queue], 1)] = next;
+}
+
+// persistent threads, every invocation fetches work until the queue is empty. Fetching
+// per invocation keeps barrier() out of the loop
+void main()
+{
+	uint count = path_count[queue];
+	for (uint index = atomicAdd(shade_fetch, 1); index < count; index = atomicAdd(shade_fetch, 1))
+		shade(index);
+}
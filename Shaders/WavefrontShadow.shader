@@ -0,0 +1,40 @@
+#version 430 core
+
+// traces the shadow rays queued by the shade pass and adds the light of visible ones
+
+layout(local_size_x = 64) in;
+
+#include "Include/Scene.shader"
+#include "Include/Wavefront.shader"
+
+struct Ray
+{
+	vec3 start;
+	vec3 dir;
+	vec3 inv;
+};
+
+#include "Include/Intersect.shader"
+#include "Include/Traverse.shader"
+
+void connect(uint index)
+{
+	ShadowRay shadow = shadow_rays[index];
+
+	Ray ray;
+	ray.start = shadow.origin.xyz;
+	ray.dir = shadow.dir.xyz;
+	ray.inv = 1.0 / ray.dir;
+
+	if (!anyHit(ray, shadow.origin.w))
+		radiance[shadow.pixel] += shadow.radiance;
+}
+
+// persistent threads, every invocation fetches work until the queue is empty. Fetching
+// per invocation keeps barrier() out of the loop
+void main()
+{
+	uint count = shadow_count;
+	for (uint index = atomicAdd(shadow_fetch, 1); index < count; index = atomicAdd(shadow_fetch, 1))
+		connect(index);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET socket_handle;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int socket_handle;
+#define INVALID_SOCKET -1
+#endif
+
+// blocking TCP socket, just enough for the distributed render protocol
+class Socket
+{
+	socket_handle handle;
+
+	// broken connections return an error instead of raising SIGPIPE
+	static int sendFlags()
+	{
+#ifdef MSG_NOSIGNAL
+		return MSG_NOSIGNAL;
+#else
+		return 0;
+#endif
+	}
+
+public:
+	// winsock has to be started once per process
+	static bool startup()
+	{
+#ifdef _WIN32
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+		return true;
+#endif
+	}
+
+	Socket() : handle(INVALID_SOCKET)
+	{
+
+	}
+
+	explicit Socket(socket_handle handle) : handle(handle)
+	{
+
+	}
+
+	~Socket()
+	{
+		close();
+	}
+
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+
+	bool valid() const
+	{
+		return handle != INVALID_SOCKET;
+	}
+
+	void close()
+	{
+		if (valid())
+		{
+#ifdef _WIN32
+			closesocket(handle);
+#else
+			::close(handle);
+#endif
+		}
+		handle = INVALID_SOCKET;
+	}
+
+	bool connect(const std::string& host, int port)
+	{
+		close();
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* addresses = NULL;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+			return false;
+
+		for (addrinfo* address = addresses; address; address = address->ai_next)
+		{
+			handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (!valid())
+				continue;
+			if (::connect(handle, address->ai_addr, (int)address->ai_addrlen) == 0)
+				break;
+			close();
+		}
+		freeaddrinfo(addresses);
+
+		if (valid())
+		{
+			// results are sent in one go, no need to wait for more data
+			int no_delay = 1;
+			setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+		}
+		return valid();
+	}
+
+	// listens on every interface
+	bool listen(int port)
+	{
+		close();
+		handle = socket(AF_INET, SOCK_STREAM, 0);
+		if (!valid())
+			return false;
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons((unsigned short)port);
+		if (bind(handle, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(handle, 16) != 0)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// waits up to timeout_ms for a connection, NULL if none came
+	Socket* accept(int timeout_ms)
+	{
+		fd_set set;
+		FD_ZERO(&set);
+		FD_SET(handle, &set);
+		timeval timeout;
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_usec = (timeout_ms % 1000) * 1000;
+		if (select((int)handle + 1, &set, NULL, NULL, &timeout) <= 0)
+			return NULL;
+
+		socket_handle client = ::accept(handle, NULL, NULL);
+		if (client == INVALID_SOCKET)
+			return NULL;
+		return new Socket(client);
+	}
+
+	// sends and receives fail once a transfer stalls for this long, 0 waits forever
+	void setTimeout(int seconds)
+	{
+#ifdef _WIN32
+		DWORD timeout = seconds * 1000;
+#else
+		timeval timeout;
+		timeout.tv_sec = seconds;
+		timeout.tv_usec = 0;
+#endif
+		setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+		setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+	}
+
+	bool sendAll(const void* data, size_t length)
+	{
+		const char* bytes = (const char*)data;
+		while (length > 0)
+		{
+			int sent = send(handle, bytes, (int)(length < 1 << 30 ? length : 1 << 30), sendFlags());
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			length -= sent;
+		}
+		return true;
+	}
+
+	bool recvAll(void* data, size_t length)
+	{
+		char* bytes = (char*)data;
+		while (length > 0)
+		{
+			int received = recv(handle, bytes, (int)(length < 1 << 30 ? length : 1 << 30), 0);
+			if (received <= 0)
+				return false;
+			bytes += received;
+			length -= received;
+		}
+		return true;
+	}
+};
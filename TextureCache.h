@@ -0,0 +1,345 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#include <glm/glm.hpp>
+
+#include "stb_image.h"
+
+#include "Debug.h"
+
+// RGB8 texture with its full mip chain, level 0 is the source image
+struct MipChain
+{
+	int width = 0;
+	int height = 0;
+	bool srgb = true;
+	std::vector<std::vector<unsigned char>> levels;
+
+	int levelWidth(int level) const
+	{
+		return glm::max(1, width >> level);
+	}
+	int levelHeight(int level) const
+	{
+		return glm::max(1, height >> level);
+	}
+};
+
+// header of the binary mip cache written next to the source image
+struct MipCacheHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned long long source_size;
+	long long source_time;
+	int width;
+	int height;
+	int num_levels;
+	int num_components;
+	int srgb;
+	int flipped; // rows stored bottom first like OpenGL expects
+};
+
+// Builds mip chains for textures and caches them in a binary file next to the source
+// (<filename>.mip, or <filename>.lin.mip for linear data maps) so later runs skip decoding
+// and filtering. The cache is invalidated when the source file's size or modification
+// time changes. Color maps are filtered in linear space since they are uploaded as sRGB.
+class TextureCache
+{
+	static const unsigned int cache_version = 3;
+
+	static unsigned char linearToSrgb(float v)
+	{
+		v = glm::clamp(v, 0.0f, 1.0f);
+		float s = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+		return (unsigned char)(s * 255.0f + 0.5f);
+	}
+
+	static std::string cacheName(const std::string& filename, bool srgb)
+	{
+		return filename + (srgb ? ".mip" : ".lin.mip");
+	}
+
+	static float decode(unsigned char c, bool srgb)
+	{
+		return srgb ? srgbToLinear(c) : c / 255.0f;
+	}
+
+	static unsigned char encode(float v, bool srgb)
+	{
+		return srgb ? linearToSrgb(v) : (unsigned char)(glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+
+	static bool sourceInfo(const std::string& filename, unsigned long long* size, long long* time)
+	{
+		std::error_code ec;
+		*size = std::filesystem::file_size(filename, ec);
+		if (ec)
+			return false;
+		*time = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+		return !ec;
+	}
+
+	static bool readCache(const std::string& filename, bool srgb, MipChain& chain)
+	{
+		unsigned long long size;
+		long long time;
+		if (!sourceInfo(filename, &size, &time))
+			return false;
+
+		std::ifstream file(cacheName(filename, srgb), std::ios::binary);
+		if (!file)
+			return false;
+
+		MipCacheHeader header;
+		file.read((char*)&header, sizeof(header));
+		if (!file || std::string(header.magic, 4) != "RTMP" || header.version != cache_version ||
+			header.source_size != size || header.source_time != time || header.num_components != 3 || header.srgb != (int)srgb || header.flipped != 1)
+			return false;
+
+		chain.srgb = srgb;
+		chain.width = header.width;
+		chain.height = header.height;
+		chain.levels.resize(header.num_levels);
+		for (int i = 0; i < header.num_levels; ++i)
+		{
+			chain.levels[i].resize(chain.levelWidth(i) * chain.levelHeight(i) * 3);
+			file.read((char*)chain.levels[i].data(), chain.levels[i].size());
+		}
+		return (bool)file;
+	}
+
+	static void writeCache(const std::string& filename, MipChain& chain)
+	{
+		MipCacheHeader header;
+		memcpy(header.magic, "RTMP", 4);
+		header.version = cache_version;
+		if (!sourceInfo(filename, &header.source_size, &header.source_time))
+			return;
+		header.width = chain.width;
+		header.height = chain.height;
+		header.num_levels = chain.levels.size();
+		header.num_components = 3;
+		header.srgb = chain.srgb;
+		header.flipped = 1;
+
+		std::ofstream file(cacheName(filename, chain.srgb), std::ios::binary);
+		if (!file)
+		{
+			dlogln("could not write texture cache: " << cacheName(filename, chain.srgb));
+			return;
+		}
+		file.write((char*)&header, sizeof(header));
+		for (unsigned int i = 0; i < chain.levels.size(); ++i)
+			file.write((char*)chain.levels[i].data(), chain.levels[i].size());
+	}
+
+public:
+	static float srgbToLinear(unsigned char c)
+	{
+		// static initialization is thread safe, worker threads share the table
+		static const std::array<float, 256> table = []() {
+			std::array<float, 256> t;
+			for (int i = 0; i < 256; ++i)
+			{
+				float v = i / 255.0f;
+				t[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+			}
+			return t;
+		}();
+		return table[c];
+	}
+
+	// generates every level below the base with a 2x2 box filter
+	static void generateMips(MipChain& chain)
+	{
+		chain.levels.resize(1);
+		int level = 0;
+		while (chain.levelWidth(level) > 1 || chain.levelHeight(level) > 1)
+		{
+			int src_width = chain.levelWidth(level);
+			int src_height = chain.levelHeight(level);
+			int dst_width = chain.levelWidth(level + 1);
+			int dst_height = chain.levelHeight(level + 1);
+
+			std::vector<unsigned char> dst(dst_width * dst_height * 3);
+			std::vector<unsigned char>& src = chain.levels[level];
+			for (int y = 0; y < dst_height; ++y)
+			{
+				int y0 = glm::min(y * 2, src_height - 1);
+				int y1 = glm::min(y * 2 + 1, src_height - 1);
+				for (int x = 0; x < dst_width; ++x)
+				{
+					int x0 = glm::min(x * 2, src_width - 1);
+					int x1 = glm::min(x * 2 + 1, src_width - 1);
+					for (int c = 0; c < 3; ++c)
+					{
+						float sum = decode(src[(y0 * src_width + x0) * 3 + c], chain.srgb) +
+									decode(src[(y0 * src_width + x1) * 3 + c], chain.srgb) +
+									decode(src[(y1 * src_width + x0) * 3 + c], chain.srgb) +
+									decode(src[(y1 * src_width + x1) * 3 + c], chain.srgb);
+						dst[(y * dst_width + x) * 3 + c] = encode(sum * 0.25f, chain.srgb);
+					}
+				}
+			}
+			chain.levels.push_back(std::move(dst));
+			level++;
+		}
+	}
+
+	// loads a mip chain from the cache, or decodes the source and rebuilds the cache.
+	// Sources are decoded bottom row first, so the stb_image flip flag has to be set. Safe to
+	// call from worker threads as long as the flag is not changed.
+	static bool load(const std::string& filename, MipChain& chain, bool srgb = true)
+	{
+		if (readCache(filename, srgb, chain))
+			return true;
+
+		int width, height, num_components;
+		unsigned char* data = stbi_load(filename.c_str(), &width, &height, &num_components, 3);
+		if (!data)
+			return false;
+
+		chain.srgb = srgb;
+		chain.width = width;
+		chain.height = height;
+		chain.levels.clear();
+		chain.levels.emplace_back(data, data + width * height * 3);
+		stbi_image_free(data);
+
+		generateMips(chain);
+		writeCache(filename, chain);
+		return true;
+	}
+
+	// builds the cache for a texture ahead of time, srgb for color maps and linear for the
+	// data maps (roughness, metallic, normal)
+	static bool bake(const std::string& filename, bool srgb = true)
+	{
+		stbi_set_flip_vertically_on_load(true);
+		MipChain chain;
+		return load(filename, chain, srgb);
+	}
+
+	// resamples a chain to a new base size, used to fit textures into a texture array
+	static void resample(const MipChain& src, int width, int height, MipChain& dst);
+};
+
+// Texture LOD from a ray cone (Akenine-Moller et al. 2019), mirrors triangleLOD() and
+// coneLOD() in TextureLOD.shader. The triangle part is independent of the texture, the
+// texture size is added per map by TextureSampler::sampleCone
+inline float triangleLOD(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec2 ta, glm::vec2 tb, glm::vec2 tc)
+{
+	glm::vec2 t1 = tb - ta;
+	glm::vec2 t2 = tc - ta;
+	float t_area = glm::abs(t1.x * t2.y - t2.x * t1.y);
+	float p_area = glm::length(glm::cross(b - a, c - a));
+	if (t_area <= 0.0f || p_area <= 0.0f)
+		return 0.0f;
+	return 0.5f * log2f(t_area / p_area);
+}
+
+// LOD of a map with one texel per unit of uv
+inline float coneLOD(float triangle_lod, float cone_width, glm::vec3 normal, glm::vec3 dir)
+{
+	float lod = triangle_lod + log2f(glm::max(glm::abs(cone_width), 1e-8f));
+	lod -= log2f(glm::max(glm::abs(glm::dot(normal, dir)), 0.0001f));
+	return lod;
+}
+
+// CPU trilinear sampler with repeat wrapping, returns linear RGB for color maps
+class TextureSampler
+{
+	const MipChain* chain;
+
+	glm::vec3 fetch(int level, int x, int y) const
+	{
+		int w = chain->levelWidth(level);
+		int h = chain->levelHeight(level);
+		x = ((x % w) + w) % w;
+		y = ((y % h) + h) % h;
+		const unsigned char* p = &chain->levels[level][(y * w + x) * 3];
+		if (!chain->srgb)
+			return glm::vec3(p[0], p[1], p[2]) / 255.0f;
+		return glm::vec3(TextureCache::srgbToLinear(p[0]), TextureCache::srgbToLinear(p[1]), TextureCache::srgbToLinear(p[2]));
+	}
+
+	glm::vec3 bilinear(int level, glm::vec2 uv) const
+	{
+		float x = uv.x * chain->levelWidth(level) - 0.5f;
+		float y = uv.y * chain->levelHeight(level) - 0.5f;
+		int x0 = (int)floorf(x);
+		int y0 = (int)floorf(y);
+		float fx = x - x0;
+		float fy = y - y0;
+		glm::vec3 top = fetch(level, x0, y0) * (1.0f - fx) + fetch(level, x0 + 1, y0) * fx;
+		glm::vec3 bottom = fetch(level, x0, y0 + 1) * (1.0f - fx) + fetch(level, x0 + 1, y0 + 1) * fx;
+		return top * (1.0f - fy) + bottom * fy;
+	}
+
+public:
+	TextureSampler(const MipChain* chain) : chain(chain)
+	{
+
+	}
+
+	glm::vec3 sample(glm::vec2 uv, float lod) const
+	{
+		if (chain->levels.empty())
+			return glm::vec3(0.0f);
+
+		lod = glm::clamp(lod, 0.0f, (float)(chain->levels.size() - 1));
+		int level = (int)floorf(lod);
+		float t = lod - level;
+		glm::vec3 col = bilinear(level, uv);
+		if (t > 0.0f && level + 1 < (int)chain->levels.size())
+			col = col * (1.0f - t) + bilinear(level + 1, uv) * t;
+		return col;
+	}
+
+	// samples with the LOD of a ray cone hitting the surface, like mapLookup() on the GPU
+	glm::vec3 sampleCone(glm::vec2 uv, float triangle_lod, float cone_width, glm::vec3 normal, glm::vec3 dir) const
+	{
+		float lod = coneLOD(triangle_lod, cone_width, normal, dir) + 0.5f * log2f((float)chain->width * chain->height);
+		return sample(uv, lod);
+	}
+};
+
+inline void TextureCache::resample(const MipChain& src, int width, int height, MipChain& dst)
+{
+	dst.srgb = src.srgb;
+	dst.width = width;
+	dst.height = height;
+	dst.levels.clear();
+
+	if (src.width == width && src.height == height)
+	{
+		dst.levels = src.levels;
+		return;
+	}
+
+	// sample the source level closest to the new texel size so downscales do not alias
+	float lod = glm::max(0.0f, log2f(glm::max((float)src.width / width, (float)src.height / height)));
+	TextureSampler sampler(&src);
+
+	std::vector<unsigned char> base(width * height * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			glm::vec3 col = sampler.sample(glm::vec2((x + 0.5f) / width, (y + 0.5f) / height), lod);
+			base[(y * width + x) * 3 + 0] = encode(col.x, src.srgb);
+			base[(y * width + x) * 3 + 1] = encode(col.y, src.srgb);
+			base[(y * width + x) * 3 + 2] = encode(col.z, src.srgb);
+		}
+	}
+	dst.levels.push_back(std::move(base));
+	generateMips(dst);
+}
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+#include "Camera.h"
+
+// cost of tracing rays through the BVH, the same counts as TraversalStats in
+// Shaders/Include/Traverse.shader
+struct TraversalStats
+{
+	int nodes = 0; // bounds tested
+	int leaves = 0;
+	int triangles = 0;
+	int max_stack = 0; // deepest the stack got
+};
+
+// Distribution of the traversal costs of many rays. The layout matches the traversal
+// histogram buffer the cost view writes on the GPU, so both can be read the same way
+struct TraversalHistogram
+{
+	enum Stat
+	{
+		NODES,
+		LEAVES,
+		TRIANGLES,
+		STACK,
+		NUM_STATS
+	};
+	static const int num_bins = 64;
+	// costs covered by one bin, the last bin also holds everything above it
+	static constexpr int bin_widths[NUM_STATS] = { 4, 1, 4, 1 };
+
+	unsigned int rays;
+	unsigned int sums[NUM_STATS];
+	unsigned int max[NUM_STATS];
+	unsigned int bins[NUM_STATS][num_bins];
+
+	TraversalHistogram()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		memset(this, 0, sizeof(TraversalHistogram));
+	}
+
+	void add(const TraversalStats& stats)
+	{
+		int values[NUM_STATS] = { stats.nodes, stats.leaves, stats.triangles, stats.max_stack };
+		rays++;
+		for (int i = 0; i < NUM_STATS; ++i)
+		{
+			sums[i] += values[i];
+			max[i] = glm::max(max[i], (unsigned int)values[i]);
+			bins[i][glm::min(values[i] / bin_widths[i], num_bins - 1)]++;
+		}
+	}
+
+	float mean(int stat) const
+	{
+		return rays > 0 ? (float)sums[stat] / (float)rays : 0.0f;
+	}
+
+	// fraction of the rays in each bin, for plotting
+	void fractions(int stat, float* values) const
+	{
+		for (int i = 0; i < num_bins; ++i)
+			values[i] = rays > 0 ? (float)bins[stat][i] / (float)rays : 0.0f;
+	}
+
+	static const char* name(int stat)
+	{
+		static const char* names[NUM_STATS] = { "Nodes", "Leaves", "Triangles", "Stack Depth" };
+		return names[stat];
+	}
+};
+
+// Reference traversal on the CPU, the same algorithm and intersection tests as the
+// shaders so its costs can validate the GPU counts and BVH changes without a context
+class BVHTraversal
+{
+	const Scene* scene;
+	bool stackless; // parent link traversal, STACKLESS_TRAVERSAL in the shaders
+
+	enum State
+	{
+		FROM_PARENT,
+		FROM_SIBLING,
+		FROM_CHILD
+	};
+
+	// ray terms of the slab test like BoxRay in Intersect.shader
+	struct BoxRay
+	{
+		glm::vec3 inv;
+		glm::vec3 org_inv;
+
+		BoxRay(const glm::vec3& start, const glm::vec3& dir)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				float d = glm::abs(dir[i]) < 1e-12f ? (dir[i] < 0.0f ? -1e-12f : 1e-12f) : dir[i];
+				inv[i] = 1.0f / d;
+			}
+			org_inv = start * inv;
+		}
+	};
+
+	static constexpr float box_miss = 1e30f;
+
+	// distance the ray enters the box, box_miss if it misses or enters beyond max_dist
+	float intersectNode(const Node& node, const BoxRay& ray, float max_dist) const
+	{
+		glm::vec3 t1 = node.min * ray.inv - ray.org_inv;
+		glm::vec3 t2 = node.max * ray.inv - ray.org_inv;
+		glm::vec3 t_near = glm::min(t1, t2);
+		glm::vec3 t_far = glm::max(t1, t2);
+
+		float tmin = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.0f));
+		float tmax = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, max_dist));
+
+		return tmin <= tmax ? tmin : box_miss;
+	}
+
+	// Moller-Trumbore like intersectTriangle() in Intersect.shader, 0 on a miss
+	static float intersectTriangle(const glm::vec3& start, const glm::vec3& dir, const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, bool parallelogram)
+	{
+		glm::vec3 ray_cross_e2 = glm::cross(dir, e2);
+		float det = glm::dot(e1, ray_cross_e2);
+		if (det > -0.0000001f && det < 0.0000001f)
+			return 0.0f;
+
+		float inv_det = 1.0f / det;
+		glm::vec3 s = start - a;
+		float u = inv_det * glm::dot(s, ray_cross_e2);
+		if (u < 0.0f || u > 1.0f)
+			return 0.0f;
+
+		glm::vec3 s_cross_e1 = glm::cross(s, e1);
+		float v = inv_det * glm::dot(dir, s_cross_e1);
+		if (v < 0.0f || (parallelogram ? v > 1.0f : u + v > 1.0f))
+			return 0.0f;
+
+		float t = inv_det * glm::dot(e2, s_cross_e1);
+		return t > 0.00001f ? t : 0.0f;
+	}
+
+	static float nearestRoot(float t_near, float t_far)
+	{
+		if (t_near > 0.00001f)
+			return t_near;
+		return t_far > 0.00001f ? t_far : 0.0f;
+	}
+
+	// distance to the primitive, 0 on a miss
+	float intersectPrimitive(const Primitive& prim, const glm::vec3& start, const glm::vec3& dir) const
+	{
+		glm::vec3 a = glm::vec3(scene->scene_data.vertices[prim.vertex_a]);
+		glm::vec3 b = glm::vec3(scene->scene_data.vertices[prim.vertex_b]);
+		glm::vec3 c = glm::vec3(scene->scene_data.vertices[prim.vertexC()]);
+
+		switch (prim.type())
+		{
+		case SPHERE_PRIMITIVE:
+		{
+			glm::vec3 oc = start - a;
+			float qa = glm::dot(dir, dir);
+			float qb = glm::dot(oc, dir);
+			float qc = glm::dot(oc, oc) - glm::dot(b - a, b - a);
+			float h = qb * qb - qa * qc;
+			if (h < 0.0f)
+				return 0.0f;
+			h = glm::sqrt(h);
+			return nearestRoot((-qb - h) / qa, (-qb + h) / qa);
+		}
+		case PLANE_PRIMITIVE:
+			return intersectTriangle(start, dir, a, b - a, c - a, true);
+		case BOX_PRIMITIVE:
+		{
+			glm::vec3 inv = 1.0f / dir;
+			glm::vec3 t1 = (glm::min(a, b) - start) * inv;
+			glm::vec3 t2 = (glm::max(a, b) - start) * inv;
+			glm::vec3 t_near = glm::min(t1, t2);
+			glm::vec3 t_far = glm::max(t1, t2);
+			float tmin = glm::max(glm::max(t_near.x, t_near.y), t_near.z);
+			float tmax = glm::min(glm::min(t_far.x, t_far.y), t_far.z);
+			return tmax < tmin ? 0.0f : nearestRoot(tmin, tmax);
+		}
+		default:
+			return intersectTriangle(start, dir, a, b - a, c - a, false);
+		}
+	}
+
+	// tests the triangles of a leaf against the closest hit so far
+	void intersectLeaf(const Node& node, const glm::vec3& start, const glm::vec3& dir, float& t, int& prim, TraversalStats& stats) const
+	{
+		stats.leaves++;
+		stats.triangles += node.prim_count;
+		for (int i = 0; i < node.prim_count; ++i)
+		{
+			float distance = intersectPrimitive(scene->primitives[node.prim_index + i], start, dir);
+			if (distance > 0.0f && distance < t)
+			{
+				t = distance;
+				prim = node.prim_index + i;
+			}
+		}
+	}
+
+	int nearChild(int index, const Node& node, const glm::vec3& dir) const
+	{
+		return dir[node.axis] < 0.0f ? node.left : index + 1;
+	}
+
+	int sibling(int index, int parent) const
+	{
+		return index == parent + 1 ? scene->nodes[parent].left : parent + 1;
+	}
+
+	void closestHitStackless(const glm::vec3& start, const glm::vec3& dir, float& t, int& prim, TraversalStats& stats) const
+	{
+		BoxRay box(start, dir);
+		int current = 0;
+		State state = FROM_SIBLING; // the root has no sibling
+		while (current >= 0)
+		{
+			if (state == FROM_CHILD)
+			{
+				if (current == 0)
+					break;
+				int parent = scene->nodes[current].parent;
+				if (current == nearChild(parent, scene->nodes[parent], dir))
+				{
+					current = sibling(current, parent);
+					state = FROM_SIBLING;
+				}
+				else
+				{
+					current = parent;
+				}
+				continue;
+			}
+
+			const Node& node = scene->nodes[current];
+			stats.nodes++;
+			bool hit = intersectNode(node, box, t) < box_miss;
+			if (hit && node.prim_index < 0) // interior
+			{
+				current = nearChild(current, node, dir);
+				state = FROM_PARENT;
+				continue;
+			}
+
+			if (hit)
+				intersectLeaf(node, start, dir, t, prim, stats);
+			if (state == FROM_PARENT)
+			{
+				current = sibling(current, node.parent);
+				state = FROM_SIBLING;
+			}
+			else
+			{
+				current = node.parent;
+				state = FROM_CHILD;
+			}
+		}
+	}
+
+public:
+	BVHTraversal(const Scene* scene, bool stackless = false) : scene(scene), stackless(stackless)
+	{
+
+	}
+
+	// closest triangle along the ray like closestHit() in the shaders, prim is -1 on a miss
+	bool closestHit(const glm::vec3& start, const glm::vec3& dir, float& t, int& prim, TraversalStats& stats) const
+	{
+		t = 999999.9f;
+		prim = -1;
+		if (scene->num_nodes == 0)
+			return false;
+		if (stackless)
+		{
+			closestHitStackless(start, dir, t, prim, stats);
+			return prim >= 0;
+		}
+
+		BoxRay box(start, dir);
+		stats.nodes++;
+		if (intersectNode(scene->nodes[0], box, t) == box_miss)
+			return false;
+
+		// far children still to visit and the distance the ray enters them
+		std::vector<std::pair<int, float>> nodes_to_visit;
+		int current_node = 0;
+		while (true)
+		{
+			const Node& node = scene->nodes[current_node];
+			if (node.prim_index > -1) // leaf
+			{
+				intersectLeaf(node, start, dir, t, prim, stats);
+				current_node = -1;
+			}
+			else // interior, the child the ray enters first is visited first
+			{
+				int near_node = current_node + 1;
+				int far_node = node.left;
+				float near_dist = intersectNode(scene->nodes[near_node], box, t);
+				float far_dist = intersectNode(scene->nodes[far_node], box, t);
+				stats.nodes += 2;
+				if (far_dist < near_dist)
+				{
+					std::swap(near_node, far_node);
+					std::swap(near_dist, far_dist);
+				}
+
+				current_node = near_dist < box_miss ? near_node : -1;
+				if (far_dist < box_miss)
+				{
+					nodes_to_visit.push_back(std::make_pair(far_node, far_dist));
+					stats.max_stack = glm::max(stats.max_stack, (int)nodes_to_visit.size());
+				}
+			}
+
+			// nodes pushed before a closer hit was found may be behind it now
+			while (current_node < 0 && !nodes_to_visit.empty())
+			{
+				if (nodes_to_visit.back().second < t)
+					current_node = nodes_to_visit.back().first;
+				nodes_to_visit.pop_back();
+			}
+			if (current_node < 0)
+				break;
+		}
+		return prim >= 0;
+	}
+
+	// costs of the primary rays through the pixel centers of a width x height image, the
+	// rays of the traversal cost view
+	void primaryCosts(const Camera* camera, int width, int height, TraversalHistogram& histogram) const
+	{
+		glm::mat4 inverse = glm::inverse(camera->view);
+		glm::vec3 start = glm::vec3(inverse * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		float aspect = (float)width / (float)height;
+
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				glm::vec2 uv = glm::vec2((x + 0.5f) / width, (y + 0.5f) / height);
+				glm::vec3 end = glm::vec3(inverse * glm::vec4((uv.x - 0.5f) * aspect, uv.y - 0.5f, -1.0f, 1.0f));
+
+				TraversalStats stats;
+				float t;
+				int prim;
+				closestHit(start, glm::normalize(end - start), t, prim, stats);
+				histogram.add(stats);
+			}
+		}
+	}
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Scene.h"
+#include "Profiler.h"
+
+// ray queue entries, match the std430 layouts in the Wavefront shaders
+struct WavefrontPath
+{
+	glm::vec4 origin;
+	glm::vec4 dir;
+	glm::vec4 throughput;
+	unsigned int pixel;
+	unsigned int seed;
+	unsigned int depth;
+	unsigned int normal;
+};
+
+struct WavefrontHit
+{
+	float t;
+	float u;
+	float v;
+	int prim;
+};
+
+struct WavefrontShadowRay
+{
+	glm::vec4 origin;
+	glm::vec4 dir;
+	glm::vec4 radiance;
+	unsigned int pixel;
+	unsigned int pad[3];
+};
+
+struct WavefrontQueues
+{
+	unsigned int path_count[2];
+	unsigned int shadow_count;
+	unsigned int extend_fetch;
+	unsigned int shade_fetch;
+	unsigned int shadow_fetch;
+};
+
+// Wavefront path tracer (Laine et al., "Megakernels Considered Harmful"). Instead of one
+// invocation running a whole path, every bounce runs separate compute passes over queues
+// of rays in SSBOs: extend finds the closest hits, shade evaluates materials and compacts
+// the surviving paths into the other queue, and shadow traces the light samples queued by
+// shade. Queue lengths stay on the GPU, the extend, shade, and shadow passes run a fixed
+// number of persistent workgroups whose invocations fetch paths until their queue is empty.
+class WavefrontPathTracer
+{
+	Shader* generate_shader;
+	Shader* extend_shader;
+	Shader* shade_shader;
+	Shader* shadow_shader;
+	Shader* resolve_shader;
+
+	unsigned int path_buffer; // two queues of max_paths, ping-ponged between bounces
+	unsigned int hit_buffer;
+	unsigned int shadow_buffer;
+	unsigned int radiance_buffer;
+	unsigned int queue_buffer;
+	unsigned int feature_buffer; // first hit albedo and normal per pixel
+
+	int max_paths; // one path per pixel of the largest resolution
+
+	void setUniforms(Shader* shader, int queue)
+	{
+		shader->use();
+		shader->setInt("queue", queue);
+		shader->setInt("max_paths", max_paths);
+	}
+
+	void barrier()
+	{
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+
+public:
+	int max_depth;
+	int persistent_groups; // workgroups of 64 threads for the queue passes
+
+	Profiler* profiler; // per pass gpu timers, summed over the bounces of a frame
+
+	WavefrontPathTracer(const std::string& defines = "") : generate_shader(NULL), extend_shader(NULL), shade_shader(NULL), shadow_shader(NULL), resolve_shader(NULL),
+		path_buffer(0), hit_buffer(0), shadow_buffer(0), radiance_buffer(0), queue_buffer(0), feature_buffer(0),
+		max_paths(0), max_depth(8), persistent_groups(256), profiler(NULL)
+	{
+		compileShaders(defines);
+	}
+
+	~WavefrontPathTracer()
+	{
+		delete(generate_shader);
+		delete(extend_shader);
+		delete(shade_shader);
+		delete(shadow_shader);
+		delete(resolve_shader);
+
+		unsigned int buffers[] = { path_buffer, hit_buffer, shadow_buffer, radiance_buffer, queue_buffer, feature_buffer };
+		glDeleteBuffers(6, buffers);
+	}
+
+	// defines specialize the passes, see Renderer::shaderDefines()
+	void compileShaders(const std::string& defines)
+	{
+		delete(generate_shader);
+		delete(extend_shader);
+		delete(shade_shader);
+		delete(shadow_shader);
+		delete(resolve_shader);
+
+		generate_shader = new Shader("Shaders/WavefrontGenerate.shader", defines);
+		extend_shader = new Shader("Shaders/WavefrontExtend.shader", defines);
+		shade_shader = new Shader("Shaders/WavefrontShade.shader", defines);
+		shadow_shader = new Shader("Shaders/WavefrontShadow.shader", defines);
+		resolve_shader = new Shader("Shaders/WavefrontResolve.shader", defines);
+	}
+
+	void createBuffers(int width, int height)
+	{
+		max_paths = width * height;
+
+		unsigned int buffers[] = { path_buffer, hit_buffer, shadow_buffer, radiance_buffer, queue_buffer, feature_buffer };
+		glDeleteBuffers(6, buffers);
+
+		glGenBuffers(1, &path_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, path_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(WavefrontPath) * max_paths * 2, NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, path_buffer);
+
+		glGenBuffers(1, &hit_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, hit_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(WavefrontHit) * max_paths, NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, hit_buffer);
+
+		glGenBuffers(1, &shadow_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadow_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(WavefrontShadowRay) * max_paths, NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, shadow_buffer);
+
+		glGenBuffers(1, &radiance_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, radiance_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * max_paths, NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, radiance_buffer);
+
+		glGenBuffers(1, &queue_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(WavefrontQueues), NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, queue_buffer);
+
+		glGenBuffers(1, &feature_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, feature_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * 2 * max_paths, NULL, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, feature_buffer);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// renders one sample per pixel of a width x height region into the running average
+	// in accumulate_texture and the first hit features into albedo_texture and
+	// normal_texture, the region must fit the size given to createBuffers. The scene
+	// buffers and the texture arrays must already be bound
+	void render(unsigned int accumulate_texture, unsigned int albedo_texture, unsigned int normal_texture, int width, int height)
+	{
+		int groups_x = (width + 7) / 8;
+		int groups_y = (height + 7) / 8;
+
+		// every pixel starts a path in queue 0
+		WavefrontQueues queues = {};
+		queues.path_count[0] = width * height;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue_buffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(WavefrontQueues), &queues);
+
+		{
+			GpuTimer timer(profiler, "wavefront generate");
+			setUniforms(generate_shader, 0);
+			glDispatchCompute(groups_x, groups_y, 1);
+			barrier();
+		}
+
+		shade_shader->use();
+		Scene::setMaterialTextureUnits(shade_shader);
+		shade_shader->setInt("skybox_texture", 1);
+		shade_shader->setInt("max_depth", max_depth);
+
+		for (int depth = 0; depth < max_depth; ++depth)
+		{
+			int queue = depth % 2;
+
+			// clear the queue shade writes into, the shadow queue, and the fetch counters
+			unsigned int zero[4] = { 0, 0, 0, 0 };
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue_buffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int) * (1 - queue), sizeof(unsigned int), zero);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(WavefrontQueues, shadow_count), sizeof(unsigned int) * 4, zero);
+
+			{
+				GpuTimer timer(profiler, "wavefront extend");
+				setUniforms(extend_shader, queue);
+				glDispatchCompute(persistent_groups, 1, 1);
+				barrier();
+			}
+
+			{
+				GpuTimer timer(profiler, "wavefront shade");
+				setUniforms(shade_shader, queue);
+				glDispatchCompute(persistent_groups, 1, 1);
+				barrier();
+			}
+
+			{
+				GpuTimer timer(profiler, "wavefront shadow");
+				setUniforms(shadow_shader, queue);
+				glDispatchCompute(persistent_groups, 1, 1);
+				barrier();
+			}
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		GpuTimer timer(profiler, "wavefront resolve");
+		setUniforms(resolve_shader, 0);
+		glBindImageTexture(0, accumulate_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(1, albedo_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(2, normal_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glDispatchCompute(groups_x, groups_y, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	}
+};
@@ -13,11 +13,21 @@
 #include "Scene.h"
 #include "Renderer.h"
 #include "BVH.h"
+#include "SceneEditor.h"
 #include "Material.h"
+#include "AssetLoader.h"
+#include "Profiler.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "BatchRender.h"
+#include "DistributedRender.h"
+#include "Benchmark.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-	glViewport(0, 0, width, height);
+	// minimized windows report a zero size, keep the old buffers until it is restored
+	Renderer* renderer = (Renderer*)glfwGetWindowUserPointer(window);
+	if (renderer && width > 0 && height > 0)
+		renderer->createBuffers(width, height);
 }
 
 void processInput(GLFWwindow* window)
@@ -26,39 +36,6 @@ void processInput(GLFWwindow* window)
 		glfwSetWindowShouldClose(window, true);
 }
 
-unsigned int textureFromFile(const std::string& filename, unsigned int texture_type = GL_TEXTURE_2D)
-{
-	stbi_set_flip_vertically_on_load(true);
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, num_components;
-	std::cout << "filename: " << filename << std::endl;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &num_components, 0);
-	std::cout << "stbi loaded texture: " << textureID << std::endl;
-	if (data)
-	{
-		glBindTexture(texture_type, textureID);
-		glTexImage2D(texture_type, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-		glTexParameteri(texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << filename << std::endl;
-		stbi_image_free(data);
-	}
-	return textureID;
-}
 unsigned int CubemapFromFile(std::vector<std::string>& faces, const std::string& directory, bool linearize)
 {
 	stbi_set_flip_vertically_on_load(false);
@@ -123,19 +100,46 @@ unsigned int CubemapFromFile(std::vector<std::string>& faces, const std::string&
 	return textureID;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+	// offline texture preprocessing: RayTracing --bake-textures <image>... [--linear <image>...],
+	// images after --linear are data maps and get the .lin.mip cache
+	if (argc > 1 && std::string(argv[1]) == "--bake-textures")
+	{
+		bool srgb = true;
+		for (int i = 2; i < argc; ++i)
+		{
+			if (std::string(argv[i]) == "--linear")
+			{
+				srgb = false;
+				continue;
+			}
+			if (!TextureCache::bake(argv[i], srgb))
+				std::cout << "Texture failed to load at path: " << argv[i] << std::endl;
+		}
+		return 0;
+	}
+
+	// offline render to files: RayTracing --render <scene file> [options]
+	if (argc > 1 && std::string(argv[1]) == "--render")
+		return batchRender(argc, argv);
+
+	// timings over the bundled assets: RayTracing --benchmark [options]
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
+		return benchmark(argc, argv);
+
+	// the same render split over worker processes, see DistributedRender.h
+	if (argc > 1 && std::string(argv[1]) == "--coordinate")
+		return coordinateRender(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--worker")
+		return workerRender(argc, argv);
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-	const int screen_width = 1200;
-	const int screen_height = 800;
-
-	GLFWwindow* window = glfwCreateWindow(screen_width, screen_height, "Ray Tracing v3", NULL, NULL);
+	GLFWwindow* window = glfwCreateWindow(1200, 800, "Ray Tracing v3", NULL, NULL);
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -150,9 +154,12 @@ int main()
 		return -1;
 	}
 
+	int screen_width, screen_height;
+	glfwGetFramebufferSize(window, &screen_width, &screen_height);
 	glViewport(0, 0, screen_width, screen_height);
 
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	// cpu and gpu timings, shown in imgui and exported as a trace
+	Profiler* profiler = new Profiler();
 
 	// camera
 	Camera* camera = new Camera(glm::vec3(0.0f, -25.0f, 5.0f),
@@ -162,117 +169,172 @@ int main()
 	// scene
 	Scene* scene = new Scene();
 
-	glActiveTexture(GL_TEXTURE0);
-	unsigned int base_map = textureFromFile("Objects/inn/bakeInn_baseColor.png");
-	scene->setBaseMap(base_map);
+	double load_start = profiler->now();
+
+	// queue textures and objects on the loader threads
+	AssetLoader* loader = new AssetLoader(scene);
 
-	glActiveTexture(GL_TEXTURE1);
-	unsigned int skybox = textureFromFile("cathedral.jpg");
-	scene->setEnvironmentMap(skybox);
+	// material maps are queued by the loader from the mtl files
+	int skybox = loader->loadTexture("cathedral.jpg");
 
-	glActiveTexture(GL_TEXTURE2);
-	unsigned int emission_map = textureFromFile("Objects/inn/bakeInn_emissive.png");
-	scene->setEmissiveMap(emission_map);
+	loader->loadObject("Objects/Stanford_Dragon/", "scene.obj", glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.1f));
+	loader->loadObject("Objects/", "quad.obj", glm::vec3(-15.0f, 15.0f, 0.0f), glm::vec3(1.0f));
+	//loader->loadObject("Objects/turtle/", "scene.obj", glm::vec3(0.0f), glm::vec3(1.0f));
+	//loader->loadObject("Objects/rosary/", "scene.obj", glm::vec3(0.0f, 0.0f, 0.075f), glm::vec3(50.0f));
+	//loader->loadObject("Objects/", "icosahedron.obj", glm::vec3(10.0f, 10.0f, 10.0f), glm::vec3(2.0f));
+	//loader->loadObject("Objects/", "icosahedron.obj", glm::vec3(-5.0f, 7.0f, 15.0f), glm::vec3(2.0f));
+	//loader->loadObject("Objects/", "icosahedron.obj", glm::vec3(0.0f, -12.0f, 12.0f), glm::vec3(2.0f));
+	//loader->loadObject("Objects/inn/", "scene.obj", glm::vec3(-60.0f, 0.0f, -10.0f), glm::vec3(2.0f));
 
-	// renderer
+	// renderer, shaders compile while the loader threads work
 	Renderer* renderer = new Renderer(camera);
 	renderer->createBuffers(screen_width, screen_height);
-	
-	// loading objects
-	scene->loadObject("Objects/Stanford_Dragon/", "scene.obj", glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.1f));
-	scene->loadObject("Objects/", "quad.obj", glm::vec3(-15.0f, 15.0f, 0.0f), glm::vec3(1.0f));
-	//scene->loadObject("Objects/turtle/", "scene.obj", glm::vec3(0.0f), glm::vec3(1.0f));
-	//scene->loadObject("Objects/rosary/", "scene.obj", glm::vec3(0.0f, 0.0f, 0.075f), glm::vec3(50.0f));
-	//scene->loadObject("Objects/", "icosahedron.obj", glm::vec3(10.0f, 10.0f, 10.0f), glm::vec3(2.0f));
-	//scene->loadObject("Objects/", "icosahedron.obj", glm::vec3(-5.0f, 7.0f, 15.0f), glm::vec3(2.0f));
-	//scene->loadObject("Objects/", "icosahedron.obj", glm::vec3(0.0f, -12.0f, 12.0f), glm::vec3(2.0f));
-	//scene->loadObject("Objects/inn/", "scene.obj", glm::vec3(-60.0f, 0.0f, -10.0f), glm::vec3(2.0f));
-
-	debug_start(glfwGetTime(), 0);
+	renderer->setProfiler(profiler);
+
+	// the render resolution follows the window, rendering can be scaled down from it
+	glfwSetWindowUserPointer(window, renderer);
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+	// imgui
+	renderer->initImGui(window);
+
+	// keep the window responsive until everything is loaded
+	while (!loader->isDone() && !glfwWindowShouldClose(window))
+	{
+		loader->update();
+
+		renderer->updateImGui();
+		loader->ImGuiDisplayProgress();
+
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		renderer->renderImGui();
+
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+	}
+
+	// closed before loading finished, the workers stop after their current job
+	if (!loader->isDone())
+	{
+		delete(loader);
+		delete(camera);
+		delete(renderer);
+		delete(scene);
+		delete(profiler);
+
+		glfwTerminate();
+		return 0;
+	}
+
+	scene->setEnvironmentMap(loader->getTexture(skybox));
+
+	// the path tracers were compiled with map lookups before the materials were known
+	renderer->setTextureMaps(!scene->color_texture_files.empty() || !scene->data_texture_files.empty());
+
+	delete(loader);
+
+	profiler->addCpuTime("asset load", load_start);
+	dlogln("Asset load time: " << profiler->cpuTime("asset load") << " ms");
 
 	// creating BVH
-	BVH* bvh = new BVH(scene);
-	bvh->computeBVH();
-	delete(bvh);
-	scene->createBVHBuffer();
+	{
+		CpuTimer timer(profiler, "bvh build");
+		BVH* bvh = new BVH(scene);
+		bvh->computeBVH();
+		delete(bvh);
+	}
 
-	// send vertex data to GPU
-	scene->createSceneBuffer();
+	{
+		CpuTimer timer(profiler, "scene upload");
+		scene->createBVHBuffer();
 
-	// send material data to GPU
-	scene->createMaterialBuffer();
+		// send vertex data to GPU
+		scene->createSceneBuffer();
 
-	// send primitive data to GPU
-	scene->createPrimitiveBuffer();
+		// send material data to GPU
+		scene->createMaterialBuffer();
 
-	debug_end(glfwGetTime(), 0);
+		// send primitive data to GPU
+		scene->createPrimitiveBuffer();
 
-	dlogln("BVH build time: " << debug_time(0));
+		// emissive primitives for light sampling
+		scene->createLightBuffer();
+	}
 
+	dlogln("BVH build time: " << profiler->cpuTime("bvh build") << " ms");
+	dlogln("Scene upload time: " << profiler->cpuTime("scene upload") << " ms");
+
+	// edits after loading only upload what changed
+	SceneEditor* editor = new SceneEditor(scene);
 
-	// imgui
-	renderer->initImGui(window);
 
 	int curr_frame = 1;
 
 	float delta_time = 0.0f;
 	float last_frame = 0.0f;
 
-	float delta_time_list[100];
-	for (unsigned int i = 0; i < 100; ++i)
-		delta_time_list[i] = 0;
-	int dt_index = 0;
-	float dt_avg = 0;
-
 	while (!glfwWindowShouldClose(window))
 	{
+		profiler->beginFrame();
+
 		// imgui update
 		renderer->updateImGui();
 		if (scene->ImGuiDisplayMaterialTree())
 		{
 			renderer->resetAccumulate();
 		}
-		renderer->ImGuiDisplayDebugViewRadio();
-
-		processInput(window);
-		if (camera->processInput(window, delta_time))
+		if (editor->ImGuiDisplayObjectTree())
 		{
 			renderer->resetAccumulate();
 		}
+		renderer->ImGuiDisplayDebugViewRadio();
+		profiler->ImGuiDisplayProfiler();
+
+		processInput(window);
+		// the renderer reprojects or restarts the image when the view changes
+		bool moving = camera->processInput(window, delta_time);
+		renderer->setMoving(moving);
 
 		float current_frame = (float)glfwGetTime();
 		delta_time = current_frame - last_frame;
 		last_frame = current_frame;
 
-		debug_start(glfwGetTime(), 0);
+		// upload scene edits
+		{
+			CpuTimer timer(profiler, "scene upload");
+			if (editor->update())
+			{
+				renderer->resetAccumulate();
+			}
+		}
 
 		// render scene
-		renderer->render(scene);
+		{
+			CpuTimer timer(profiler, "render");
+			renderer->render(scene);
+		}
 
 		// imgui render
-		renderer->renderImGui();
+		{
+			GpuTimer timer(profiler, "imgui");
+			renderer->renderImGui();
+		}
 
-		glfwSwapBuffers(window);
+		{
+			CpuTimer timer(profiler, "swap");
+			glfwSwapBuffers(window);
+		}
 		glfwPollEvents();
 
-		debug_end(glfwGetTime(), 0);
-
 		curr_frame++;
-
-		delta_time_list[dt_index] = debug_time(0);
-		dt_index++;
-		dt_index = dt_index % 100;
-		dt_avg = 0;
-		for (unsigned int i = 0; i < 100; ++i)
-			dt_avg += delta_time_list[i];
-		dt_avg *= 0.01f;
-
-		//dlogln("time avg: " << dt_avg);
 	}
 
+	delete(editor);
 	delete(camera);
 	delete(renderer);
 	delete(scene);
+	delete(profiler);
 
 	glfwTerminate();
 	return 0;